@@ -0,0 +1,439 @@
+#include "string.h"
+#include "sys.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <vector>
+
+/*
+ * Benchmarks for wobble::str.
+ *
+ * Each benchmark prints one tab-separated line with its name, the input size
+ * class, the input size in bytes, nanoseconds per operation, throughput in
+ * MB/s and heap allocations per operation. Timings are the best of several
+ * runs, to reduce noise.
+ *
+ * Command line arguments, if present, select only the benchmarks whose name
+ * contains one of them.
+ */
+
+using namespace std;
+using namespace wobble;
+
+namespace {
+
+/// Number of allocations performed so far
+size_t allocations = 0;
+
+}
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* res = malloc(size ? size : 1))
+        return res;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+namespace {
+
+/// Accumulates results, so that the compiler cannot optimize operations away
+volatile size_t sink = 0;
+
+/// Input size classes
+struct SizeClass
+{
+    const char* name;
+    size_t size;
+};
+
+const SizeClass sizes[] = {
+    { "small", 16 },
+    { "medium", 1024 },
+    { "large", 1024 * 1024 },
+};
+
+/// Benchmark selection from the command line
+std::vector<std::string> filters;
+
+bool selected(const std::string& name)
+{
+    if (filters.empty())
+        return true;
+    for (const auto& f: filters)
+        if (name.find(f) != std::string::npos)
+            return true;
+    return false;
+}
+
+/**
+ * Measure func, which processes size bytes of input, and print the results.
+ *
+ * func is run repeatedly for at least 50ms, and the fastest of 5 such runs is
+ * reported.
+ */
+void measure(const std::string& name, const SizeClass& cls, size_t size, std::function<size_t()> func)
+{
+    if (!selected(name))
+        return;
+
+    // Warm up, then count allocations
+    sink = sink + func();
+    size_t before = allocations;
+    sink = sink + func();
+    size_t allocs = allocations - before;
+
+    const unsigned long long min_ns = 50000000;
+    double best = 0;
+    for (unsigned run = 0; run < 5; ++run)
+    {
+        // Run in doubling batches, to keep reading the clock out of the
+        // measurement of fast operations
+        unsigned long long iterations = 0;
+        unsigned long long batch = 1;
+        unsigned long long elapsed;
+        sys::Clock clock(CLOCK_MONOTONIC);
+        do {
+            for (unsigned long long i = 0; i < batch; ++i)
+                sink = sink + func();
+            iterations += batch;
+            batch *= 2;
+            elapsed = clock.elapsed();
+        } while (elapsed < min_ns);
+        double ns = (double)elapsed / iterations;
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+
+    printf("%s\t%s\t%zu\t%.1f\t%.1f\t%zu\n",
+            name.c_str(), cls.name, size, best, size * 1000.0 / best, allocs);
+    fflush(stdout);
+}
+
+/// Deterministic pseudorandom number generator
+struct Random
+{
+    uint32_t seed = 1;
+
+    unsigned operator()(unsigned max)
+    {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % max;
+    }
+};
+
+/// Generate size random bytes
+std::string random_bytes(size_t size)
+{
+    Random rnd;
+    std::string res(size, 0);
+    for (auto& c: res)
+        c = rnd(256);
+    return res;
+}
+
+/// Generate size bytes of text, with words, punctuation and spaces
+std::string random_text(size_t size)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789     .,;:-/\"\t";
+    Random rnd;
+    std::string res(size, 0);
+    for (auto& c: res)
+        c = chars[rnd(sizeof(chars) - 1)];
+    return res;
+}
+
+/// Generate a path of about size bytes, with . and .. components
+std::string random_path(size_t size)
+{
+    static const char* components[] = { "usr", "share", "doc", ".", "..", "wobble", "", "lib", "x86_64-linux-gnu" };
+    Random rnd;
+    std::string res;
+    while (res.size() < size)
+    {
+        res += '/';
+        res += components[rnd(sizeof(components) / sizeof(components[0]))];
+    }
+    res.resize(size);
+    return res;
+}
+
+void bench_split()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string text = random_text(cls.size);
+        measure("split", cls, text.size(), [&] {
+            size_t res = 0;
+            for (const auto& tok: str::Split(text, " ", true))
+                res += tok.size();
+            return res;
+        });
+        measure("split_view", cls, text.size(), [&] {
+            size_t res = 0;
+            for (const auto& tok: str::SplitView(text, " ", true))
+                res += tok.size();
+            return res;
+        });
+        str::Arena arena;
+        std::vector<std::string_view> tokens;
+        measure("split_arena", cls, text.size(), [&] {
+            arena.clear();
+            tokens.clear();
+            str::split_into(tokens, arena, text, " ", true);
+            return tokens.size();
+        });
+        str::Tokenizer tokenizer(text, " \t,;", true);
+        measure("tokenizer", cls, text.size(), [&] {
+            size_t res = 0;
+            for (const auto& tok: tokenizer)
+                res += tok.size();
+            return res;
+        });
+    }
+}
+
+void bench_join()
+{
+    for (const auto& cls: sizes)
+    {
+        std::vector<std::string> items;
+        size_t size = 0;
+        for (const auto& tok: str::Split(random_text(cls.size), " ", true))
+        {
+            items.push_back(tok);
+            size += tok.size() + 1;
+        }
+        measure("join", cls, size, [&] { return str::join(" ", items).size(); });
+
+        std::vector<unsigned> ids;
+        Random rnd;
+        size = 0;
+        while (size < cls.size)
+        {
+            ids.push_back(rnd(1000000));
+            size += std::to_string(ids.back()).size() + 1;
+        }
+        measure("join_numbers", cls, size, [&] { return str::join(",", ids).size(); });
+    }
+}
+
+void bench_normpath()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string path = random_path(cls.size);
+        measure("normpath", cls, path.size(), [&] { return str::normpath(path).size(); });
+    }
+
+    // Batches of short paths, as when processing directory listings
+    const SizeClass& cls = sizes[1];
+    std::vector<std::string> names;
+    size_t size = 0;
+    for (const auto& name: str::Split(random_text(cls.size), " ", true))
+    {
+        names.push_back(name);
+        size += name.size();
+    }
+    measure("joinpath_batch", cls, size, [&] {
+        std::vector<std::string> res;
+        for (const auto& name: names)
+            res.push_back(str::joinpath("/srv/data", name));
+        return res.size();
+    });
+    str::Arena arena;
+    std::vector<std::string_view> res;
+    measure("joinpath_batch_arena", cls, size, [&] {
+        arena.clear();
+        res.clear();
+        for (const auto& name: names)
+            res.push_back(str::joinpath(arena, {"/srv/data", name}));
+        return res.size();
+    });
+}
+
+void bench_url()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string text = random_text(cls.size);
+        std::string encoded = str::encode_url(text);
+        measure("encode_url", cls, text.size(), [&] { return str::encode_url(text).size(); });
+        measure("decode_url", cls, encoded.size(), [&] { return str::decode_url(encoded).size(); });
+    }
+}
+
+void bench_base64()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string data = random_bytes(cls.size);
+        std::string encoded = str::encode_base64(data);
+        measure("encode_base64", cls, data.size(), [&] { return str::encode_base64(data).size(); });
+        measure("decode_base64", cls, encoded.size(), [&] { return str::decode_base64(encoded).size(); });
+    }
+
+    // Compare the available implementations on large inputs
+    const SizeClass& cls = sizes[2];
+    std::string data = random_bytes(cls.size);
+    std::string encoded = str::encode_base64(data);
+    const std::pair<str::Base64Impl, const char*> impls[] = {
+        { str::Base64Impl::SCALAR, "scalar" },
+        { str::Base64Impl::SSE41, "sse4.1" },
+        { str::Base64Impl::AVX2, "avx2" },
+    };
+    for (const auto& impl: impls)
+    {
+        if (!str::base64_impl_supported(impl.first))
+            continue;
+        str::base64_set_impl(impl.first);
+        measure(std::string("encode_base64_") + impl.second, cls, data.size(), [&] { return str::encode_base64(data).size(); });
+        measure(std::string("decode_base64_") + impl.second, cls, encoded.size(), [&] { return str::decode_base64(encoded).size(); });
+    }
+    str::base64_set_impl(str::Base64Impl::AUTO);
+}
+
+void bench_hex()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string data = random_bytes(cls.size);
+        std::string encoded = str::encode_hex(data);
+        measure("encode_hex", cls, data.size(), [&] { return str::encode_hex(data).size(); });
+        measure("decode_hex", cls, encoded.size(), [&] { return str::decode_hex(encoded).size(); });
+    }
+
+    // Appending a digest to an existing buffer
+    const SizeClass& cls = sizes[0];
+    std::string digest = random_bytes(20);
+    std::string out;
+    measure("encode_hex_append", cls, digest.size(), [&] {
+        out.clear();
+        str::encode_hex_append(out, digest);
+        return out.size();
+    });
+}
+
+void bench_cstring()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string text = random_text(cls.size);
+        std::string encoded = str::encode_cstring(text);
+        measure("encode_cstring", cls, text.size(), [&] { return str::encode_cstring(text).size(); });
+        measure("decode_cstring", cls, encoded.size(), [&] {
+            size_t len;
+            return str::decode_cstring(encoded, len).size();
+        });
+
+        std::string data = random_bytes(cls.size);
+        measure("encode_cstring_binary", cls, data.size(), [&] { return str::encode_cstring(data).size(); });
+    }
+}
+
+void bench_utf8()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string text = random_text(cls.size);
+        measure("validate_utf8_ascii", cls, text.size(), [&] { return str::validate_utf8(text); });
+
+        // Mostly ASCII text with some multibyte characters
+        std::string mixed;
+        Random rnd;
+        static const char* chars[] = { "a", "b", " ", "è", "€", "𝄞" };
+        while (mixed.size() < cls.size)
+            mixed += chars[rnd(6)];
+        measure("validate_utf8", cls, mixed.size(), [&] { return str::validate_utf8(mixed); });
+        measure("count_codepoints", cls, mixed.size(), [&] { return str::count_codepoints(mixed); });
+    }
+}
+
+void bench_search()
+{
+    const SizeClass& cls = sizes[2];
+    std::string text = random_text(cls.size);
+    for (const char* needle: { "\n--", "END OF TRANSMISSION", "-----BEGIN CERTIFICATE----- MIIDdzCCAl+gAwIBAgIEAgAAuTANBgkqhkiG9w0BAQUFADBaMQswCQYDVQQGEwJJ" })
+    {
+        std::string len = std::to_string(strlen(needle));
+        str::Searcher searcher(needle);
+        measure("search_" + len, cls, text.size(), [&] { return searcher.find(text); });
+        measure("search_" + len + "_std", cls, text.size(), [&] { return std::string_view(text).find(needle); });
+    }
+
+    // Worst case for naive search
+    std::string pathological(cls.size, 'a');
+    std::string needle = std::string(40, 'a') + 'b';
+    str::Searcher searcher(needle);
+    measure("search_pathological", cls, pathological.size(), [&] { return searcher.find(pathological); });
+    measure("search_pathological_std", cls, pathological.size(), [&] { return std::string_view(pathological).find(needle); });
+}
+
+void bench_glob()
+{
+    // Match test names against a typical test filter
+    const SizeClass& cls = sizes[0];
+    std::vector<std::string> names;
+    Random rnd;
+    size_t size = 0;
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        names.push_back(std::string(i % 2 ? "string" : "sys") + ".method_" + std::to_string(rnd(1000000)));
+        size += names.back().size();
+    }
+    str::Glob glob("sys.*_{1,2}*");
+    measure("glob", cls, size, [&] {
+        size_t res = 0;
+        for (const auto& name: names)
+            res += glob.match(name);
+        return res;
+    });
+}
+
+void bench_case()
+{
+    for (const auto& cls: sizes)
+    {
+        std::string text = random_text(cls.size);
+        std::string padded = std::string(cls.size / 4, ' ') + text + std::string(cls.size / 4, ' ');
+        measure("strip", cls, padded.size(), [&] { return str::strip(padded).size(); });
+        measure("upper", cls, text.size(), [&] { return str::upper(text).size(); });
+        measure("lower", cls, text.size(), [&] { return str::lower(text).size(); });
+    }
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+        filters.emplace_back(argv[i]);
+
+    printf("benchmark\tinput\tbytes\tns/op\tMB/s\tallocs/op\n");
+    bench_split();
+    bench_join();
+    bench_normpath();
+    bench_url();
+    bench_base64();
+    bench_hex();
+    bench_cstring();
+    bench_case();
+    bench_search();
+    bench_glob();
+    bench_utf8();
+    return 0;
+}
@@ -1,5 +1,13 @@
 #include "tests.h"
 #include "string.h"
+#include <list>
+#include <sstream>
+#include <iterator>
+#include <fnmatch.h>
+#include <limits>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 
 using namespace std;
 using namespace wobble;
@@ -7,6 +15,33 @@ using namespace wobble::tests;
 
 namespace {
 
+/// Number of heap allocations performed so far, to test allocation-free code
+std::atomic<size_t> allocations(0);
+
+}
+
+// Not inlined, so that the compiler does not pair malloc and free with new
+// and delete expressions and warn about a mismatch
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* res = malloc(size ? size : 1))
+        return res;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+namespace {
+
 class Tests : public TestCase
 {
     using TestCase::TestCase;
@@ -36,6 +71,137 @@ class Tests : public TestCase
             vector<std::string> strs { "", "foo", "", "", "bar" };
             wassert(actual(str::join(",", strs)) == ",foo,,,bar");
             wassert(actual(str::join(",", strs.begin(), strs.end())) == ",foo,,,bar");
+            wassert(actual(str::join(",", vector<string>())) == "");
+            wassert(actual(str::join(", ", list<const char*>{ "a", "b" })) == "a, b");
+            wassert(actual(str::join("", vector<std::string_view>{ "a", "b", "c" })) == "abc");
+
+            // Numbers and other values
+            wassert(actual(str::join(" ", vector<long long>{ -9223372036854775807LL - 1, 0, 42 })) == "-9223372036854775808 0 42");
+            wassert(actual(str::join(" ", vector<double>{ 0.5, -2, 1e100 })) == "0.5 -2 1e+100");
+            wassert(actual(str::join("", vector<char>{ 'a', 'b' })) == "ab");
+            wassert(actual(str::join("", vector<bool>{ true, false })) == "10");
+            wassert(actual(str::join("|", vector<const void*>{ nullptr })) != "");
+
+            // Single pass iterators
+            std::istringstream in("foo bar baz");
+            wassert(actual(str::join("-", istream_iterator<string>(in), istream_iterator<string>())) == "foo-bar-baz");
+        });
+
+        add_method("join_into", []() {
+            std::string out("cmd:");
+            str::join_into(out, " ", vector<string>{ "a", "bb", "ccc" });
+            wassert(actual(out) == "cmd:a bb ccc");
+            vector<unsigned> ids { 1, 22, 333 };
+            str::join_into(out, ",", ids.begin(), ids.end());
+            wassert(actual(out) == "cmd:a bb ccc1,22,333");
+            str::join_into(out, ",", vector<int>());
+            wassert(actual(out) == "cmd:a bb ccc1,22,333");
+        });
+
+        add_method("parse", []() {
+            int i = 7;
+            wassert(actual((int)str::parse("42", i)) == 0);
+            wassert(actual(i) == 42);
+            wassert(actual((int)str::parse("-42", i)) == 0);
+            wassert(actual(i) == -42);
+            wassert(actual(str::parse("ff", i, 16) == std::errc()).istrue());
+            wassert(actual(i) == 255);
+
+            // Errors leave the result unchanged
+            wassert(actual(str::parse("", i) == std::errc::invalid_argument).istrue());
+            wassert(actual(str::parse(" 1", i) == std::errc::invalid_argument).istrue());
+            wassert(actual(str::parse("+1", i) == std::errc::invalid_argument).istrue());
+            wassert(actual(str::parse("12a", i) == std::errc::invalid_argument).istrue());
+            wassert(actual(i) == 255);
+            uint8_t u8 = 1;
+            wassert(actual(str::parse("256", u8) == std::errc::result_out_of_range).istrue());
+            wassert(actual(str::parse("-1", u8) == std::errc::invalid_argument).istrue());
+            wassert(actual((unsigned)u8) == 1u);
+
+            double d = 0;
+            wassert(actual(str::parse("1.5e3", d) == std::errc()).istrue());
+            wassert(actual(d) == 1500.0);
+            wassert(actual(str::parse("1.5.", d) == std::errc::invalid_argument).istrue());
+
+            wassert(actual(str::parse<unsigned>("4294967295")) == 4294967295u);
+            wassert(actual(str::parse<long long>("-9223372036854775808")) == std::numeric_limits<long long>::min());
+            wassert(actual(str::parse<float>("0.25")) == 0.25f);
+            wassert_throws(std::invalid_argument, str::parse<int>("foo"));
+            wassert_throws(std::out_of_range, str::parse<short>("65536"));
+        });
+
+        add_method("format_append", []() {
+            std::string out = "n=";
+            str::format_append(out, 42);
+            wassert(actual(out) == "n=42");
+            out.clear();
+            str::format_append(out, -1);
+            str::format_append(out, 18446744073709551615ull);
+            wassert(actual(out) == "-118446744073709551615");
+            out.clear();
+            str::format_append(out, 0.1);
+            out += ' ';
+            str::format_append(out, 1e300);
+            out += ' ';
+            str::format_append(out, 2.5f);
+            wassert(actual(out) == "0.1 1e+300 2.5");
+
+            out.clear();
+            str::format_fixed_append(out, 1.005, 2);
+            out += ' ';
+            str::format_fixed_append(out, 3.0, 0);
+            out += ' ';
+            str::format_fixed_append(out, -0.125, 3);
+            wassert(actual(out) == "1.00 3 -0.125");
+
+            // Values that do not fit the stack buffer
+            out = "x";
+            str::format_fixed_append(out, 1e100, 1);
+            wassert(actual(out.size()) == 104u);
+            wassert(actual(str::startswith(out, "x1")).istrue());
+            wassert(actual(str::endswith(out, ".0")).istrue());
+        });
+
+        add_method("appender", []() {
+            str::Appender a;
+            wassert(actual(a.empty()).istrue());
+            wassert(actual(a.c_str()) == "");
+            a << "foo" << ' ' << std::string("bar") << std::string_view(" baz") << ' ' << 42 << ' ' << -1.5 << ' ' << true;
+            wassert(actual(a.str()) == "foo bar baz 42 -1.5 1");
+            wassert(actual(a.size()) == 21u);
+
+            // Types without a specific overload use their ostream operator<<
+            a.clear();
+            a << std::vector<int>{1, 2, 3}.size() << ' ' << (const char*)nullptr;
+            wassert(actual(a.str()) == "3 (null)");
+
+            // Growing out of the inline buffer, also appending from itself
+            a.clear();
+            std::string expected;
+            for (unsigned i = 0; i < 100; ++i)
+            {
+                a << i << ',';
+                expected += std::to_string(i) + ",";
+            }
+            wassert(actual(a.str()) == expected);
+            a << a.view();
+            wassert(actual(a.str()) == expected + expected);
+
+            // Copy and move
+            str::Appender b(a);
+            wassert(actual(b.str()) == a.str());
+            str::Appender c(std::move(a));
+            wassert(actual(c.str()) == b.str());
+            wassert(actual(a.empty()).istrue());
+            str::Appender d;
+            d << "short";
+            c = std::move(d);
+            wassert(actual(c.str()) == "short");
+
+            // Storage is kept across clear()
+            b.clear();
+            b << "reused";
+            wassert(actual(b.c_str()) == "reused");
         });
 
         add_method("strip", []() {
@@ -79,6 +245,18 @@ class Tests : public TestCase
             //wassert(actual(str::rstrip(" ", ::isalpha)) == " ");
         });
 
+        add_method("strip_view", []() {
+            std::string src("  ciao \t\n");
+            std::string_view res = str::strip_view(src);
+            wassert(actual(res == "ciao").istrue());
+            wassert(actual(res.data() == src.data() + 2).istrue());
+            wassert(actual(str::lstrip_view(src) == "ciao \t\n").istrue());
+            wassert(actual(str::rstrip_view(src) == "  ciao").istrue());
+            wassert(actual(str::strip_view("   ").empty()).istrue());
+            wassert(actual(str::lstrip_view("").empty()).istrue());
+            wassert(actual(str::strip_view(" \xe0 ") == "\xe0").istrue());
+        });
+
         add_method("upper", []() {
             wassert(actual(str::lower("ciao")) == "ciao");
             wassert(actual(str::lower("CIAO")) == "ciao");
@@ -93,6 +271,57 @@ class Tests : public TestCase
             wassert(actual(str::upper("cIAO")) == "CIAO");
         });
 
+        add_method("case_inplace", []() {
+            // Cover vector blocks and scalar tails, with non-ASCII bytes
+            std::string all;
+            for (unsigned i = 0; i < 256; ++i)
+                all += (char)i;
+            std::string expected_upper = all;
+            std::string expected_lower = all;
+            for (unsigned c = 'a'; c <= 'z'; ++c)
+            {
+                expected_upper[c] = c - 32;
+                expected_lower[c - 32] = c;
+            }
+            for (unsigned len: { 0u, 5u, 17u, 100u, 256u })
+            {
+                std::string buf = all.substr(256 - len);
+                str::upper_inplace(buf);
+                wassert(actual(buf) == expected_upper.substr(256 - len));
+                str::lower_inplace(&buf[0], buf.size());
+                wassert(actual(buf) == expected_lower.substr(256 - len));
+            }
+            wassert(actual(str::upper("Ciao \xe0 mondo, ciao mondo, ciao mondo!")) == "CIAO \xe0 MONDO, CIAO MONDO, CIAO MONDO!");
+            wassert(actual(str::lower("Ciao \xc0 MONDO, CIAO MONDO, CIAO MONDO!")) == "ciao \xc0 mondo, ciao mondo, ciao mondo!");
+        });
+
+        add_method("char_class", []() {
+            using str::CharClass;
+            const size_t npos = std::string_view::npos;
+            wassert(actual(str::find_first_not_of("", CharClass::SPACE)) == npos);
+            wassert(actual(str::find_last_not_of("", CharClass::SPACE)) == npos);
+            wassert(actual(str::find_first_not_of(" \t\n\v\f\r", CharClass::SPACE)) == npos);
+            wassert(actual(str::find_first_not_of("0123456789abcdefABCDEFg", CharClass::XDIGIT)) == 22u);
+            wassert(actual(str::find_first_not_of("0123456789abcdefABCDEFg", CharClass::DIGIT)) == 10u);
+            wassert(actual(str::find_last_not_of("0123456789abcdefABCDEFg", CharClass::ALPHA)) == 9u);
+            wassert(actual(str::find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0", CharClass::ALPHA)) == 52u);
+            wassert(actual(str::find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0", CharClass::ALNUM)) == npos);
+            wassert(actual(str::find_first_not_of("abcdefghijklmnopqrstuvwxyzABC", CharClass::LOWER)) == 26u);
+            wassert(actual(str::find_last_not_of("abcdefghijklmnopqrstuvwxyzABC", CharClass::UPPER)) == 25u);
+
+            // Check every position across vector blocks and scalar tails
+            for (unsigned len = 1; len < 80; ++len)
+                for (unsigned pos = 0; pos < len; ++pos)
+                {
+                    std::string s(len, ' ');
+                    s[pos] = '\xa0';
+                    wassert(actual(str::find_first_not_of(s, CharClass::SPACE)) == pos);
+                    wassert(actual(str::find_last_not_of(s, CharClass::SPACE)) == pos);
+                    wassert(actual(str::strip_view(s).data() == s.data() + pos).istrue());
+                    wassert(actual(str::strip_view(s).size()) == 1u);
+                }
+        });
+
         add_method("basename", []() {
             wassert(actual(str::basename("ciao")) == "ciao");
             wassert(actual(str::basename("a/ciao")) == "ciao");
@@ -112,6 +341,25 @@ class Tests : public TestCase
             wassert(actual(str::dirname("ciao///")) == ".");
         });
 
+        add_method("path_views", []() {
+            std::string path("/a/b/ciao");
+            wassert(actual(str::basename_view(path) == "ciao").istrue());
+            wassert(actual(str::basename_view(path).data() == path.data() + 5).istrue());
+            wassert(actual(str::basename_view("ciao") == "ciao").istrue());
+            wassert(actual(str::dirname_view(path) == "/a/b").istrue());
+            wassert(actual(str::dirname_view(path).data() == path.data()).istrue());
+            wassert(actual(str::dirname_view("ciao") == ".").istrue());
+            wassert(actual(str::dirname_view("/ciao///") == "/").istrue());
+            wassert(actual(str::dirname_view("") == ".").istrue());
+
+            std::string_view sv("foo/../bar/baz", 10);
+            wassert(actual(str::normpath(sv)) == "bar");
+            wassert(actual(str::joinpath(sv, std::string_view("/x"))) == "foo/../bar/x");
+            wassert(actual(str::startswith(sv, std::string_view("foo"))).istrue());
+            wassert(actual(str::endswith(sv, "bar")).istrue());
+            wassert(actual(str::endswith(sv, "baz")).isfalse());
+        });
+
         add_method("joinpath", []() {
             wassert(actual(str::joinpath(string("a"), "b")) == "a/b");
             char b[] = "b";
@@ -137,6 +385,130 @@ class Tests : public TestCase
             wassert(actual(str::normpath("foo//bar")) == "foo/bar");
             wassert(actual(str::normpath("foo/./bar")) == "foo/bar");
             wassert(actual(str::normpath("foo/foo/../bar")) == "foo/bar");
+            wassert(actual(str::normpath("../foo")) == "../foo");
+            wassert(actual(str::normpath(string("/foo/../bar"))) == "/bar");
+            wassert(actual(str::normpath("a/../..")) == "..");
+            wassert(actual(str::normpath("../../a/..")) == "../..");
+            wassert(actual(str::normpath("../a/../../b")) == "../../b");
+            wassert(actual(str::normpath("//a//b/")) == "/a/b");
+            wassert(actual(str::normpath("/..")) == "/");
+            wassert(actual(str::normpath("..a/.b/...")) == "..a/.b/...");
+        });
+
+        add_method("arena", []() {
+            str::Arena arena(64);
+            wassert(actual(arena.capacity()) == 0u);
+            std::string_view a = arena.store("foo");
+            std::string_view b = arena.store("");
+            std::string_view c = arena.concat({"bar", "/", "baz"});
+            wassert(actual(a == "foo").istrue());
+            wassert(actual(a.data()[3]) == 0);
+            wassert(actual(b.empty()).istrue());
+            wassert(actual(c.data()) == "bar/baz");
+            wassert(actual(arena.capacity()) == 64u);
+
+            // Filling blocks
+            std::vector<std::string_view> stored;
+            for (unsigned i = 0; i < 100; ++i)
+                stored.push_back(arena.store(std::to_string(i)));
+            for (unsigned i = 0; i < 100; ++i)
+                wassert(actual(stored[i] == std::to_string(i)).istrue());
+            wassert(actual(a == "foo").istrue());
+
+            // Large strings get their own block
+            size_t capacity = arena.capacity();
+            std::string large(100, 'x');
+            wassert(actual(arena.store(large) == large).istrue());
+            wassert(actual(arena.capacity()) == capacity + 101);
+
+            // Clearing keeps one block
+            arena.clear();
+            wassert(actual(arena.capacity()) == 64u);
+            wassert(actual(arena.store("reused") == "reused").istrue());
+            wassert(actual(arena.capacity()) == 64u);
+        });
+
+        add_method("arena_paths", []() {
+            str::Arena arena;
+            wassert(actual(str::normpath(arena, "") == ".").istrue());
+            wassert(actual(str::normpath(arena, "/a/./b/../c//") == "/a/c").istrue());
+            wassert(actual(str::normpath(arena, "../a/..") == "..").istrue());
+            std::string_view p = str::normpath(arena, "a/b/../../..");
+            wassert(actual(p == "..").istrue());
+            wassert(actual(p.data()[p.size()]) == 0);
+
+            wassert(actual(str::joinpath(arena, {}) == "").istrue());
+            wassert(actual(str::joinpath(arena, {"a", "b"}) == "a/b").istrue());
+            wassert(actual(str::joinpath(arena, {"/a/", "/b", "", "c/"}) == "/a/b/c/").istrue());
+            wassert(actual(str::joinpath(arena, {"", "/"}) == "/").istrue());
+            for (const auto& args: std::vector<std::vector<std::string>>{ { "a", "/b/", "c" }, { "/", "/" }, { "x/", "y", "/z" } })
+                wassert(actual(str::joinpath(arena, {args[0], args[1], args[2 % args.size()]})) == str::joinpath(args[0], args[1], args[2 % args.size()]));
+
+            std::vector<std::string_view> tokens;
+            {
+                std::string tmp = "a,b,,c";
+                str::split_into(tokens, arena, tmp, ",");
+                str::split_into(tokens, arena, tmp, ",", true);
+            }
+            wassert(actual(str::join("|", tokens)) == "a|b||c|a|b|c");
+        });
+
+        add_method("path_buffer", []() {
+            str::PathBuffer path;
+            wassert(actual(path.c_str()) == "");
+            path.append("a/", "/b", string("c"), "/d/");
+            wassert(actual(path.view() == "a/b/c/d/").istrue());
+            wassert(actual(path.basename() == "").istrue());
+            wassert(actual(path.dirname() == "a/b/c").istrue());
+
+            path.assign("/usr/./lib/../share//doc/");
+            path.normalize();
+            wassert(actual(path.c_str()) == "/usr/share/doc");
+            wassert(actual(path.basename() == "doc").istrue());
+            wassert(actual(path.dirname() == "/usr/share").istrue());
+
+            // Append part of itself
+            path.append(path.basename());
+            wassert(actual(path.c_str()) == "/usr/share/doc/doc");
+
+            path.assign("foo/../..");
+            path.normalize();
+            wassert(actual(path.c_str()) == "..");
+            path.assign("foo/..");
+            path.normalize();
+            wassert(actual(path.c_str()) == ".");
+
+            path.assign("../bar/");
+            path.make_absolute("/home/user");
+            wassert(actual(path.c_str()) == "/home/bar");
+            path.make_absolute("/other");
+            wassert(actual(path.c_str()) == "/home/bar");
+            path.clear();
+            path.make_absolute("/other/");
+            wassert(actual(path.c_str()) == "/other");
+
+            // Paths longer than the inline buffer move to the heap
+            std::string longpath;
+            for (unsigned i = 0; i < 100; ++i)
+                longpath += "/component." + std::to_string(i) + "/.";
+            str::PathBuffer lp("..");
+            lp.append(longpath);
+            lp.make_absolute("/base/dir");
+            wassert(actual(lp.size()) > str::PathBuffer::inline_size);
+            wassert(actual(lp.str()) == str::normpath("/base/" + longpath));
+
+            // Copy and move both inline and heap buffers
+            str::PathBuffer copy(lp);
+            wassert(actual(copy.str()) == lp.str());
+            str::PathBuffer moved(std::move(copy));
+            wassert(actual(moved.str()) == lp.str());
+            wassert(actual(copy.c_str()) == "");
+            copy = path;
+            wassert(actual(copy.c_str()) == "/other");
+            copy = std::move(moved);
+            wassert(actual(copy.str()) == lp.str());
+            moved = std::move(path);
+            wassert(actual(moved.c_str()) == "/other");
         });
 
         add_method("split", []() {
@@ -195,11 +567,317 @@ class Tests : public TestCase
             wassert(actual(res[1]) == "string");
         });
 
+        add_method("split_view", []() {
+            std::string src("a/b//c");
+            str::SplitView split(src, "/");
+            auto a = split.begin();
+            wassert(actual(a != split.end()).istrue());
+            wassert(actual(*a == "a").istrue());
+            wassert(actual(a->data() == src.data()).istrue());
+            wassert(actual(a.remainder() == "b//c").istrue());
+            ++a;
+            wassert(actual(*a == "b").istrue());
+            ++a;
+            wassert(actual(a->empty()).istrue());
+            ++a;
+            wassert(actual(*a == "c").istrue());
+            wassert(actual(a.remainder().empty()).istrue());
+            ++a;
+            wassert(actual(a == split.end()).istrue());
+
+            vector<std::string_view> res;
+            for (auto tok: str::SplitView("std::string::", "::"))
+                res.push_back(tok);
+            wassert(actual(res.size()) == 3u);
+            wassert(actual(res[0] == "std").istrue());
+            wassert(actual(res[1] == "string").istrue());
+            wassert(actual(res[2].empty()).istrue());
+
+            res.clear();
+            for (auto tok: str::SplitView("::std::::string::", "::", true))
+                res.push_back(tok);
+            wassert(actual(res.size()) == 2u);
+            wassert(actual(res[0] == "std").istrue());
+            wassert(actual(res[1] == "string").istrue());
+
+            res.clear();
+            for (auto tok: str::SplitView("", ","))
+                res.push_back(tok);
+            wassert(actual(res.size()) == 0u);
+
+            res.clear();
+            for (auto tok: str::SplitView("abc", "", true))
+                res.push_back(tok);
+            wassert(actual(res.size()) == 3u);
+            wassert(actual(res[2] == "c").istrue());
+
+            // Splitting does not allocate, whatever the separator length
+            std::string long_sep(40, '-');
+            for (std::string_view sep: { std::string_view(","), std::string_view(", "), std::string_view("::--"), std::string_view(long_sep) })
+            {
+                std::string line = "a" + std::string(sep) + "bb" + std::string(sep) + std::string(sep) + "c";
+                size_t count = 0;
+                size_t before = allocations;
+                for (unsigned i = 0; i < 100; ++i)
+                    for (auto tok: str::SplitView(line, sep))
+                        count += tok.size() + 1;
+                size_t allocated = allocations - before;
+                WOBBLE_TEST_INFO(info);
+                info() << "separator: " << sep;
+                wassert(actual(allocated) == 0u);
+                wassert(actual(count) == 100u * 8u);
+            }
+        });
+
+        add_method("byte_set", []() {
+            const size_t npos = std::string_view::npos;
+            str::ByteSet empty;
+            wassert(actual(empty.find_in("abc")) == npos);
+
+            str::ByteSet single(",");
+            wassert(actual(single.size()) == 1u);
+            wassert(actual(single.find_in("a,b,c")) == 1u);
+            wassert(actual(single.find_in("a,b,c", 2)) == 3u);
+            wassert(actual(single.find_in("a,b,c", 10)) == npos);
+
+            str::ByteSet seps(" \t,;,");
+            wassert(actual(seps.size()) == 4u);
+            wassert(actual(seps.contains(';')).istrue());
+            wassert(actual(seps.contains('\xe0')).isfalse());
+            wassert(actual(seps.find_not_in(" ,;\tfoo")) == 4u);
+
+            str::ByteSet non_ascii("\xe0 ");
+            wassert(actual(non_ascii.find_in("abc\xe1\xe0")) == 4u);
+
+            // Check every position across vector blocks and scalar tails
+            for (unsigned len = 1; len < 80; ++len)
+                for (unsigned pos = 0; pos < len; ++pos)
+                    for (char c: { ' ', '\t', ';' })
+                    {
+                        std::string s(len, 'a');
+                        // Fill with bytes that share a nibble with the separators
+                        for (unsigned i = 0; i < pos; ++i)
+                            s[i] = "\x19\x30\x2b\x3c\x29\xa0\x0b\x3a"[i % 8];
+                        s[pos] = c;
+                        wassert(actual(seps.find_in(s)) == pos);
+                        wassert(actual(non_ascii.find_in(s)) == (c == ' ' ? pos : npos));
+                    }
+        });
+
+        add_method("searcher", []() {
+            const size_t npos = std::string_view::npos;
+            wassert(actual(str::Searcher("").find("")) == 0u);
+            wassert(actual(str::Searcher("").find("abc", 2)) == 2u);
+            wassert(actual(str::Searcher("").find("abc", 4)) == npos);
+            wassert(actual(str::Searcher("b").find("abc")) == 1u);
+            wassert(actual(str::Searcher("ab").find("abab", 1)) == 2u);
+            wassert(actual(str::Searcher("abc").find("ab")) == npos);
+            wassert(actual(str::Searcher("abc").contained_in("xxabcxx")).istrue());
+            wassert(actual(str::Searcher("abd").contained_in("xxabcxx")).isfalse());
+
+            // Compare with std::string_view::find on random strings from
+            // small alphabets, which give many partial and periodic matches
+            uint32_t seed = 1;
+            auto rnd = [&](unsigned max) {
+                seed = seed * 1103515245 + 12345;
+                return (seed >> 16) % max;
+            };
+            for (unsigned i = 0; i < 3000; ++i)
+            {
+                unsigned alphabet = 2 + i % 3;
+                std::string haystack;
+                size_t hsize = rnd(300);
+                for (size_t j = 0; j < hsize; ++j)
+                    haystack += 'a' + rnd(alphabet);
+                std::string needle;
+                if (i % 2 && hsize > 0)
+                {
+                    // Take the needle from the haystack
+                    size_t start = rnd(hsize);
+                    needle = haystack.substr(start, 1 + rnd(80));
+                } else {
+                    size_t nsize = 1 + rnd(80);
+                    for (size_t j = 0; j < nsize; ++j)
+                        needle += 'a' + rnd(alphabet);
+                }
+                str::Searcher searcher(needle);
+                WOBBLE_TEST_INFO(info);
+                info() << "needle " << needle << " haystack " << haystack;
+                for (size_t pos = 0; pos <= hsize; pos += 1 + hsize / 4)
+                    wassert(actual(searcher.find(haystack, pos)) == std::string_view(haystack).find(needle, pos));
+            }
+
+            // Periodic needles
+            std::string haystack;
+            for (unsigned i = 0; i < 100; ++i)
+                haystack += "abaabaab";
+            haystack += "abaabaabb";
+            for (size_t nsize: { 2, 8, 31, 32, 33, 40, 64, 65, 100 })
+            {
+                std::string needle = haystack.substr(haystack.size() - nsize);
+                WOBBLE_TEST_INFO(info);
+                info() << "needle size " << nsize;
+                wassert(actual(str::Searcher(needle).find(haystack)) == haystack.size() - nsize);
+                needle = haystack.substr(0, nsize);
+                wassert(actual(str::Searcher(needle).find(haystack, 1)) == std::string_view(haystack).find(needle, 1));
+            }
+        });
+
+        add_method("tokenizer", []() {
+            auto tokens = [](const str::Tokenizer& tok) {
+                vector<string> res;
+                for (auto t: tok)
+                    res.emplace_back(t);
+                return str::join("|", res);
+            };
+
+            wassert(actual(tokens(str::Tokenizer("", ","))) == "");
+            wassert(actual(tokens(str::Tokenizer("a,b;c", ",;"))) == "a|b|c");
+            wassert(actual(tokens(str::Tokenizer(",a,;b,", ",;"))) == "|a||b|");
+            wassert(actual(tokens(str::Tokenizer(",a,;b,", ",;", true))) == "a|b");
+            wassert(actual(tokens(str::Tokenizer(" \t, ", " \t,", true))) == "");
+            wassert(actual(tokens(str::Tokenizer("foo", " "))) == "foo");
+
+            // Maximum number of splits
+            str::Tokenizer max("a b  c d", " ", true);
+            max.max_splits = 2;
+            wassert(actual(tokens(max)) == "a|b|c d");
+            max.max_splits = 0;
+            wassert(actual(tokens(max)) == "a b  c d");
+
+            // Quoted fields
+            str::Tokenizer quoted("a,\"b,c\",\"d\"\"e\",\"f\"g,\"h", ",");
+            quoted.quote = '"';
+            wassert(actual(tokens(quoted)) == "a|b,c|d\"\"e|\"f\"g|\"h");
+            quoted.str = "\"\",\"\"\"\"";
+            wassert(actual(tokens(quoted)) == "|\"\"");
+
+            // Iterator access to the rest of the string
+            str::Tokenizer tok("a b c", " ");
+            auto i = tok.begin();
+            wassert(actual(i->size()) == 1u);
+            wassert(actual(i.remainder() == "b c").istrue());
+            ++i;
+            wassert(actual(*i == "b").istrue());
+            ++i;
+            wassert(actual(*i == "c").istrue());
+            wassert(actual(i.remainder() == "").istrue());
+            wassert(actual(i != tok.end()).istrue());
+            ++i;
+            wassert(actual(i == tok.end()).istrue());
+        });
+
+        add_method("glob", []() {
+            wassert(actual(str::Glob().match("")).isfalse());
+            wassert(actual(str::Glob("").match("")).isfalse());
+            wassert(actual(str::Glob("*").match("")).istrue());
+            wassert(actual(str::Glob("*").match("a/b")).istrue());
+            wassert(actual(str::Glob("foo").match("foo")).istrue());
+            wassert(actual(str::Glob("foo").match("fo")).isfalse());
+            wassert(actual(str::Glob("foo").match("fooo")).isfalse());
+            wassert(actual(str::Glob("string.*").match("string.glob")).istrue());
+            wassert(actual(str::Glob("string.*").match("strin.glob")).isfalse());
+            wassert(actual(str::Glob("*.cc").match("string-test.cc")).istrue());
+            wassert(actual(str::Glob("*.cc").match("string-test.c")).isfalse());
+            wassert(actual(str::Glob("a*b*c").match("aXbYbZc")).istrue());
+            wassert(actual(str::Glob("a*b*c").match("aXbYbZ")).isfalse());
+            wassert(actual(str::Glob("a*bc").match("abcbcbc")).istrue());
+            wassert(actual(str::Glob("a?c").match("abc")).istrue());
+            wassert(actual(str::Glob("a?c").match("ac")).isfalse());
+            wassert(actual(str::Glob("a[bc]d").match("acd")).istrue());
+            wassert(actual(str::Glob("a[!bc]d").match("acd")).isfalse());
+            wassert(actual(str::Glob("a[^bc]d").match("aed")).istrue());
+            wassert(actual(str::Glob("[a-c]*").match("b")).istrue());
+            wassert(actual(str::Glob("[a-c]*").match("d")).isfalse());
+            wassert(actual(str::Glob("[]]").match("]")).istrue());
+            wassert(actual(str::Glob("[a-]").match("-")).istrue());
+            wassert(actual(str::Glob("[ab").match("[ab")).istrue());
+            wassert(actual(str::Glob("\\*").match("*")).istrue());
+            wassert(actual(str::Glob("\\*").match("a")).isfalse());
+
+            // Alternatives
+            str::Glob alt("*.{cc,h}");
+            wassert(actual(alt.match("string.cc")).istrue());
+            wassert(actual(alt.match("string.h")).istrue());
+            wassert(actual(alt.match("string.o")).isfalse());
+            wassert(actual(str::Glob("{a,b{c,d}}x").match("bdx")).istrue());
+            wassert(actual(str::Glob("{a,b{c,d}}x").match("bx")).isfalse());
+            wassert(actual(str::Glob("a{b").match("a{b")).istrue());
+
+            // Multiple patterns
+            str::Glob multi;
+            multi.add("string.*");
+            multi.add("sys.mapped_*");
+            wassert(actual(multi.match("string.glob")).istrue());
+            wassert(actual(multi.match("sys.mapped_lines")).istrue());
+            wassert(actual(multi.match("sys.abspath")).isfalse());
+            multi.clear();
+            wassert(actual(multi.empty()).istrue());
+
+            // Compare with fnmatch on patterns without alternatives
+            const char* patterns[] = { "*", "?", "a*", "*a", "*a*", "a?b*", "[ab]*[!c]", "*.*.*", "**x", "[a-]?*" };
+            const char* strings[] = { "", "a", "b", "ab", "ba", "axb", "a.b.c", "xx", "-bc", "aab", "abc" };
+            for (const auto& pattern: patterns)
+            {
+                str::Glob glob(pattern);
+                for (const auto& s: strings)
+                {
+                    WOBBLE_TEST_INFO(info);
+                    info() << "pattern: " << pattern << " string: " << s;
+                    wassert(actual(glob.match(s)) == (fnmatch(pattern, s, 0) == 0));
+                }
+            }
+        });
+
         add_method("encode_cstring", []() {
             size_t len;
             wassert(actual(str::decode_cstring("cia\\x00o", len)) == string("cia\0o", 5));
             wassert(actual(len) == 8u);
             wassert(actual(str::encode_cstring(string("cia\0o", 5))) == "cia\\x00o");
+            wassert(actual(str::encode_cstring(std::string_view("a\nb"))) == "a\\nb");
+            wassert(actual(str::decode_cstring(std::string("a\\nb"), len)) == "a\nb");
+            wassert(actual(str::decode_cstring(std::string_view("a\\nb"), len)) == "a\nb");
+
+            // Escapes
+            wassert(actual(str::encode_cstring("a\tb\nc\"d\\e\x7f\x1b\xe0")) == "a\\tb\\nc\\\"d\\\\e\\x7f\\x1b\xe0");
+            wassert(actual(str::decode_cstring("a\\tb\\nc\\\"d\\\\e\\x7f\\x1b\xe0\" tail", len)) == "a\tb\nc\"d\\e\x7f\x1b\xe0");
+            wassert(actual(len) == 23u);
+            wassert(actual(str::decode_cstring("\\r\\q\\x\\xag\\", len)) == string("\rq\0\x0ag\\", 6));
+            wassert(actual(len) == 11u);
+
+            // Round trip of all bytes, across vector blocks
+            std::string all;
+            for (unsigned i = 0; i < 1024; ++i)
+                all += (char)(i * 7);
+            std::string encoded = str::encode_cstring(all);
+            wassert(actual(str::decode_cstring(encoded, len)) == all);
+            wassert(actual(len) == encoded.size());
+
+            std::string out("prefix:");
+            str::encode_cstring_append(out, "\"");
+            wassert(actual(out) == "prefix:\\\"");
+        });
+
+        add_method("decode_cstring_append", []() {
+            std::string out;
+            size_t len;
+            wassert(actual(str::decode_cstring_append(out, "foo\\x41\\'\"bar", len)).istrue());
+            wassert(actual(out) == "fooA'");
+            wassert(actual(len) == 10u);
+
+            out.clear();
+            wassert(actual(str::decode_cstring_append(out, "foo\\qbar", len)).isfalse());
+            wassert(actual(out) == "foo");
+            wassert(actual(len) == 3u);
+
+            out.clear();
+            wassert(actual(str::decode_cstring_append(out, "\\n\\xz", len)).isfalse());
+            wassert(actual(out) == "\n");
+            wassert(actual(len) == 2u);
+
+            out.clear();
+            wassert(actual(str::decode_cstring_append(out, "foo\\", len)).isfalse());
+            wassert(actual(len) == 3u);
         });
 
         add_method("encode_url", []() {
@@ -217,6 +895,33 @@ class Tests : public TestCase
 
             wassert(actual(str::decode_url(str::encode_url("àá☣☢☠!@#$%^&*(\")/A"))) == "àá☣☢☠!@#$%^&*(\")/A");
             wassert(actual(str::decode_url(str::encode_url("http://zz:ss@a.b:31/c?d=e&f=g"))) == "http://zz:ss@a.b:31/c?d=e&f=g");
+
+            std::string all;
+            for (unsigned i = 0; i < 256; ++i)
+                all += (char)i;
+            std::string encoded = str::encode_url(all);
+            wassert(actual(encoded.size()) == 256u * 3 - 2 * (10 + 26 + 26 + 7));
+            wassert(actual(encoded).contains("%26'()*%2b%2c-%2e%2f0123"));
+            wassert(actual(encoded).endswith("xyz%7b%7c%7d%7e%7f%80"
+                        "%81%82%83%84%85%86%87%88%89%8a%8b%8c%8d%8e%8f%90%91%92%93%94%95%96%97%98%99%9a%9b%9c%9d%9e%9f"
+                        "%a0%a1%a2%a3%a4%a5%a6%a7%a8%a9%aa%ab%ac%ad%ae%af%b0%b1%b2%b3%b4%b5%b6%b7%b8%b9%ba%bb%bc%bd%be%bf"
+                        "%c0%c1%c2%c3%c4%c5%c6%c7%c8%c9%ca%cb%cc%cd%ce%cf%d0%d1%d2%d3%d4%d5%d6%d7%d8%d9%da%db%dc%dd%de%df"
+                        "%e0%e1%e2%e3%e4%e5%e6%e7%e8%e9%ea%eb%ec%ed%ee%ef%f0%f1%f2%f3%f4%f5%f6%f7%f8%f9%fa%fb%fc%fd%fe%ff"));
+            wassert(actual(str::decode_url(encoded)) == all);
+            wassert(actual(str::decode_url("%41%4A%4a%zz%4z")) == string("AJJ\0\x04", 5));
+        });
+
+        add_method("encode_url_append", []() {
+            std::string buf("?q=");
+            str::encode_url_append(buf, "a b");
+            str::encode_url_append(buf, std::string_view("&c=d", 2));
+            wassert(actual(buf) == "?q=a%20b%26c");
+
+            std::string dec("x");
+            str::decode_url_append(dec, "a%20b%2");
+            wassert(actual(dec) == "xa b");
+            str::decode_url_append(dec, "%26");
+            wassert(actual(dec) == "xa b&");
         });
 
         add_method("encode_base64", []() {
@@ -258,6 +963,290 @@ class Tests : public TestCase
             wassert(actual(str::decode_base64(str::encode_base64("ciao cia"))) == "ciao cia");
             wassert(actual(str::decode_base64(str::encode_base64("ciao ciao"))) == "ciao ciao");
         });
+
+        add_method("encode_hex", []() {
+            wassert(actual(str::encode_hex("")) == "");
+            wassert(actual(str::encode_hex(string("\x00\x01\xab\xff", 4))) == "0001abff");
+            wassert(actual(str::encode_hex(string("\x00\x01\xab\xff", 4), str::HexCase::UPPER)) == "0001ABFF");
+            wassert(actual(str::encode_hex("abc", str::HexCase::UPPER)) == "616263");
+            uint8_t buf[] = { 0xde, 0xad, 0xbe, 0xef };
+            wassert(actual(str::encode_hex(buf, 4)) == "deadbeef");
+
+            std::string out("sha1:");
+            str::encode_hex_append(out, buf, 2);
+            str::encode_hex_append(out, "\xef", str::HexCase::UPPER);
+            wassert(actual(out) == "sha1:deadEF");
+
+            // Compare with a simple implementation, across vector blocks and
+            // scalar tails
+            std::string data;
+            for (unsigned i = 0; i < 300; ++i)
+                data += (char)(i * 13);
+            for (size_t len: { 1, 15, 16, 17, 31, 32, 33, 48, 63, 64, 65, 100, 300 })
+            {
+                WOBBLE_TEST_INFO(info);
+                info() << "length " << len;
+                std::string expected;
+                for (size_t i = 0; i < len; ++i)
+                {
+                    char digits[3];
+                    snprintf(digits, 3, "%02x", (unsigned char)data[i]);
+                    expected += digits;
+                }
+                std::string encoded = str::encode_hex(data.substr(0, len));
+                wassert(actual(encoded) == expected);
+                wassert(actual(str::decode_hex(encoded)) == data.substr(0, len));
+                wassert(actual(str::decode_hex(str::upper(encoded))) == data.substr(0, len));
+            }
+        });
+
+        add_method("decode_hex", []() {
+            wassert(actual(str::decode_hex("")) == "");
+            wassert(actual(str::decode_hex("0001aBfF")) == string("\x00\x01\xab\xff", 4));
+            wassert_throws(std::invalid_argument, str::decode_hex("abc"));
+
+            std::string out("prefix");
+            str::decode_hex_append(out, "6869");
+            wassert(actual(out) == "prefixhi");
+
+            // Invalid characters are found at any position
+            std::string digits(130, 'a');
+            for (size_t pos: { 0, 1, 31, 32, 63, 64, 65, 127, 128, 129 })
+                for (char c: { 'g', 'G', '/', ':', '@', '`', ' ', '\xe1' })
+                {
+                    WOBBLE_TEST_INFO(info);
+                    info() << "position " << pos << " character " << c;
+                    std::string s = digits;
+                    s[pos] = c;
+                    try {
+                        str::decode_hex_append(out, s);
+                        wassert(actual(false).istrue());
+                    } catch (std::invalid_argument& e) {
+                        wassert(actual(e.what()).endswith("offset " + std::to_string(pos)));
+                    }
+                    wassert(actual(out) == "prefixhi");
+                }
+        });
+
+        add_method("validate_utf8", []() {
+            const size_t npos = std::string_view::npos;
+            wassert(actual(str::validate_utf8("")).istrue());
+            wassert(actual(str::validate_utf8("ascii")).istrue());
+            wassert(actual(str::validate_utf8("è € 𝄞")).istrue());
+            wassert(actual(str::validate_utf8("\xf4\x8f\xbf\xbf")).istrue());
+            wassert(actual(str::find_invalid_utf8("\x80")) == 0u);
+            wassert(actual(str::find_invalid_utf8("a\xc0\x80")) == 1u);
+            wassert(actual(str::find_invalid_utf8("ab\xe0\x9f\xbf")) == 2u);
+            wassert(actual(str::find_invalid_utf8("ab\xed\xa0\x80")) == 2u);
+            wassert(actual(str::find_invalid_utf8("\xf0\x8f\xbf\xbf")) == 0u);
+            wassert(actual(str::find_invalid_utf8("\xf4\x90\x80\x80")) == 0u);
+            wassert(actual(str::find_invalid_utf8("€\xf5\x80\x80\x80")) == 3u);
+            wassert(actual(str::find_invalid_utf8("\xff")) == 0u);
+            wassert(actual(str::find_invalid_utf8("\xe2\x28\xa1")) == 0u);
+            wassert(actual(str::find_invalid_utf8("abc\xe2\x82")) == 3u);
+            wassert(actual(str::find_invalid_utf8("€\xac")) == 3u);
+
+            // Reference implementation, decoding each code point
+            auto reference = [](std::string_view s) {
+                static const unsigned min[] = { 0, 0, 0x80, 0x800, 0x10000 };
+                size_t i = 0;
+                while (i < s.size())
+                {
+                    unsigned char c = s[i];
+                    unsigned cp;
+                    size_t len;
+                    if (c < 0x80) { ++i; continue; }
+                    else if ((c & 0xe0) == 0xc0) { len = 2; cp = c & 0x1f; }
+                    else if ((c & 0xf0) == 0xe0) { len = 3; cp = c & 0x0f; }
+                    else if ((c & 0xf8) == 0xf0) { len = 4; cp = c & 0x07; }
+                    else return i;
+                    if (i + len > s.size()) return i;
+                    for (size_t j = 1; j < len; ++j)
+                    {
+                        if ((s[i + j] & 0xc0) != 0x80) return i;
+                        cp = (cp << 6) | (s[i + j] & 0x3f);
+                    }
+                    if (cp < min[len] || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return i;
+                    i += len;
+                }
+                return std::string_view::npos;
+            };
+
+            // Invalid sequences around vector block boundaries
+            std::string valid;
+            while (valid.size() < 200)
+                valid += "abcè€𝄞xyz";
+            wassert(actual(str::find_invalid_utf8(valid)) == npos);
+            for (const char* bad: { "\x80", "\xc1\xbf", "\xe0\x80\x80", "\xed\xbf\xbf", "\xf4\x90\x80\x80", "\xf8", "\xc3", "\xe2\x82", "\xf0\x9d\x84" })
+                for (size_t pos = 0; pos < valid.size(); ++pos)
+                {
+                    if ((valid[pos] & 0xc0) == 0x80)
+                        continue;
+                    WOBBLE_TEST_INFO(info);
+                    info() << "sequence " << str::encode_cstring(bad) << " position " << pos;
+                    std::string s = valid.substr(0, pos) + bad + valid.substr(pos);
+                    wassert(actual(str::find_invalid_utf8(s)) == pos);
+                    // Truncated at the end
+                    s = valid.substr(0, pos) + bad;
+                    wassert(actual(str::find_invalid_utf8(s)) == pos);
+                }
+
+            // Random corruption
+            uint32_t seed = 1;
+            for (unsigned i = 0; i < 2000; ++i)
+            {
+                std::string s = valid;
+                for (unsigned j = 0; j < 1 + i % 3; ++j)
+                {
+                    seed = seed * 1103515245 + 12345;
+                    s[(seed >> 8) % s.size()] = seed >> 24;
+                }
+                WOBBLE_TEST_INFO(info);
+                info() << "string " << str::encode_cstring(s);
+                wassert(actual(str::find_invalid_utf8(s)) == reference(s));
+                wassert(actual(str::validate_utf8(s)) == (reference(s) == npos));
+            }
+        });
+
+        add_method("count_codepoints", []() {
+            wassert(actual(str::count_codepoints("")) == 0u);
+            wassert(actual(str::count_codepoints("ascii")) == 5u);
+            wassert(actual(str::count_codepoints("è € 𝄞")) == 5u);
+
+            std::string s;
+            size_t count = 0;
+            while (s.size() < 20000)
+            {
+                wassert(actual(str::count_codepoints(s)) == count);
+                s += "aè€𝄞";
+                count += 4;
+            }
+            wassert(actual(str::count_codepoints(s)) == count);
+            wassert(actual(str::count_codepoints(std::string_view(s).substr(1))) == count - 1);
+        });
+
+        add_method("encode_base64_impls", []() {
+            // Restore the default implementation when done
+            struct ResetImpl
+            {
+                ~ResetImpl() { str::base64_set_impl(str::Base64Impl::AUTO); }
+            } reset_impl;
+
+            // Build test data of all lengths, and reference results with the
+            // scalar implementation
+            std::string data;
+            uint32_t seed = 1;
+            for (unsigned i = 0; i < 300; ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                data += (char)(seed >> 16);
+            }
+
+            str::base64_set_impl(str::Base64Impl::SCALAR);
+            vector<string> encoded;
+            vector<string> decoded;
+            for (unsigned len = 0; len < data.size(); ++len)
+            {
+                encoded.emplace_back(str::encode_base64(data.substr(0, len)));
+                wassert(actual(str::decode_base64(encoded.back())) == data.substr(0, len));
+            }
+            // Decoding is lenient with invalid characters: check that all
+            // implementations handle them in the same way
+            std::string invalid = encoded.back();
+            for (unsigned pos = 0; pos < invalid.size(); pos += 7)
+            {
+                std::string s = invalid;
+                s[pos] = pos % 2 ? '=' : '\xe0';
+                decoded.emplace_back(str::decode_base64(s));
+            }
+
+            for (auto impl: { str::Base64Impl::SSE41, str::Base64Impl::AVX2 })
+            {
+                WOBBLE_TEST_INFO(info);
+                info() << "implementation " << (int)impl;
+                if (!str::base64_impl_supported(impl))
+                    continue;
+                str::base64_set_impl(impl);
+                for (unsigned len = 0; len < data.size(); ++len)
+                {
+                    wassert(actual(str::encode_base64(data.substr(0, len))) == encoded[len]);
+                    wassert(actual(str::decode_base64(encoded[len])) == data.substr(0, len));
+                }
+                for (unsigned pos = 0, i = 0; pos < invalid.size(); pos += 7, ++i)
+                {
+                    std::string s = invalid;
+                    s[pos] = pos % 2 ? '=' : '\xe0';
+                    wassert(actual(str::decode_base64(s)) == decoded[i]);
+                }
+            }
+        });
+
+        add_method("base64_stream", []() {
+            std::string data;
+            for (unsigned i = 0; i < 200; ++i)
+                data += (char)(i * 7);
+            std::string encoded = str::encode_base64(data);
+
+            for (unsigned chunk: { 1u, 2u, 3u, 4u, 5u, 7u, 16u, 100u, 1000u })
+            {
+                WOBBLE_TEST_INFO(info);
+                info() << "chunk size " << chunk;
+
+                for (unsigned len: { 0u, 1u, 2u, 3u, 50u, 199u, 200u })
+                {
+                    str::Base64Encoder encoder;
+                    std::string res;
+                    for (unsigned pos = 0; pos < len; pos += chunk)
+                        encoder.encode(data.data() + pos, std::min(chunk, len - pos), res);
+                    encoder.flush(res);
+                    std::string expected = str::encode_base64(data.substr(0, len));
+                    wassert(actual(res) == expected);
+
+                    str::Base64Decoder decoder;
+                    std::string decoded;
+                    for (unsigned pos = 0; pos < res.size(); pos += chunk)
+                        decoder.decode(res.data() + pos, std::min<size_t>(chunk, res.size() - pos), decoded);
+                    decoder.flush(decoded);
+                    wassert(actual(decoded) == data.substr(0, len));
+                }
+
+                // Whitespace is skipped, and concatenated streams are supported
+                std::string wrapped;
+                for (unsigned pos = 0; pos < encoded.size(); pos += 76)
+                    wrapped += encoded.substr(pos, 76) + "\r\n";
+                wrapped += str::encode_base64("a") + "\n" + str::encode_base64("bc");
+                str::Base64Decoder decoder;
+                std::string decoded;
+                for (unsigned pos = 0; pos < wrapped.size(); pos += chunk)
+                    decoder.decode(wrapped.data() + pos, std::min<size_t>(chunk, wrapped.size() - pos), decoded);
+                decoder.flush(decoded);
+                wassert(actual(decoded) == data + "abc");
+            }
+
+            // Padding in the middle of the input gives the same result
+            // however the input is split
+            for (std::string input: { "QQ==QQ==", "QQ==\nQQ==", "QUI=QQ==QUJD", "QUJDQQ==QUI=QUJD" })
+            {
+                WOBBLE_TEST_INFO(info);
+                info() << "input " << input;
+                str::Base64Decoder decoder;
+                std::string whole;
+                decoder.decode(input.data(), input.size(), whole);
+                decoder.flush(whole);
+                for (unsigned chunk: { 1u, 2u, 3u, 5u })
+                {
+                    std::string decoded;
+                    for (unsigned pos = 0; pos < input.size(); pos += chunk)
+                        decoder.decode(input.data() + pos, std::min<size_t>(chunk, input.size() - pos), decoded);
+                    decoder.flush(decoded);
+                    wassert(actual(decoded) == whole);
+                }
+            }
+            str::Base64Decoder decoder;
+            std::string decoded;
+            decoder.decode("QQ==QQ==", 8, decoded);
+            wassert(actual(decoded) == "AA");
+        });
     }
 } tests("string");
 
@@ -1,6 +1,16 @@
 #include "string.h"
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define WOBBLE_STR_X86_SIMD
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -10,90 +20,330 @@ namespace str {
 namespace {
 
 /**
- * Return the substring of 'str' without all leading characters for which
- * 'classifier' returns true.
+ * Character class as a set of up to 3 byte ranges, for vectorized matching,
+ * and as a lookup table, for scalar matching
  */
-template<typename FUN>
-std::string lstrip(const std::string& str, const FUN& classifier)
+struct CharRanges
 {
-    if (str.empty())
-        return str;
+    uint8_t lo[3] = {};
+    uint8_t span[3] = {};
+    unsigned count = 0;
+    bool table[256] = {};
+
+    constexpr CharRanges(std::initializer_list<std::pair<uint8_t, uint8_t>> ranges)
+    {
+        for (const auto& r: ranges)
+        {
+            lo[count] = r.first;
+            span[count] = r.second - r.first;
+            ++count;
+            for (unsigned c = r.first; c <= r.second; ++c)
+                table[c] = true;
+        }
+    }
+
+    bool operator()(char c) const { return table[static_cast<unsigned char>(c)]; }
+};
 
-    size_t beg = 0;
-    while (beg < str.size() && classifier(str[beg]))
-        ++beg;
+constexpr CharRanges char_classes[] = {
+    { { '\t', '\r' }, { ' ', ' ' } },                       // SPACE
+    { { '0', '9' } },                                       // DIGIT
+    { { 'A', 'Z' }, { 'a', 'z' } },                         // ALPHA
+    { { '0', '9' }, { 'A', 'Z' }, { 'a', 'z' } },           // ALNUM
+    { { '0', '9' }, { 'A', 'F' }, { 'a', 'f' } },           // XDIGIT
+    { { 'A', 'Z' } },                                       // UPPER
+    { { 'a', 'z' } },                                       // LOWER
+};
 
-    return str.substr(beg, str.size() - beg + 1);
+const CharRanges& char_class(CharClass cls)
+{
+    return char_classes[static_cast<unsigned>(cls)];
 }
 
-/**
- * Return the substring of 'str' without all trailing characters for which
- * 'classifier' returns true.
+#ifdef WOBBLE_STR_X86_SIMD
+bool cpu_has_avx2()
+{
+    static const bool res = __builtin_cpu_supports("avx2");
+    return res;
+}
+
+bool cpu_has_ssse3()
+{
+    static const bool res = __builtin_cpu_supports("ssse3");
+    return res;
+}
+
+/*
+ * A byte x is in [lo, lo + span] if (uint8_t)(x - lo) <= span, which is
+ * tested with an unsigned min
  */
-template<typename FUN>
-std::string rstrip(const std::string& str, const FUN& classifier)
+
+__attribute__((target("sse2")))
+inline __m128i in_range_sse2(__m128i x, uint8_t lo, uint8_t span)
 {
-    if (str.empty())
-        return str;
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(span)), t);
+}
 
-    size_t end = str.size();
-    while (end > 0 && classifier(str[end - 1]))
-        --end;
+__attribute__((target("avx2")))
+inline __m256i in_range_avx2(__m256i x, uint8_t lo, uint8_t span)
+{
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(span)), t);
+}
 
-    if (end == 0)
-        return std::string();
-    else
-        return str.substr(0, end);
+__attribute__((target("sse2")))
+inline unsigned match_sse2(const char* buf, const CharRanges& cls)
+{
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+    __m128i res = in_range_sse2(x, cls.lo[0], cls.span[0]);
+    for (unsigned i = 1; i < cls.count; ++i)
+        res = _mm_or_si128(res, in_range_sse2(x, cls.lo[i], cls.span[i]));
+    return _mm_movemask_epi8(res);
 }
 
-/**
- * Return the substring of 'str' without all leading and trailing characters
- * for which 'classifier' returns true.
- */
-template<typename FUN>
-std::string strip(const std::string& str, const FUN& classifier)
+__attribute__((target("avx2")))
+inline uint32_t match_avx2(const char* buf, const CharRanges& cls)
 {
-    if (str.empty())
-        return str;
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf));
+    __m256i res = in_range_avx2(x, cls.lo[0], cls.span[0]);
+    for (unsigned i = 1; i < cls.count; ++i)
+        res = _mm256_or_si256(res, in_range_avx2(x, cls.lo[i], cls.span[i]));
+    return _mm256_movemask_epi8(res);
+}
+
+/// Flip the case of the ASCII letters in [lo, lo + 25] in 32 byte blocks
+__attribute__((target("avx2")))
+size_t flip_case_avx2(char* buf, size_t size, uint8_t lo)
+{
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+        __m256i letters = in_range_avx2(x, lo, 25);
+        x = _mm256_xor_si256(x, _mm256_and_si256(letters, _mm256_set1_epi8(0x20)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(buf + i), x);
+    }
+    return i;
+}
+
+/// Flip the case of the ASCII letters in [lo, lo + 25] in 16 byte blocks
+__attribute__((target("sse2")))
+size_t flip_case_sse2(char* buf, size_t size, uint8_t lo)
+{
+    size_t i = 0;
+    for ( ; i + 16 <= size; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        __m128i letters = in_range_sse2(x, lo, 25);
+        x = _mm_xor_si128(x, _mm_and_si128(letters, _mm_set1_epi8(0x20)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buf + i), x);
+    }
+    return i;
+}
+#endif
+
+/// Flip the case of the ASCII letters in [lo, lo + 25]
+void flip_case(char* buf, size_t size, char lo)
+{
+    size_t i = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        i = flip_case_avx2(buf, size, lo);
+    i += flip_case_sse2(buf + i, size - i, lo);
+#endif
+    for ( ; i < size; ++i)
+        if (static_cast<unsigned char>(buf[i] - lo) <= 25)
+            buf[i] ^= 0x20;
+}
+
+}
 
-    size_t beg = 0;
-    size_t end = str.size();
-    while (beg < end && classifier(str[beg]))
-        ++beg;
-    while (beg < end && classifier(str[end - 1]))
-        --end;
 
-    return str.substr(beg, end - beg);
+std::string upper(const std::string& str)
+{
+    std::string res(str);
+    upper_inplace(res);
+    return res;
+}
+
+std::string lower(const std::string& str)
+{
+    std::string res(str);
+    lower_inplace(res);
+    return res;
+}
+
+void upper_inplace(char* buf, size_t size)
+{
+    flip_case(buf, size, 'a');
+}
+
+void lower_inplace(char* buf, size_t size)
+{
+    flip_case(buf, size, 'A');
 }
 
+size_t find_first_not_of(std::string_view str, CharClass cls)
+{
+    const CharRanges& ranges = char_class(cls);
+    const char* buf = str.data();
+    size_t size = str.size();
+    size_t i = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        for ( ; i + 32 <= size; i += 32)
+            if (uint32_t mismatch = ~match_avx2(buf + i, ranges))
+                return i + __builtin_ctz(mismatch);
+    for ( ; i + 16 <= size; i += 16)
+        if (unsigned mismatch = ~match_sse2(buf + i, ranges) & 0xffff)
+            return i + __builtin_ctz(mismatch);
+#endif
+    for ( ; i < size; ++i)
+        if (!ranges(buf[i]))
+            return i;
+    return std::string_view::npos;
 }
 
+size_t find_last_not_of(std::string_view str, CharClass cls)
+{
+    const CharRanges& ranges = char_class(cls);
+    const char* buf = str.data();
+    size_t end = str.size();
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        for ( ; end >= 32; end -= 32)
+            if (uint32_t mismatch = ~match_avx2(buf + end - 32, ranges))
+                return end - 32 + 31 - __builtin_clz(mismatch);
+    for ( ; end >= 16; end -= 16)
+        if (unsigned mismatch = ~match_sse2(buf + end - 16, ranges) & 0xffff)
+            return end - 16 + 31 - __builtin_clz(mismatch);
+#endif
+    for ( ; end > 0; --end)
+        if (!ranges(buf[end - 1]))
+            return end - 1;
+    return std::string_view::npos;
+}
 
 std::string lstrip(const std::string& str)
 {
-    return lstrip(str, ::isspace);
+    return std::string(lstrip_view(str));
 }
 
 std::string rstrip(const std::string& str)
 {
-    return rstrip(str, ::isspace);
+    return std::string(rstrip_view(str));
 }
 
 std::string strip(const std::string& str)
 {
-    return strip(str, ::isspace);
+    return std::string(strip_view(str));
+}
+
+std::string_view lstrip_view(std::string_view str)
+{
+    size_t beg = find_first_not_of(str, CharClass::SPACE);
+    if (beg == std::string_view::npos)
+        return str.substr(str.size());
+    return str.substr(beg);
+}
+
+std::string_view rstrip_view(std::string_view str)
+{
+    size_t last = find_last_not_of(str, CharClass::SPACE);
+    if (last == std::string_view::npos)
+        return str.substr(0, 0);
+    return str.substr(0, last + 1);
+}
+
+std::string_view strip_view(std::string_view str)
+{
+    return rstrip_view(lstrip_view(str));
 }
 
 std::string basename(const std::string& pathname)
 {
-    size_t pos = pathname.rfind("/");
-    if (pos == std::string::npos)
+    return std::string(basename_view(pathname));
+}
+
+std::string dirname(const std::string& pathname)
+{
+    return std::string(dirname_view(pathname));
+}
+
+namespace {
+
+/**
+ * Normalise the pathname in buf, in place, and return its new length.
+ *
+ * An empty result means the current directory.
+ */
+size_t normalize_path(char* buf, size_t size)
+{
+    const bool absolute = size > 0 && buf[0] == '/';
+    // Length of the part of the output that '..' cannot remove: the leading
+    // '/' of absolute paths, or the leading '..' components of relative ones
+    size_t floor = absolute ? 1 : 0;
+    // Write position, always before or at the read position
+    size_t w = floor;
+
+    size_t r = 0;
+    while (r < size)
+    {
+        // Find the next component
+        while (r < size && buf[r] == '/')
+            ++r;
+        size_t start = r;
+        while (r < size && buf[r] != '/')
+            ++r;
+        size_t clen = r - start;
+
+        if (clen == 0 || (clen == 1 && buf[start] == '.'))
+            continue;
+
+        const bool dotdot = clen == 2 && buf[start] == '.' && buf[start + 1] == '.';
+        if (dotdot)
+        {
+            if (w > floor)
+            {
+                // Drop the last component
+                while (w > floor && buf[w - 1] != '/')
+                    --w;
+                if (w > floor)
+                    --w;
+                continue;
+            }
+            // Nothing to drop: '..' is ignored at the root, and kept at the
+            // beginning of relative paths
+            if (absolute)
+                continue;
+        }
+
+        if (w > (absolute ? 1 : 0))
+            buf[w++] = '/';
+        memmove(buf + w, buf + start, clen);
+        w += clen;
+
+        // A '..' that could not be dropped cannot be dropped later either
+        if (dotdot)
+            floor = w;
+    }
+
+    return w;
+}
+
+}
+
+std::string_view basename_view(std::string_view pathname)
+{
+    size_t pos = pathname.rfind('/');
+    if (pos == std::string_view::npos)
         return pathname;
     else
         return pathname.substr(pos+1);
 }
 
-std::string dirname(const std::string& pathname)
+std::string_view dirname_view(std::string_view pathname)
 {
     if (pathname.empty()) return ".";
 
@@ -106,11 +356,11 @@ std::string dirname(const std::string& pathname)
     if (!end) return "/";
 
     // Find the previous separator
-    end = pathname.rfind("/", end - 1);
+    end = pathname.rfind('/', end - 1);
 
-    if (end == std::string::npos)
+    if (end == std::string_view::npos)
         // No previous separator found, everything should be chopped
-        return std::string(".");
+        return ".";
     else
     {
         while (end > 0 && pathname[end - 1] == '/')
@@ -122,31 +372,15 @@ std::string dirname(const std::string& pathname)
 
 void appendpath(std::string& dest, const char* path2)
 {
-    if (!*path2)
-        return;
-
-    if (dest.empty())
-    {
-        dest = path2;
-        return;
-    }
-
-    if (dest[dest.size() - 1] == '/')
-        if (path2[0] == '/')
-            dest += (path2 + 1);
-        else
-            dest += path2;
-    else
-        if (path2[0] == '/')
-            dest += path2;
-        else
-        {
-            dest += '/';
-            dest += path2;
-        }
+    appendpath(dest, std::string_view(path2));
 }
 
 void appendpath(std::string& dest, const std::string& path2)
+{
+    appendpath(dest, std::string_view(path2));
+}
+
+void appendpath(std::string& dest, std::string_view path2)
 {
     if (path2.empty())
         return;
@@ -181,343 +415,2833 @@ std::string joinpath(const std::string& path1, const std::string& path2)
 
 std::string normpath(const std::string& pathname)
 {
-    vector<string> st;
-    if (pathname[0] == '/')
-        st.push_back("/");
-
-    Split split(pathname, "/");
-    for (const auto& i: split)
-    {
-        if (i == "." || i.empty()) continue;
-        if (i == "..")
-            if (st.back() == "..")
-                st.emplace_back(i);
-            else if (st.back() == "/")
-                continue;
-            else
-                st.pop_back();
-        else
-            st.emplace_back(i);
-    }
+    return normpath(std::string_view(pathname));
+}
 
-    if (st.empty())
-        return ".";
+std::string normpath(const char* pathname)
+{
+    return normpath(std::string_view(pathname));
+}
 
-    string res;
-    for (const auto& i: st)
-        appendpath(res, i);
+std::string normpath(std::string_view pathname)
+{
+    std::string res(pathname);
+    res.resize(normalize_path(&res[0], res.size()));
+    if (res.empty())
+        res = ".";
     return res;
 }
 
-Split::const_iterator::const_iterator(const Split& split)
-    : split(&split)
+/*
+ * Number parsing and formatting
+ */
+
+namespace impl {
+
+void throw_parse_error(std::string_view str, std::errc err)
 {
-    if (split.str.empty())
-        this->split = nullptr;
-    else
+    std::string msg;
+    msg += '\'';
+    msg.append(str.data(), str.size());
+    if (err == std::errc::result_out_of_range)
     {
-        // Ignore leading separators if skip_end is true
-        if (split.skip_empty) skip_separators();
-        ++*this;
+        msg += "' is out of range";
+        throw std::out_of_range(msg);
     }
+    msg += "' is not a valid number";
+    throw std::invalid_argument(msg);
 }
 
-Split::const_iterator::~const_iterator()
-{
-}
-
-std::string Split::const_iterator::remainder() const
-{
-    if (end == std::string::npos)
-        return std::string();
-    else
-        return split->str.substr(end);
 }
 
-void Split::const_iterator::skip_separators()
+void format_fixed_append(std::string& out, double value, int precision)
 {
-    const std::string& str = split->str;
-    const std::string& sep = split->sep;
-
-    while (end + sep.size() <= str.size())
+    char buf[64];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, precision);
+    if (res.ec == std::errc())
     {
-        unsigned i = 0;
-        for ( ; i < sep.size(); ++i)
-            if (str[end + i] != sep[i])
-                break;
-        if (i < sep.size())
-            break;
-        else
-            end += sep.size();
+        out.append(buf, res.ptr);
+        return;
     }
+
+    // Large values need room for all their integer digits
+    size_t pos = out.size();
+    out.resize(pos + std::numeric_limits<double>::max_exponent10 + std::max(precision, 6) + 4);
+    res = std::to_chars(&out[pos], &out[0] + out.size(), value, std::chars_format::fixed, precision);
+    out.resize(res.ptr - out.data());
 }
 
-Split::const_iterator& Split::const_iterator::operator++()
-{
-    if (!split) return *this;
+/*
+ * Arena
+ */
 
-    const std::string& str = split->str;
-    const std::string& sep = split->sep;
-    bool skip_empty = split->skip_empty;
+Arena::Arena(size_t block_size)
+    : block_size(block_size)
+{
+}
 
-    /// Convert into an end iterator
-    if (end == std::string::npos)
+char* Arena::allocate_slow(size_t size)
+{
+    if (size > block_size / 4)
     {
-        split = nullptr;
-        return *this;
+        // Give large strings a block of their own, and keep filling the
+        // current one
+        blocks.emplace_back(Block{std::unique_ptr<char[]>(new char[size]), size});
+        return blocks.back().data.get();
     }
 
-    /// The string ended with an iterator, and we do not skip empty tokens:
-    /// return it
-    if (end == str.size())
-    {
-        cur = string();
-        end = std::string::npos;
-        return *this;
-    }
+    blocks.emplace_back(Block{std::unique_ptr<char[]>(new char[block_size]), block_size});
+    char* res = blocks.back().data.get();
+    cur = res + size;
+    avail = block_size - size;
+    return res;
+}
 
-    /// Position of the first character past the token that starts at 'end'
-    size_t tok_end;
-    if (sep.empty())
-        /// If separator is empty, advance one character at a time
-        tok_end = end + 1;
-    else
+std::string_view Arena::store(std::string_view str)
+{
+    char* res = allocate(str.size() + 1);
+    memcpy(res, str.data(), str.size());
+    res[str.size()] = 0;
+    return std::string_view(res, str.size());
+}
+
+std::string_view Arena::concat(std::initializer_list<std::string_view> parts)
+{
+    size_t size = 0;
+    for (const auto& p: parts)
+        size += p.size();
+    char* res = allocate(size + 1);
+    char* pos = res;
+    for (const auto& p: parts)
     {
-        /// The token ends at the next separator
-        tok_end = str.find(sep, end);
+        memcpy(pos, p.data(), p.size());
+        pos += p.size();
     }
+    *pos = 0;
+    return std::string_view(res, size);
+}
 
-    /// No more separators found, return from end to the end of the string
-    if (tok_end == std::string::npos)
+void Arena::clear()
+{
+    // Keep a full sized block, if there is one
+    auto keep = std::find_if(blocks.begin(), blocks.end(), [&](const Block& b) { return b.size == block_size; });
+    if (keep == blocks.end())
     {
-        cur = str.substr(end);
-        end = std::string::npos;
-        return *this;
+        blocks.clear();
+        cur = nullptr;
+        avail = 0;
+        return;
     }
+    Block block = std::move(*keep);
+    blocks.clear();
+    blocks.emplace_back(std::move(block));
+    cur = blocks.back().data.get();
+    avail = block_size;
+}
 
-    /// We have the boundaries of the current token
-    cur = str.substr(end, tok_end - end);
+size_t Arena::capacity() const
+{
+    size_t res = 0;
+    for (const auto& b: blocks)
+        res += b.size;
+    return res;
+}
 
-    /// Skip the separator
-    end = tok_end + sep.size();
+std::string_view normpath(Arena& arena, std::string_view pathname)
+{
+    // Allocate room for "." when the result is empty
+    size_t size = std::max(pathname.size(), (size_t)1) + 1;
+    char* buf = arena.allocate(size);
+    memcpy(buf, pathname.data(), pathname.size());
+    size_t len = normalize_path(buf, pathname.size());
+    if (len == 0)
+        buf[len++] = '.';
+    buf[len] = 0;
+    arena.shrink(buf, size, len + 1);
+    return std::string_view(buf, len);
+}
 
-    /// Skip all the following separators if skip_empty is true
-    if (skip_empty)
+std::string_view joinpath(Arena& arena, std::initializer_list<std::string_view> components)
+{
+    // Enough for all components, a separator between each and the trailing 0
+    size_t size = components.size() + 1;
+    for (const auto& c: components)
+        size += c.size();
+    char* buf = arena.allocate(size);
+
+    // Same logic as appendpath
+    size_t len = 0;
+    for (auto c: components)
     {
-        skip_separators();
-        if (end == str.size())
+        if (c.empty())
+            continue;
+        if (len > 0)
         {
-            end = std::string::npos;
-            return *this;
+            if (buf[len - 1] == '/')
+            {
+                if (c[0] == '/')
+                    c.remove_prefix(1);
+            } else if (c[0] != '/')
+                buf[len++] = '/';
         }
+        memcpy(buf + len, c.data(), c.size());
+        len += c.size();
     }
-
-    return *this;
+    buf[len] = 0;
+    arena.shrink(buf, size, len + 1);
+    return std::string_view(buf, len);
 }
 
-const std::string& Split::const_iterator::operator*() const { return cur; }
-const std::string* Split::const_iterator::operator->() const { return &cur; }
+/*
+ * PathBuffer
+ */
 
-bool Split::const_iterator::operator==(const const_iterator& ti) const
+PathBuffer::PathBuffer()
+    : buf(inline_buf)
 {
-    if (!split && !ti.split) return true;
-    if (split != ti.split) return false;
-    return end == ti.end;
+    buf[0] = 0;
 }
 
-bool Split::const_iterator::operator!=(const const_iterator& ti) const
+PathBuffer::PathBuffer(std::string_view path)
+    : PathBuffer()
 {
-    if (!split && !ti.split) return false;
-    if (split != ti.split) return true;
-    return end != ti.end;
+    assign(path);
 }
 
+PathBuffer::PathBuffer(const PathBuffer& o)
+    : PathBuffer()
+{
+    assign(o.view());
+}
 
-std::string encode_cstring(const std::string& str)
+PathBuffer::PathBuffer(PathBuffer&& o)
+    : PathBuffer()
 {
-    string res;
-    for (string::const_iterator i = str.begin(); i != str.end(); ++i)
-        if (*i == '\n')
-            res += "\\n";
-        else if (*i == '\t')
-            res += "\\t";
-        else if (*i == 0 || iscntrl(*i))
-        {
-            char buf[5];
-            snprintf(buf, 5, "\\x%02x", (unsigned int)*i);
-            res += buf;
-        }
-        else if (*i == '"' || *i == '\\')
-        {
-            res += "\\";
-            res += *i;
-        }
-        else
-            res += *i;
-    return res;
+    *this = std::move(o);
 }
 
-std::string decode_cstring(const std::string& str, size_t& lenParsed)
+PathBuffer::~PathBuffer()
 {
-    string res;
-    string::const_iterator i = str.begin();
-    for ( ; i != str.end() && *i != '"'; ++i)
-        if (*i == '\\' && (i+1) != str.end())
-        {
-            switch (*(i+1))
-            {
-                case 'n': res += '\n'; break;
-                case 't': res += '\t'; break;
-                case 'x': {
-                              size_t j;
-                              char buf[5] = "0x\0\0";
-                              // Read up to 2 extra hex digits
-                              for (j = 0; j < 2 && i+2+j != str.end() && isxdigit(*(i+2+j)); ++j)
-                                  buf[2+j] = *(i+2+j);
-                              i += j;
-                              res += (char)atoi(buf);
-                              break;
-                          }
-                default:
-                          res += *(i+1);
-                          break;
-            }
-            ++i;
-        } else
-            res += *i;
-    if (i != str.end() && *i == '"')
-        ++i;
-    lenParsed = i - str.begin();
-    return res;
+    if (buf != inline_buf)
+        delete[] buf;
 }
 
-std::string encode_url(const std::string& str)
+PathBuffer& PathBuffer::operator=(const PathBuffer& o)
 {
-    string res;
-    for (string::const_iterator i = str.begin(); i != str.end(); ++i)
-    {
-        if ( (*i >= '0' && *i <= '9') || (*i >= 'A' && *i <= 'Z')
-          || (*i >= 'a' && *i <= 'z') || *i == '-' || *i == '_'
-          || *i == '!' || *i == '*' || *i == '\'' || *i == '(' || *i == ')')
-            res += *i;
-        else {
-            char buf[4];
-            snprintf(buf, 4, "%%%02x", static_cast<unsigned>(static_cast<unsigned char>(*i)));
-            res += buf;
-        }
-    }
-    return res;
+    if (this != &o)
+        assign(o.view());
+    return *this;
 }
 
-std::string decode_url(const std::string& str)
+PathBuffer& PathBuffer::operator=(PathBuffer&& o)
 {
-    string res;
-    for (size_t i = 0; i < str.size(); ++i)
+    if (this == &o)
+        return *this;
+
+    if (o.buf == o.inline_buf)
     {
-        if (str[i] == '%')
-        {
-            // If there's a partial %something at the end, ignore it
-            if (i >= str.size() - 2)
-                return res;
-            res += static_cast<char>(strtoul(str.substr(i+1, 2).c_str(), 0, 16));
-            i += 2;
-        }
-        else
-            res += str[i];
+        assign(o.view());
+    } else {
+        if (buf != inline_buf)
+            delete[] buf;
+        buf = o.buf;
+        len = o.len;
+        cap = o.cap;
+        o.buf = o.inline_buf;
+        o.cap = inline_size;
     }
-    return res;
+    o.clear();
+    return *this;
 }
 
-static const char* base64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-template<typename T>
-static char invbase64(const T& idx)
+void PathBuffer::reserve(size_t size)
 {
-    static const char data[] = {62,0,0,0,63,52,53,54,55,56,57,58,59,60,61,0,0,0,0,0,0,0,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,0,0,0,0,0,0,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51};
-    if (idx < 43) return 0;
-    if (static_cast<unsigned>(idx) > 43 + (sizeof(data)/sizeof(data[0]))) return 0;
-    return data[idx - 43];
+    if (size < cap)
+        return;
+
+    size_t new_cap = std::max(size + 1, cap * 2);
+    char* new_buf = new char[new_cap];
+    memcpy(new_buf, buf, len + 1);
+    if (buf != inline_buf)
+        delete[] buf;
+    buf = new_buf;
+    cap = new_cap;
 }
 
-std::string encode_base64(const std::string& str)
+void PathBuffer::clear()
 {
-    return encode_base64(str.data(), str.size());
+    len = 0;
+    buf[0] = 0;
 }
 
-std::string encode_base64(const void* data, size_t size)
+void PathBuffer::assign(std::string_view path)
 {
-    std::string res;
-    const uint8_t* str = (const uint8_t*)data;
-
-    for (size_t i = 0; i < size; i += 3)
+    if (path.data() >= buf && path.data() < buf + len)
     {
-        // Pack every triplet into 24 bits
-        unsigned int enc;
-        if (i + 3 < size)
-            enc = (str[i] << 16) | (str[i + 1] << 8) | str[i + 2];
-        else
+        // Assigning a part of ourselves
+        memmove(buf, path.data(), path.size());
+    } else {
+        len = 0;
+        reserve(path.size());
+        memcpy(buf, path.data(), path.size());
+    }
+    len = path.size();
+    buf[len] = 0;
+}
+
+PathBuffer& PathBuffer::append(std::string_view path)
+{
+    if (path.empty())
+        return *this;
+
+    if (len == 0)
+    {
+        assign(path);
+        return *this;
+    }
+
+    // Remember where path is if it points inside the buffer, since reserve
+    // can move it
+    size_t self_offset = std::string_view::npos;
+    if (path.data() >= buf && path.data() < buf + len)
+        self_offset = path.data() - buf;
+
+    bool has_slash = buf[len - 1] == '/';
+    reserve(len + path.size() + 1);
+    if (self_offset != std::string_view::npos)
+        path = std::string_view(buf + self_offset, path.size());
+
+    if (has_slash)
+    {
+        if (path[0] == '/')
+            path.remove_prefix(1);
+    } else if (path[0] != '/')
+        buf[len++] = '/';
+
+    memmove(buf + len, path.data(), path.size());
+    len += path.size();
+    buf[len] = 0;
+    return *this;
+}
+
+void PathBuffer::normalize()
+{
+    len = normalize_path(buf, len);
+    if (len == 0)
+        buf[len++] = '.';
+    buf[len] = 0;
+}
+
+void PathBuffer::make_absolute(std::string_view cwd)
+{
+    if (len == 0 || buf[0] != '/')
+    {
+        if (cwd.data() >= buf && cwd.data() < buf + cap)
+            throw std::invalid_argument("cannot make a path absolute using a part of itself as the current directory");
+
+        // Make room for cwd and a separator, and move the path after them
+        reserve(cwd.size() + 1 + len);
+        memmove(buf + cwd.size() + 1, buf, len + 1);
+        memcpy(buf, cwd.data(), cwd.size());
+        buf[cwd.size()] = '/';
+        len += cwd.size() + 1;
+    }
+    normalize();
+}
+
+/*
+ * Appender
+ */
+
+Appender::Appender()
+    : buf(inline_buf)
+{
+    buf[0] = 0;
+}
+
+Appender::Appender(const Appender& o)
+    : Appender()
+{
+    append(o.view());
+}
+
+Appender::Appender(Appender&& o)
+    : Appender()
+{
+    *this = std::move(o);
+}
+
+Appender::~Appender()
+{
+    if (buf != inline_buf)
+        delete[] buf;
+}
+
+Appender& Appender::operator=(const Appender& o)
+{
+    if (this != &o)
+    {
+        clear();
+        append(o.view());
+    }
+    return *this;
+}
+
+Appender& Appender::operator=(Appender&& o)
+{
+    if (this == &o)
+        return *this;
+
+    if (o.buf == o.inline_buf)
+    {
+        clear();
+        append(o.view());
+    } else {
+        if (buf != inline_buf)
+            delete[] buf;
+        buf = o.buf;
+        len = o.len;
+        cap = o.cap;
+        o.buf = o.inline_buf;
+        o.cap = inline_size;
+    }
+    o.clear();
+    return *this;
+}
+
+void Appender::reserve(size_t size)
+{
+    if (size < cap)
+        return;
+
+    size_t new_cap = std::max(size + 1, cap * 2);
+    char* new_buf = new char[new_cap];
+    memcpy(new_buf, buf, len + 1);
+    if (buf != inline_buf)
+        delete[] buf;
+    buf = new_buf;
+    cap = new_cap;
+}
+
+void Appender::clear()
+{
+    len = 0;
+    buf[0] = 0;
+}
+
+/*
+ * Searcher
+ */
+
+namespace {
+
+#ifdef WOBBLE_STR_X86_SIMD
+/*
+ * Search needles of 2 or more bytes by comparing 16 or 32 candidate
+ * positions at a time with the first and the last byte of the needle, and
+ * checking the rest of the needle only where both match, as described by
+ * Wojciech Muła in "SIMD-friendly algorithms for substring searching".
+ *
+ * If bounded is true, checking candidates uses up a budget that grows with
+ * the haystack bytes scanned: when it runs out, the kernels give up, and the
+ * caller can continue with an algorithm with better worst case behaviour.
+ *
+ * The kernels return the position of the match, search_gave_up, or npos if
+ * no match was found among the candidates that they could check. pos is set
+ * to the first candidate left unchecked.
+ */
+
+constexpr size_t search_gave_up = std::string_view::npos - 1;
+
+template<bool bounded> __attribute__((target("sse2")))
+size_t search_sse2(const char* h, size_t size, const char* n, size_t nsize, size_t& pos, size_t& budget)
+{
+    const __m128i first = _mm_set1_epi8(n[0]);
+    const __m128i last = _mm_set1_epi8(n[nsize - 1]);
+    for ( ; pos + nsize + 15 <= size; pos += 16)
+    {
+        if (bounded)
+            budget += 16;
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + pos));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + pos + nsize - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(block_first, first),
+                    _mm_cmpeq_epi8(block_last, last)));
+        while (mask)
+        {
+            if (bounded)
+            {
+                if (budget < nsize)
+                    return search_gave_up;
+                budget -= nsize;
+            }
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(h + pos + bit + 1, n + 1, nsize - 2) == 0)
+                return pos + bit;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+template<bool bounded> __attribute__((target("avx2")))
+size_t search_avx2(const char* h, size_t size, const char* n, size_t nsize, size_t& pos, size_t& budget)
+{
+    const __m256i first = _mm256_set1_epi8(n[0]);
+    const __m256i last = _mm256_set1_epi8(n[nsize - 1]);
+    for ( ; pos + nsize + 31 <= size; pos += 32)
+    {
+        if (bounded)
+            budget += 32;
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + pos));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + pos + nsize - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(block_first, first),
+                    _mm256_cmpeq_epi8(block_last, last)));
+        while (mask)
+        {
+            if (bounded)
+            {
+                if (budget < nsize)
+                    return search_gave_up;
+                budget -= nsize;
+            }
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(h + pos + bit + 1, n + 1, nsize - 2) == 0)
+                return pos + bit;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view::npos;
+}
+#endif
+
+/**
+ * Compute the maximal suffix of the needle, using the given byte ordering,
+ * returning its start minus one, and setting period to its period
+ */
+template<typename Less>
+size_t maximal_suffix(const uint8_t* n, size_t size, size_t& period, Less less)
+{
+    size_t ip = -1, jp = 0, k = 1;
+    period = 1;
+    while (jp + k < size)
+    {
+        uint8_t a = n[ip + k];
+        uint8_t b = n[jp + k];
+        if (a == b)
+        {
+            if (k == period)
+            {
+                jp += period;
+                k = 1;
+            } else
+                ++k;
+        } else if (less(b, a)) {
+            jp += k;
+            k = 1;
+            period = jp - ip;
+        } else {
+            ip = jp++;
+            k = period = 1;
+        }
+    }
+    return ip;
+}
+
+}
+
+void Searcher::prepare_two_way()
+{
+    // Two-Way preprocessing, following Crochemore and Perrin, "Two-way
+    // string-matching", and the implementation in musl's memmem
+    two_way = true;
+    const uint8_t* n = reinterpret_cast<const uint8_t*>(needle.data());
+    size_t size = needle.size();
+
+    for (size_t i = 0; i < size; ++i)
+        byteset[n[i] >> 6] |= uint64_t(1) << (n[i] & 63);
+
+    // The critical factorization comes from the longer of the maximal
+    // suffixes for the two opposite byte orderings
+    size_t p1, p2;
+    size_t ms1 = maximal_suffix(n, size, p1, std::less<uint8_t>());
+    size_t ms2 = maximal_suffix(n, size, p2, std::greater<uint8_t>());
+    if (ms2 + 1 > ms1 + 1)
+    {
+        critical = ms2;
+        period = p2;
+    } else {
+        critical = ms1;
+        period = p1;
+    }
+
+    if (memcmp(n, n + period, critical + 1) == 0)
+        // Periodic needle: after a match or a mismatch on the left half,
+        // the first size - period bytes are known to match again
+        period_memory = size - period;
+    else
+    {
+        period = std::max(critical + 1, size - critical - 1) + 1;
+        period_memory = 0;
+    }
+}
+
+size_t Searcher::find_two_way(std::string_view haystack, size_t pos) const
+{
+    const uint8_t* n = reinterpret_cast<const uint8_t*>(needle.data());
+    const size_t size = needle.size();
+    const uint8_t* h = reinterpret_cast<const uint8_t*>(haystack.data()) + pos;
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(haystack.data()) + haystack.size();
+    size_t memory = 0;
+    while (static_cast<size_t>(end - h) >= size)
+    {
+        // If the last byte does not occur in the needle, no match can
+        // overlap it
+        uint8_t c = h[size - 1];
+        if (!(byteset[c >> 6] & (uint64_t(1) << (c & 63))))
+        {
+            h += size;
+            memory = 0;
+            continue;
+        }
+
+        // Compare the right half
+        size_t k;
+        for (k = std::max(critical + 1, memory); k < size && n[k] == h[k]; ++k)
+            ;
+        if (k < size)
+        {
+            h += k - critical;
+            memory = 0;
+            continue;
+        }
+
+        // Compare the left half
+        for (k = critical + 1; k > memory && n[k - 1] == h[k - 1]; --k)
+            ;
+        if (k <= memory)
+            return h - reinterpret_cast<const uint8_t*>(haystack.data());
+        h += period;
+        memory = period_memory;
+    }
+    return std::string_view::npos;
+}
+
+size_t Searcher::find_long(std::string_view haystack, size_t pos) const
+{
+#ifdef WOBBLE_STR_X86_SIMD
+    // Short needles need no budget, since checking a candidate costs at most
+    // short_needle_size comparisons
+    const char* h = haystack.data();
+    size_t budget = needle.size() * 4;
+    size_t res = std::string_view::npos;
+    if (cpu_has_avx2())
+        res = two_way ? search_avx2<true>(h, haystack.size(), needle.data(), needle.size(), pos, budget)
+                      : search_avx2<false>(h, haystack.size(), needle.data(), needle.size(), pos, budget);
+    if (res == std::string_view::npos)
+        res = two_way ? search_sse2<true>(h, haystack.size(), needle.data(), needle.size(), pos, budget)
+                      : search_sse2<false>(h, haystack.size(), needle.data(), needle.size(), pos, budget);
+    if (res != std::string_view::npos && res != search_gave_up)
+        return res;
+#endif
+
+    // Continue with the positions left at the end, or after the vectorized
+    // search gave up
+    if (two_way)
+        return find_two_way(haystack, pos);
+    return haystack.find(needle, pos);
+}
+
+/*
+ * SplitView
+ */
+
+SplitView::const_iterator::const_iterator(const SplitView& split)
+    : str(split.str), sep(split.sep), skip_empty(split.skip_empty)
+{
+    if (str.empty())
+        return;
+
+    valid = true;
+    // Ignore leading separators if skip_end is true
+    if (skip_empty) skip_separators();
+    ++*this;
+}
+
+std::string_view SplitView::const_iterator::remainder() const
+{
+    if (end == std::string_view::npos)
+        return std::string_view();
+    else
+        return str.substr(end);
+}
+
+void SplitView::const_iterator::skip_separators()
+{
+    if (sep.empty())
+        return;
+
+    if (sep.size() == 1)
+    {
+        while (end < str.size() && str[end] == sep[0])
+            ++end;
+        return;
+    }
+
+    while (end + sep.size() <= str.size() && str.compare(end, sep.size(), sep) == 0)
+        end += sep.size();
+}
+
+SplitView::const_iterator& SplitView::const_iterator::operator++()
+{
+    if (!valid) return *this;
+
+    /// Convert into an end iterator
+    if (end == std::string_view::npos)
+    {
+        valid = false;
+        return *this;
+    }
+
+    /// The string ended with an iterator, and we do not skip empty tokens:
+    /// return it
+    if (end == str.size())
+    {
+        cur = std::string_view();
+        end = std::string_view::npos;
+        return *this;
+    }
+
+    /// Position of the first character past the token that starts at 'end'
+    size_t tok_end;
+    if (sep.empty())
+        /// If separator is empty, advance one character at a time
+        tok_end = end + 1;
+    else if (sep.size() == 1)
+    {
+        /// The token ends at the next separator
+        const void* found = memchr(str.data() + end, sep[0], str.size() - end);
+        tok_end = found ? static_cast<const char*>(found) - str.data() : std::string_view::npos;
+    }
+    else
+        /// Preparing a Searcher costs nothing for short separators, and for
+        /// long ones no more than skipping the separator that it finds
+        tok_end = Searcher(sep).find(str, end);
+
+    /// No more separators found, return from end to the end of the string
+    if (tok_end == std::string_view::npos)
+    {
+        cur = str.substr(end);
+        end = std::string_view::npos;
+        return *this;
+    }
+
+    /// We have the boundaries of the current token
+    cur = str.substr(end, tok_end - end);
+
+    /// Skip the separator
+    end = tok_end + sep.size();
+
+    /// Skip all the following separators if skip_empty is true
+    if (skip_empty)
+    {
+        skip_separators();
+        if (end == str.size())
+        {
+            end = std::string_view::npos;
+            return *this;
+        }
+    }
+
+    return *this;
+}
+
+bool SplitView::const_iterator::operator==(const const_iterator& ti) const
+{
+    if (!valid && !ti.valid) return true;
+    if (valid != ti.valid || str.data() != ti.str.data()) return false;
+    return end == ti.end;
+}
+
+bool SplitView::const_iterator::operator!=(const const_iterator& ti) const
+{
+    return !operator==(ti);
+}
+
+
+/*
+ * ByteSet
+ */
+
+namespace {
+
+#ifdef WOBBLE_STR_X86_SIMD
+/*
+ * Membership of ASCII bytes in a set is tested with two table lookups: the
+ * low nibble selects a bitmap of the high nibbles in the set, and the high
+ * nibble selects the bit to test. High nibbles 8-15 select no bits, so that
+ * non-ASCII bytes never match.
+ */
+
+/**
+ * Return the offset of the first byte in buf that is in the set described by
+ * nibbles, or the offset where the complete 16 byte blocks end
+ */
+__attribute__((target("ssse3")))
+size_t find_byteset_ssse3(const char* buf, size_t size, const uint8_t* nibbles)
+{
+    const __m128i lo_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(nibbles));
+    const __m128i hi_table = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for ( ; i + 16 <= size; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(x, mask));
+        __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+        __m128i none = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+        if (unsigned found = ~_mm_movemask_epi8(none) & 0xffff)
+            return i + __builtin_ctz(found);
+    }
+    return i;
+}
+#endif
+
+}
+
+ByteSet::ByteSet(std::string_view chars)
+{
+    for (char c: chars)
+        add(c);
+}
+
+void ByteSet::add(char c)
+{
+    unsigned char u = c;
+    if (table[u])
+        return;
+    table[u] = true;
+    if (count++ == 0)
+        first = c;
+    if (u < 0x80)
+        nibbles[u & 0xf] |= 1 << (u >> 4);
+    else
+        ascii = false;
+}
+
+size_t ByteSet::find_in(std::string_view str, size_t pos) const
+{
+    if (pos >= str.size() || count == 0)
+        return std::string_view::npos;
+
+    const char* buf = str.data() + pos;
+    size_t size = str.size() - pos;
+
+    if (count == 1)
+    {
+        const void* res = memchr(buf, first, size);
+        return res ? static_cast<const char*>(res) - str.data() : std::string_view::npos;
+    }
+
+    // Tokens are often short, and the 16 byte kernel does better than the
+    // 32 byte one with them
+    size_t i = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (ascii && cpu_has_ssse3())
+        i = find_byteset_ssse3(buf, size, nibbles);
+#endif
+    for ( ; i < size; ++i)
+        if (contains(buf[i]))
+            return pos + i;
+    return std::string_view::npos;
+}
+
+size_t ByteSet::find_not_in(std::string_view str, size_t pos) const
+{
+    for ( ; pos < str.size(); ++pos)
+        if (!contains(str[pos]))
+            return pos;
+    return std::string_view::npos;
+}
+
+
+/*
+ * Tokenizer
+ */
+
+Tokenizer::const_iterator::const_iterator(const Tokenizer& tok)
+    : tok(&tok)
+{
+    if (tok.str.empty())
+    {
+        this->tok = nullptr;
+        return;
+    }
+
+    // Ignore leading separators if skip_empty is true
+    if (tok.skip_empty)
+    {
+        end = tok.separators.find_not_in(tok.str);
+        if (end == std::string_view::npos)
+        {
+            this->tok = nullptr;
+            return;
+        }
+    }
+
+    ++*this;
+}
+
+size_t Tokenizer::const_iterator::token_end(size_t& closing_quote) const
+{
+    const std::string_view& str = tok->str;
+    size_t pos = end;
+    closing_quote = std::string_view::npos;
+
+    // Skip over a quoted section
+    if (tok->quote && str[pos] == tok->quote)
+    {
+        pos = end + 1;
+        while (true)
+        {
+            pos = str.find(tok->quote, pos);
+            if (pos == std::string_view::npos)
+                return pos;
+            // Doubled quotes do not close the quoted section
+            if (pos + 1 < str.size() && str[pos + 1] == tok->quote)
+                pos += 2;
+            else
+                break;
+        }
+        closing_quote = pos++;
+    }
+
+    return tok->separators.find_in(str, pos);
+}
+
+std::string_view Tokenizer::const_iterator::remainder() const
+{
+    if (!tok || end == std::string_view::npos)
+        return std::string_view();
+    else
+        return tok->str.substr(end);
+}
+
+Tokenizer::const_iterator& Tokenizer::const_iterator::operator++()
+{
+    if (!tok) return *this;
+
+    // Convert into an end iterator
+    if (end == std::string_view::npos)
+    {
+        tok = nullptr;
+        return *this;
+    }
+
+    const std::string_view& str = tok->str;
+
+    // The string ended with a separator, and we do not skip empty tokens:
+    // return an empty token
+    if (end == str.size())
+    {
+        cur = std::string_view();
+        end = std::string_view::npos;
+        return *this;
+    }
+
+    // After the maximum number of splits, return the rest of the string
+    if (splits == tok->max_splits)
+    {
+        cur = str.substr(end);
+        end = std::string_view::npos;
+        return *this;
+    }
+
+    size_t closing_quote;
+    size_t tok_end = token_end(closing_quote);
+    if (tok_end == std::string_view::npos)
+        cur = str.substr(end);
+    else
+        cur = str.substr(end, tok_end - end);
+
+    // Remove the quotes around a quoted token
+    if (closing_quote != std::string_view::npos && closing_quote == end + cur.size() - 1)
+        cur = cur.substr(1, cur.size() - 2);
+
+    if (tok_end == std::string_view::npos)
+    {
+        end = std::string_view::npos;
+        return *this;
+    }
+
+    // Skip the separator, and all the following ones if skip_empty is true
+    ++splits;
+    end = tok_end + 1;
+    if (tok->skip_empty)
+        end = tok->separators.find_not_in(str, end);
+
+    return *this;
+}
+
+bool Tokenizer::const_iterator::operator==(const const_iterator& ti) const
+{
+    if (!tok && !ti.tok) return true;
+    return tok == ti.tok && end == ti.end;
+}
+
+bool Tokenizer::const_iterator::operator!=(const const_iterator& ti) const
+{
+    return !operator==(ti);
+}
+
+
+/*
+ * Glob
+ */
+
+namespace {
+
+/**
+ * Find the end of the [...] set that starts at pos, returning npos if it is
+ * not terminated
+ */
+size_t glob_set_end(std::string_view pattern, size_t pos)
+{
+    size_t i = pos + 1;
+    if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^'))
+        ++i;
+    // A ']' at the start of the set is literal
+    if (i < pattern.size() && pattern[i] == ']')
+        ++i;
+    for ( ; i < pattern.size(); ++i)
+    {
+        if (pattern[i] == '\\')
+            ++i;
+        else if (pattern[i] == ']')
+            return i;
+    }
+    return std::string_view::npos;
+}
+
+/// Expand the {...} alternatives in pattern, calling dest for each result
+void glob_expand(std::string_view pattern, const std::function<void(std::string_view)>& dest)
+{
+    // Find the first brace group
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        switch (pattern[i])
+        {
+            case '\\':
+                ++i;
+                continue;
+            case '[': {
+                size_t end = glob_set_end(pattern, i);
+                if (end != std::string_view::npos)
+                    i = end;
+                continue;
+            }
+            case '{':
+                break;
+            default:
+                continue;
+        }
+
+        // Split the group on top-level commas
+        std::vector<std::string_view> alternatives;
+        unsigned depth = 0;
+        size_t start = i + 1;
+        size_t j = start;
+        for ( ; j < pattern.size(); ++j)
+        {
+            char c = pattern[j];
+            if (c == '\\')
+                ++j;
+            else if (c == '{')
+                ++depth;
+            else if (c == '}' && depth)
+                --depth;
+            else if ((c == ',' || c == '}') && !depth)
+            {
+                alternatives.push_back(pattern.substr(start, j - start));
+                start = j + 1;
+                if (c == '}')
+                    break;
+            }
+        }
+
+        // An unterminated group is literal
+        if (j >= pattern.size())
+            break;
+
+        std::string_view before = pattern.substr(0, i);
+        std::string_view after = pattern.substr(j + 1);
+        std::string expanded;
+        for (const auto& alt: alternatives)
+        {
+            expanded.assign(before.data(), before.size());
+            expanded.append(alt.data(), alt.size());
+            expanded.append(after.data(), after.size());
+            glob_expand(expanded, dest);
+        }
+        return;
+    }
+
+    dest(pattern);
+}
+
+}
+
+Glob::Glob(std::string_view pattern)
+{
+    if (!pattern.empty())
+        add(pattern);
+}
+
+void Glob::add(std::string_view pattern)
+{
+    glob_expand(pattern, [this](std::string_view p) { compile(p); });
+}
+
+void Glob::clear()
+{
+    patterns.clear();
+    sets.clear();
+}
+
+void Glob::compile(std::string_view pattern)
+{
+    Pattern res;
+
+    auto add_literal = [&](char c) {
+        if (res.tokens.empty() || res.tokens.back().op != Op::LITERAL)
+            res.tokens.push_back(Token{Op::LITERAL, std::string()});
+        res.tokens.back().literal += c;
+    };
+
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        char c = pattern[i];
+        switch (c)
+        {
+            case '*':
+                // Consecutive stars are the same as one
+                if (res.tokens.empty() || res.tokens.back().op != Op::ANY_STRING)
+                    res.tokens.push_back(Token{Op::ANY_STRING, std::string()});
+                break;
+            case '?':
+                res.tokens.push_back(Token{Op::ANY_CHAR, std::string()});
+                break;
+            case '\\':
+                // A trailing backslash is literal
+                add_literal(i + 1 < pattern.size() ? pattern[++i] : c);
+                break;
+            case '[': {
+                size_t end = glob_set_end(pattern, i);
+                if (end == std::string_view::npos)
+                {
+                    add_literal(c);
+                    break;
+                }
+
+                ByteSet set;
+                size_t j = i + 1;
+                bool negate = pattern[j] == '!' || pattern[j] == '^';
+                if (negate)
+                    ++j;
+                for (bool first = true; j < end; ++j, first = false)
+                {
+                    unsigned char lo = pattern[j];
+                    if (lo == '\\')
+                        lo = pattern[++j];
+                    else if (lo == ']' && !first)
+                        break;
+                    unsigned char hi = lo;
+                    if (j + 2 < end && pattern[j + 1] == '-')
+                    {
+                        j += 2;
+                        hi = pattern[j];
+                        if (hi == '\\')
+                            hi = pattern[++j];
+                    }
+                    for (unsigned b = lo; b <= hi; ++b)
+                        set.add(b);
+                }
+                if (negate)
+                {
+                    ByteSet inverted;
+                    for (unsigned b = 0; b < 256; ++b)
+                        if (!set.contains(b))
+                            inverted.add(b);
+                    set = inverted;
+                }
+
+                res.tokens.push_back(Token{Op::CHAR_SET, std::string(), (unsigned)sets.size()});
+                sets.push_back(set);
+                i = end;
+                break;
+            }
+            default:
+                add_literal(c);
+                break;
+        }
+    }
+
+    for (const auto& tok: res.tokens)
+    {
+        switch (tok.op)
+        {
+            case Op::LITERAL: res.min_size += tok.literal.size(); break;
+            case Op::ANY_STRING: res.variable_size = true; break;
+            default: ++res.min_size; break;
+        }
+    }
+    if (!res.tokens.empty() && res.tokens[0].op == Op::LITERAL)
+        res.prefix = res.tokens[0].literal;
+
+    patterns.emplace_back(std::move(res));
+}
+
+bool Glob::match(const Pattern& pattern, std::string_view str) const
+{
+    // Fast rejection
+    if (str.size() < pattern.min_size)
+        return false;
+    if (!pattern.variable_size && str.size() != pattern.min_size)
+        return false;
+    if (!startswith(str, pattern.prefix))
+        return false;
+
+    const auto& tokens = pattern.tokens;
+    size_t ti = 0;
+    size_t si = 0;
+    // Position of the last '*' seen, and of the string position it is
+    // currently matched up to, for backtracking
+    size_t star_ti = std::string_view::npos;
+    size_t star_si = 0;
+
+    while (true)
+    {
+        if (ti < tokens.size())
+        {
+            const Token& tok = tokens[ti];
+            switch (tok.op)
+            {
+                case Op::ANY_STRING:
+                    // Stars at the end match everything that is left
+                    if (ti + 1 == tokens.size())
+                        return true;
+                    star_ti = ti++;
+                    star_si = si;
+                    continue;
+                case Op::LITERAL:
+                    if (str.compare(si, tok.literal.size(), tok.literal) == 0)
+                    {
+                        si += tok.literal.size();
+                        ++ti;
+                        continue;
+                    }
+                    break;
+                case Op::ANY_CHAR:
+                    if (si < str.size())
+                    {
+                        ++si;
+                        ++ti;
+                        continue;
+                    }
+                    break;
+                case Op::CHAR_SET:
+                    if (si < str.size() && sets[tok.set].contains(str[si]))
+                    {
+                        ++si;
+                        ++ti;
+                        continue;
+                    }
+                    break;
+            }
+        } else if (si == str.size())
+            return true;
+
+        // Mismatch: let the last star match one more character, and retry
+        if (star_ti == std::string_view::npos || star_si >= str.size())
+            return false;
+        ++star_si;
+        const Token& next = tokens[star_ti + 1];
+        if (next.op == Op::LITERAL)
+        {
+            // Skip directly to the next occurrence of the literal
+            star_si = str.find(next.literal, star_si);
+            if (star_si == std::string_view::npos)
+                return false;
+        }
+        si = star_si;
+        ti = star_ti + 1;
+    }
+}
+
+bool Glob::match(std::string_view str) const
+{
+    for (const auto& pattern: patterns)
+        if (match(pattern, str))
+            return true;
+    return false;
+}
+
+
+/*
+ * Split
+ */
+
+void split_into(std::vector<std::string_view>& out, Arena& arena, std::string_view str, std::string_view sep, bool skip_empty)
+{
+    std::string_view copy = arena.store(str);
+    for (std::string_view tok: SplitView(copy, sep, skip_empty))
+        out.push_back(tok);
+}
+
+Split::const_iterator::const_iterator(const Split& split)
+    : pos(SplitView(split.str, split.sep, split.skip_empty))
+{
+    if (!pos.is_end())
+        cur.assign(pos->data(), pos->size());
+}
+
+Split::const_iterator::~const_iterator()
+{
+}
+
+std::string Split::const_iterator::remainder() const
+{
+    std::string_view res = pos.remainder();
+    return std::string(res.data(), res.size());
+}
+
+Split::const_iterator& Split::const_iterator::operator++()
+{
+    ++pos;
+    if (!pos.is_end())
+        cur.assign(pos->data(), pos->size());
+    return *this;
+}
+
+const std::string& Split::const_iterator::operator*() const { return cur; }
+const std::string* Split::const_iterator::operator->() const { return &cur; }
+
+bool Split::const_iterator::operator==(const const_iterator& ti) const
+{
+    return pos == ti.pos;
+}
+
+bool Split::const_iterator::operator!=(const const_iterator& ti) const
+{
+    return pos != ti.pos;
+}
+
+
+namespace {
+
+constexpr char hex_digits_lower[] = "0123456789abcdef";
+
+/// Characters that do not need escaping in urls
+struct UrlSafe
+{
+    bool safe[256] = {};
+
+    constexpr UrlSafe()
+    {
+        for (unsigned c = '0'; c <= '9'; ++c) safe[c] = true;
+        for (unsigned c = 'A'; c <= 'Z'; ++c) safe[c] = true;
+        for (unsigned c = 'a'; c <= 'z'; ++c) safe[c] = true;
+        for (unsigned char c: "-_!*'()")
+            safe[c] = true;
+        // The loop above also marked the string terminator
+        safe[0] = false;
+    }
+
+    bool operator[](char c) const { return safe[static_cast<unsigned char>(c)]; }
+};
+
+constexpr UrlSafe url_safe;
+
+/// Value of each hexadecimal digit, or 0xff for non-hex characters
+struct HexValues
+{
+    uint8_t values[256] = {};
+
+    constexpr HexValues()
+    {
+        for (unsigned i = 0; i < 256; ++i) values[i] = 0xff;
+        for (unsigned c = '0'; c <= '9'; ++c) values[c] = c - '0';
+        for (unsigned c = 'a'; c <= 'f'; ++c) values[c] = c - 'a' + 10;
+        for (unsigned c = 'A'; c <= 'F'; ++c) values[c] = c - 'A' + 10;
+    }
+
+    uint8_t operator[](char c) const { return values[static_cast<unsigned char>(c)]; }
+};
+
+constexpr HexValues hex_values;
+
+}
+
+namespace {
+
+/// Characters that need escaping in C strings
+struct CStringSpecial
+{
+    static bool scalar(char c)
+    {
+        unsigned char u = c;
+        return u < 0x20 || u == 0x7f || u == '"' || u == '\\';
+    }
+
+#ifdef WOBBLE_STR_X86_SIMD
+    __attribute__((target("sse2")))
+    static __m128i sse2(__m128i x)
+    {
+        __m128i res = in_range_sse2(x, 0, 0x1f);
+        res = _mm_or_si128(res, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f)));
+        res = _mm_or_si128(res, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+        return _mm_or_si128(res, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i avx2(__m256i x)
+    {
+        __m256i res = in_range_avx2(x, 0, 0x1f);
+        res = _mm256_or_si256(res, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(0x7f)));
+        res = _mm256_or_si256(res, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+        return _mm256_or_si256(res, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+    }
+#endif
+};
+
+/// Characters that end a run of literal characters when decoding C strings
+struct CStringDecodeSpecial
+{
+    static bool scalar(char c) { return c == '"' || c == '\\'; }
+
+#ifdef WOBBLE_STR_X86_SIMD
+    __attribute__((target("sse2")))
+    static __m128i sse2(__m128i x)
+    {
+        return _mm_or_si128(
+                _mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+                _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i avx2(__m256i x)
+    {
+        return _mm256_or_si256(
+                _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+                _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+    }
+#endif
+};
+
+#ifdef WOBBLE_STR_X86_SIMD
+/**
+ * Return the offset of the first 16 byte block in buf with a character
+ * matched by Matcher, or the offset where the complete blocks end
+ */
+template<typename Matcher> __attribute__((target("sse2")))
+size_t find_first_sse2(const char* buf, size_t size)
+{
+    size_t i = 0;
+    for ( ; i + 16 <= size; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        if (unsigned mask = _mm_movemask_epi8(Matcher::sse2(x)))
+            return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+/// AVX2 version of find_first_sse2
+template<typename Matcher> __attribute__((target("avx2")))
+size_t find_first_avx2(const char* buf, size_t size)
+{
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+        if (uint32_t mask = _mm256_movemask_epi8(Matcher::avx2(x)))
+            return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+#endif
+
+/// Return the offset of the first character in buf matched by Matcher, or size
+template<typename Matcher>
+size_t find_first(const char* buf, size_t size)
+{
+    size_t i = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        i = find_first_avx2<Matcher>(buf, size);
+    if (i < size)
+        i += find_first_sse2<Matcher>(buf + i, size - i);
+#endif
+    for ( ; i < size; ++i)
+        if (Matcher::scalar(buf[i]))
+            return i;
+    return size;
+}
+
+/**
+ * Decode a C string, appending it to out.
+ *
+ * Return the number of characters parsed. If strict is true and an invalid
+ * escape sequence is found, stop and set error to its offset.
+ */
+size_t decode_cstring(std::string& out, std::string_view str, bool strict, bool& error)
+{
+    error = false;
+    size_t pos = 0;
+    while (true)
+    {
+        // Copy a run of characters that need no decoding
+        size_t next = pos + find_first<CStringDecodeSpecial>(str.data() + pos, str.size() - pos);
+        out.append(str.data() + pos, next - pos);
+        if (next == str.size())
+            return next;
+        if (str[next] == '"')
+            return next + 1;
+
+        // Backslash escape
+        if (next + 1 == str.size())
+        {
+            if (strict)
+            {
+                error = true;
+                return next;
+            }
+            out += '\\';
+            return str.size();
+        }
+
+        pos = next + 2;
+        char c = str[next + 1];
+        switch (c)
+        {
+            case 'a': out += '\a'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'v': out += '\v'; break;
+            case '\\':
+            case '"':
+            case '\'':
+            case '?': out += c; break;
+            case 'x': {
+                // Read up to 2 hex digits
+                unsigned value = 0;
+                size_t digits = 0;
+                for ( ; digits < 2 && pos < str.size() && hex_values[str[pos]] != 0xff; ++digits, ++pos)
+                    value = value * 16 + hex_values[str[pos]];
+                if (strict && digits == 0)
+                {
+                    error = true;
+                    return next;
+                }
+                out += static_cast<char>(value);
+                break;
+            }
+            default:
+                if (strict)
+                {
+                    error = true;
+                    return next;
+                }
+                out += c;
+                break;
+        }
+    }
+}
+
+}
+
+std::string encode_cstring(std::string_view str)
+{
+    string res;
+    encode_cstring_append(res, str);
+    return res;
+}
+
+std::string encode_cstring(const std::string& str)
+{
+    return encode_cstring(std::string_view(str));
+}
+
+void encode_cstring_append(std::string& out, std::string_view str)
+{
+    out.reserve(out.size() + str.size());
+
+    size_t pos = 0;
+    while (pos < str.size())
+    {
+        // Copy a run of characters that do not need escaping
+        size_t next = pos + find_first<CStringSpecial>(str.data() + pos, str.size() - pos);
+        out.append(str.data() + pos, next - pos);
+        if (next == str.size())
+            break;
+
+        unsigned char c = str[next];
+        pos = next + 1;
+        switch (c)
+        {
+            case '\n': out.append("\\n", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            case '"':
+            case '\\': {
+                char esc[2] = { '\\', static_cast<char>(c) };
+                out.append(esc, 2);
+                break;
+            }
+            default: {
+                char esc[4] = { '\\', 'x', hex_digits_lower[c >> 4], hex_digits_lower[c & 0xf] };
+                out.append(esc, 4);
+                break;
+            }
+        }
+    }
+}
+
+std::string decode_cstring(std::string_view str, size_t& lenParsed)
+{
+    string res;
+    bool error;
+    lenParsed = decode_cstring(res, str, false, error);
+    return res;
+}
+
+std::string decode_cstring(const std::string& str, size_t& lenParsed)
+{
+    return decode_cstring(std::string_view(str), lenParsed);
+}
+
+bool decode_cstring_append(std::string& out, std::string_view str, size_t& lenParsed)
+{
+    bool error;
+    lenParsed = decode_cstring(out, str, true, error);
+    return !error;
+}
+
+std::string encode_url(const std::string& str)
+{
+    string res;
+    encode_url_append(res, str);
+    return res;
+}
+
+void encode_url_append(std::string& out, std::string_view str)
+{
+    size_t escaped = 0;
+    for (char c: str)
+        escaped += !url_safe[c];
+    out.reserve(out.size() + str.size() + escaped * 2);
+
+    const char* pos = str.data();
+    const char* end = pos + str.size();
+    while (pos != end)
+    {
+        // Copy a run of characters that do not need escaping
+        const char* run = pos;
+        while (pos != end && url_safe[*pos])
+            ++pos;
+        out.append(run, pos - run);
+        if (pos == end)
+            break;
+
+        unsigned char c = *pos++;
+        char esc[3] = { '%', hex_digits_lower[c >> 4], hex_digits_lower[c & 0xf] };
+        out.append(esc, 3);
+    }
+}
+
+std::string decode_url(const std::string& str)
+{
+    string res;
+    decode_url_append(res, str);
+    return res;
+}
+
+void decode_url_append(std::string& out, std::string_view str)
+{
+    out.reserve(out.size() + str.size());
+
+    const char* pos = str.data();
+    const char* end = pos + str.size();
+    while (pos != end)
+    {
+        // Copy everything up to the next escape sequence
+        const char* esc = static_cast<const char*>(memchr(pos, '%', end - pos));
+        if (!esc)
+        {
+            out.append(pos, end - pos);
+            break;
+        }
+        out.append(pos, esc - pos);
+
+        // If there's a partial %something at the end, ignore it
+        if (end - esc < 3)
+            break;
+
+        // Like strtoul, use as many leading hex digits as are available
+        unsigned char value = 0;
+        uint8_t hi = hex_values[esc[1]];
+        if (hi != 0xff)
+        {
+            uint8_t lo = hex_values[esc[2]];
+            value = lo == 0xff ? hi : (hi << 4) | lo;
+        }
+        out += static_cast<char>(value);
+        pos = esc + 3;
+    }
+}
+
+/*
+ * Hexadecimal encoding
+ */
+
+namespace {
+
+constexpr char hex_digits_upper[] = "0123456789ABCDEF";
+
+#ifdef WOBBLE_STR_X86_SIMD
+/// Encode 16 bytes at a time, looking up the digits of each nibble with pshufb
+__attribute__((target("ssse3")))
+size_t encode_hex_ssse3(const uint8_t* src, size_t size, char* dst, const char* digits)
+{
+    const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(digits));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for ( ; i + 16 <= size; i += 16, dst += 32)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(x, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+/// AVX2 version of encode_hex_ssse3, encoding 32 bytes at a time
+__attribute__((target("avx2")))
+size_t encode_hex_avx2(const uint8_t* src, size_t size, char* dst, const char* digits)
+{
+    const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(digits)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32, dst += 64)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        // Unpacking works within 128 bit lanes: arrange the input 64 bit
+        // blocks so that the unpacked output comes out in order
+        x = _mm256_permute4x64_epi64(x, 0xd8);
+        __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(x, mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_unpacklo_epi8(hi, lo));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+/**
+ * Convert hex digits to their values, setting valid to false if some
+ * characters are not hex digits
+ */
+__attribute__((target("ssse3")))
+inline __m128i hex_values_ssse3(__m128i x, bool& valid)
+{
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    __m128i digit = in_range_sse2(x, '0', 9);
+    __m128i alpha = in_range_sse2(lower, 'a', 5);
+    valid = _mm_movemask_epi8(_mm_or_si128(digit, alpha)) == 0xffff;
+    return _mm_or_si128(
+            _mm_and_si128(digit, _mm_sub_epi8(x, _mm_set1_epi8('0'))),
+            _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+/**
+ * Decode 32 hex digits at a time, stopping at the first block with invalid
+ * characters
+ */
+__attribute__((target("ssse3")))
+size_t decode_hex_ssse3(const char* src, size_t size, uint8_t* dst)
+{
+    // Multiply the high nibble by 16 and add the low one
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32, dst += 16)
+    {
+        bool valid0, valid1;
+        __m128i v0 = hex_values_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), valid0);
+        __m128i v1 = hex_values_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16)), valid1);
+        if (!valid0 || !valid1)
+            break;
+        __m128i res = _mm_packus_epi16(_mm_maddubs_epi16(v0, weights), _mm_maddubs_epi16(v1, weights));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), res);
+    }
+    return i;
+}
+
+/// AVX2 version of hex_values_ssse3
+__attribute__((target("avx2")))
+inline __m256i hex_values_avx2(__m256i x, bool& valid)
+{
+    __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    __m256i digit = in_range_avx2(x, '0', 9);
+    __m256i alpha = in_range_avx2(lower, 'a', 5);
+    valid = _mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) == -1;
+    return _mm256_or_si256(
+            _mm256_and_si256(digit, _mm256_sub_epi8(x, _mm256_set1_epi8('0'))),
+            _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+}
+
+/// AVX2 version of decode_hex_ssse3, decoding 64 hex digits at a time
+__attribute__((target("avx2")))
+size_t decode_hex_avx2(const char* src, size_t size, uint8_t* dst)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+    for ( ; i + 64 <= size; i += 64, dst += 32)
+    {
+        bool valid0, valid1;
+        __m256i v0 = hex_values_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), valid0);
+        __m256i v1 = hex_values_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32)), valid1);
+        if (!valid0 || !valid1)
+            break;
+        // Packing works within 128 bit lanes: reorder the 64 bit blocks
+        // of the result
+        __m256i res = _mm256_packus_epi16(_mm256_maddubs_epi16(v0, weights), _mm256_maddubs_epi16(v1, weights));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute4x64_epi64(res, 0xd8));
+    }
+    return i;
+}
+#endif
+
+/// Encode src to dst, which needs to have room for size * 2 characters
+void encode_hex(const uint8_t* src, size_t size, char* dst, HexCase hex_case)
+{
+    const char* digits = hex_case == HexCase::UPPER ? hex_digits_upper : hex_digits_lower;
+    size_t i = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        i = encode_hex_avx2(src, size, dst, digits);
+    if (cpu_has_ssse3())
+        i += encode_hex_ssse3(src + i, size - i, dst + i * 2, digits);
+#endif
+    for ( ; i < size; ++i)
+    {
+        dst[i * 2] = digits[src[i] >> 4];
+        dst[i * 2 + 1] = digits[src[i] & 0xf];
+    }
+}
+
+/**
+ * Decode size hex digits from src into dst, which needs to have room for
+ * size / 2 bytes.
+ *
+ * size must be even.
+ */
+void decode_hex(const char* src, size_t size, uint8_t* dst)
+{
+    size_t i = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        i = decode_hex_avx2(src, size, dst);
+    if (cpu_has_ssse3())
+        i += decode_hex_ssse3(src + i, size - i, dst + i / 2);
+#endif
+    for ( ; i < size; i += 2)
+    {
+        uint8_t hi = hex_values[src[i]];
+        uint8_t lo = hex_values[src[i + 1]];
+        if (hi == 0xff || lo == 0xff)
+        {
+            size_t pos = hi == 0xff ? i : i + 1;
+            throw std::invalid_argument("invalid hexadecimal digit at offset " + std::to_string(pos));
+        }
+        dst[i / 2] = (hi << 4) | lo;
+    }
+}
+
+}
+
+std::string encode_hex(std::string_view str, HexCase hex_case)
+{
+    return encode_hex(str.data(), str.size(), hex_case);
+}
+
+std::string encode_hex(const void* data, size_t size, HexCase hex_case)
+{
+    std::string res(size * 2, 0);
+    encode_hex(static_cast<const uint8_t*>(data), size, &res[0], hex_case);
+    return res;
+}
+
+void encode_hex_append(std::string& out, std::string_view str, HexCase hex_case)
+{
+    encode_hex_append(out, str.data(), str.size(), hex_case);
+}
+
+void encode_hex_append(std::string& out, const void* data, size_t size, HexCase hex_case)
+{
+    size_t pos = out.size();
+    out.resize(pos + size * 2);
+    encode_hex(static_cast<const uint8_t*>(data), size, &out[pos], hex_case);
+}
+
+std::string decode_hex(std::string_view str)
+{
+    std::string res;
+    decode_hex_append(res, str);
+    return res;
+}
+
+void decode_hex_append(std::string& out, std::string_view str)
+{
+    if (str.size() % 2)
+        throw std::invalid_argument("hexadecimal string has an odd number of digits");
+    size_t pos = out.size();
+    out.resize(pos + str.size() / 2);
+    try {
+        decode_hex(str.data(), str.size(), reinterpret_cast<uint8_t*>(&out[pos]));
+    } catch (...) {
+        out.resize(pos);
+        throw;
+    }
+}
+
+/*
+ * UTF-8
+ */
+
+namespace {
+
+/**
+ * Validate UTF-8 one sequence at a time, starting at pos, which needs to be
+ * at the start of a sequence.
+ *
+ * Returns the offset of the first invalid sequence, or npos.
+ */
+size_t find_invalid_utf8_scalar(const uint8_t* s, size_t size, size_t pos)
+{
+    while (pos < size)
+    {
+        // Skip ASCII 8 bytes at a time
+        if (size - pos >= 8)
+        {
+            uint64_t chunk;
+            memcpy(&chunk, s + pos, 8);
+            if (!(chunk & 0x8080808080808080ull))
+            {
+                pos += 8;
+                continue;
+            }
+        }
+
+        uint8_t c = s[pos];
+        if (c < 0x80)
         {
-            enc = (str[i] << 16);
-            if (i + 1 < size)
-                enc |= str[i + 1] << 8;
-            if (i + 2 < size)
-                enc |= str[i + 2];
+            ++pos;
+            continue;
         }
 
-        // Divide in 4 6-bit values and use them as indexes in the base64 char
-        // array
-        for (int j = 18; j >= 0; j -= 6)
-            res += base64[(enc >> j) & 63];
+        // Sequence length, and valid range of its second byte, which
+        // excludes overlong encodings, surrogates and values past U+10FFFF
+        size_t len;
+        uint8_t lo = 0x80, hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf)
+            len = 2;
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            len = 3;
+            if (c == 0xe0)
+                lo = 0xa0;
+            else if (c == 0xed)
+                hi = 0x9f;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            len = 4;
+            if (c == 0xf0)
+                lo = 0x90;
+            else if (c == 0xf4)
+                hi = 0x8f;
+        }
+        else
+            return pos;
+
+        if (size - pos < len || s[pos + 1] < lo || s[pos + 1] > hi)
+            return pos;
+        for (size_t i = 2; i < len; ++i)
+            if ((s[pos + i] & 0xc0) != 0x80)
+                return pos;
+        pos += len;
     }
+    return std::string_view::npos;
+}
 
-    // Replace padding characters with '='
-    if (size % 3)
-        for (size_t i = 0; i < 3 - (size % 3); ++i)
-            res[res.size() - i - 1] = '=';
+#ifdef WOBBLE_STR_X86_SIMD
+/*
+ * Vectorized UTF-8 validation, based on the lookup algorithm by John Keiser
+ * and Daniel Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+ *
+ * Each byte is classified with three 16-entry tables, indexed by the high
+ * nibble of the previous byte, the low nibble of the previous byte and the
+ * high nibble of the byte itself: their AND is nonzero for invalid 2-byte
+ * combinations. Missing or extra continuation bytes for 3 and 4 byte
+ * sequences are detected by looking 2 and 3 bytes back.
+ *
+ * The kernels only locate the first 64 byte block containing an error: the
+ * exact position is then found by find_invalid_utf8_scalar.
+ */
 
-    return res;
+constexpr uint8_t utf8_too_short = 1 << 0;
+constexpr uint8_t utf8_too_long = 1 << 1;
+constexpr uint8_t utf8_overlong_3 = 1 << 2;
+constexpr uint8_t utf8_too_large = 1 << 3;
+constexpr uint8_t utf8_surrogate = 1 << 4;
+constexpr uint8_t utf8_overlong_2 = 1 << 5;
+constexpr uint8_t utf8_too_large_1000 = 1 << 6;
+constexpr uint8_t utf8_overlong_4 = 1 << 6;
+constexpr uint8_t utf8_two_conts = 1 << 7;
+constexpr uint8_t utf8_carry = utf8_too_short | utf8_too_long | utf8_two_conts;
+
+/// Error flags by the high nibble of the first byte
+alignas(16) constexpr uint8_t utf8_byte_1_high[16] = {
+    // 0_______: ASCII
+    utf8_too_long, utf8_too_long, utf8_too_long, utf8_too_long,
+    utf8_too_long, utf8_too_long, utf8_too_long, utf8_too_long,
+    // 10______: continuation
+    utf8_two_conts, utf8_two_conts, utf8_two_conts, utf8_two_conts,
+    // 1100____: 2 byte lead, overlong unless followed by more bits
+    utf8_too_short | utf8_overlong_2,
+    // 1101____: 2 byte lead
+    utf8_too_short,
+    // 1110____: 3 byte lead
+    utf8_too_short | utf8_overlong_3 | utf8_surrogate,
+    // 1111____: 4 byte lead
+    utf8_too_short | utf8_too_large | utf8_too_large_1000 | utf8_overlong_4,
+};
+
+/// Error flags by the low nibble of the first byte
+alignas(16) constexpr uint8_t utf8_byte_1_low[16] = {
+    // ____0000
+    utf8_carry | utf8_overlong_3 | utf8_overlong_2 | utf8_overlong_4,
+    // ____0001
+    utf8_carry | utf8_overlong_2,
+    // ____001_
+    utf8_carry,
+    utf8_carry,
+    // ____0100
+    utf8_carry | utf8_too_large,
+    // ____0101
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    // ____011_
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    // ____1___
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    // ____1101
+    utf8_carry | utf8_too_large | utf8_too_large_1000 | utf8_surrogate,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+};
+
+/// Error flags by the high nibble of the second byte
+alignas(16) constexpr uint8_t utf8_byte_2_high[16] = {
+    // 0_______: ASCII
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+    // 1000____
+    utf8_too_long | utf8_overlong_2 | utf8_two_conts | utf8_overlong_3 | utf8_too_large_1000 | utf8_overlong_4,
+    // 1001____
+    utf8_too_long | utf8_overlong_2 | utf8_two_conts | utf8_overlong_3 | utf8_too_large,
+    // 101_____
+    utf8_too_long | utf8_overlong_2 | utf8_two_conts | utf8_surrogate | utf8_too_large,
+    utf8_too_long | utf8_overlong_2 | utf8_two_conts | utf8_surrogate | utf8_too_large,
+    // 11______: lead byte
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+};
+
+/**
+ * Saturating subtraction that leaves nonzero only the last bytes of a block
+ * that start a sequence not finished within the block
+ */
+alignas(32) constexpr uint8_t utf8_incomplete[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf,
+};
+
+/// Lookup algorithm on 16 bytes, given the 16 bytes that precede them
+__attribute__((target("ssse3")))
+inline __m128i utf8_errors_ssse3(__m128i input, __m128i prev_input)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    __m128i b1h = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(utf8_byte_1_high)),
+            _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i b1l = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(utf8_byte_1_low)),
+            _mm_and_si128(prev1, nibble));
+    __m128i b2h = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(utf8_byte_2_high)),
+            _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+    // Bytes that must be the 3rd or 4th of a sequence
+    const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+    __m128i must23 = _mm_or_si128(
+            _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xe0 - 0x80))),
+            _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xf0 - 0x80))));
+    __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8(static_cast<char>(0x80)));
+    return _mm_xor_si128(must23_80, special);
 }
 
-std::string decode_base64(const std::string& str)
+/// Return the start of the first 64 byte block with errors, or of the tail
+__attribute__((target("ssse3")))
+size_t utf8_valid_prefix_ssse3(const uint8_t* s, size_t size)
 {
-    std::string res;
+    const __m128i incomplete = _mm_load_si128(reinterpret_cast<const __m128i*>(utf8_incomplete + 16));
+    __m128i prev_input = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+    size_t i = 0;
+    for ( ; i + 64 <= size; i += 64)
+    {
+        __m128i error = _mm_setzero_si128();
+        for (unsigned j = 0; j < 64; j += 16)
+        {
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + j));
+            if (_mm_movemask_epi8(input) == 0)
+            {
+                // ASCII is only wrong if it interrupts a sequence
+                error = _mm_or_si128(error, prev_incomplete);
+                prev_incomplete = _mm_setzero_si128();
+            } else {
+                error = _mm_or_si128(error, utf8_errors_ssse3(input, prev_input));
+                prev_incomplete = _mm_subs_epu8(input, incomplete);
+            }
+            prev_input = input;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff)
+            break;
+    }
+    return i;
+}
+
+/// Load a 16 byte lookup table in both lanes
+__attribute__((target("avx2")))
+inline __m256i utf8_table_avx2(const uint8_t* table)
+{
+    return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+/// Lookup algorithm on 32 bytes, given the 32 bytes that precede them
+__attribute__((target("avx2")))
+inline __m256i utf8_errors_avx2(__m256i input, __m256i prev_input)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    // The 32 bytes ending just before the last 16 bytes of input, to shift
+    // bytes across the two lanes
+    const __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    const __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i b1h = _mm256_shuffle_epi8(utf8_table_avx2(utf8_byte_1_high), _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i b1l = _mm256_shuffle_epi8(utf8_table_avx2(utf8_byte_1_low), _mm256_and_si256(prev1, nibble));
+    __m256i b2h = _mm256_shuffle_epi8(utf8_table_avx2(utf8_byte_2_high), _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+    const __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    const __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+    __m256i must23 = _mm256_or_si256(
+            _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xe0 - 0x80))),
+            _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xf0 - 0x80))));
+    __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must23_80, special);
+}
 
-    for (size_t i = 0; i < str.size(); i += 4)
+/// Return the start of the first 64 byte block with errors, or of the tail
+__attribute__((target("avx2")))
+size_t utf8_valid_prefix_avx2(const uint8_t* s, size_t size)
+{
+    const __m256i incomplete = _mm256_load_si256(reinterpret_cast<const __m256i*>(utf8_incomplete));
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    for ( ; i + 64 <= size; i += 64)
     {
-        // Pack every quadruplet into 24 bits
-        unsigned int enc;
-        if (i+4 < str.size())
+        __m256i error = _mm256_setzero_si256();
+        for (unsigned j = 0; j < 64; j += 32)
         {
-            enc = (invbase64(str[i]) << 18)
-                + (invbase64(str[i+1]) << 12)
-                + (invbase64(str[i+2]) << 6)
-                + (invbase64(str[i+3]));
-        } else {
-            enc = (invbase64(str[i]) << 18);
-            if (i+1 < str.size())
-                enc += (invbase64(str[i+1]) << 12);
-            if (i+2 < str.size())
-                enc += (invbase64(str[i+2]) << 6);
-            if (i+3 < str.size())
-                enc += (invbase64(str[i+3]));
+            __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + j));
+            if (_mm256_movemask_epi8(input) == 0)
+            {
+                error = _mm256_or_si256(error, prev_incomplete);
+                prev_incomplete = _mm256_setzero_si256();
+            } else {
+                error = _mm256_or_si256(error, utf8_errors_avx2(input, prev_input));
+                prev_incomplete = _mm256_subs_epu8(input, incomplete);
+            }
+            prev_input = input;
         }
+        if (!_mm256_testz_si256(error, error))
+            break;
+    }
+    return i;
+}
 
-        // Divide in 3 8-bit values and append them to the result
-        res += enc >> 16 & 0xff;
-        res += enc >> 8 & 0xff;
-        res += enc & 0xff;
+/// Count the bytes that are not UTF-8 continuation bytes
+__attribute__((target("sse2")))
+size_t count_codepoints_sse2(const uint8_t* s, size_t size, size_t& pos)
+{
+    // Continuation bytes are the signed values from -128 to -65
+    const __m128i threshold = _mm_set1_epi8(-65);
+    size_t res = 0;
+    pos = 0;
+    while (pos + 16 <= size)
+    {
+        // Count in 8 bit lanes, for at most 255 iterations before they
+        // overflow, then add them up
+        __m128i counts = _mm_setzero_si128();
+        size_t end = pos + std::min(size - pos, (size_t)255 * 16) / 16 * 16;
+        for ( ; pos < end; pos += 16)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+            counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(x, threshold));
+        }
+        __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+        res += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
     }
+    return res;
+}
 
-    // Remove trailing padding
-    if (str.size() > 0)
-        for (size_t i = str.size() - 1; str[i] == '='; --i)
+__attribute__((target("avx2")))
+size_t count_codepoints_avx2(const uint8_t* s, size_t size, size_t& pos)
+{
+    const __m256i threshold = _mm256_set1_epi8(-65);
+    size_t res = 0;
+    pos = 0;
+    while (pos + 32 <= size)
+    {
+        __m256i counts = _mm256_setzero_si256();
+        size_t end = pos + std::min(size - pos, (size_t)255 * 32) / 32 * 32;
+        for ( ; pos < end; pos += 32)
+        {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + pos));
+            counts = _mm256_sub_epi8(counts, _mm256_cmpgt_epi8(x, threshold));
+        }
+        __m256i sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        res += _mm_cvtsi128_si32(halves) + _mm_extract_epi16(halves, 4);
+    }
+    return res;
+}
+#endif
+
+}
+
+size_t find_invalid_utf8(std::string_view str)
+{
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(str.data());
+    size_t size = str.size();
+    size_t pos = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        pos = utf8_valid_prefix_avx2(s, size);
+    else if (cpu_has_ssse3())
+        pos = utf8_valid_prefix_ssse3(s, size);
+
+    // Everything before pos is valid, except possibly for a sequence
+    // interrupted at pos: back up to its start
+    size_t start = pos;
+    while (start > 0 && pos - start < 3 && (s[start - 1] & 0xc0) == 0x80)
+        --start;
+    if (start > 0 && s[start - 1] >= 0xc0)
+        --start;
+    pos = start;
+#endif
+    return find_invalid_utf8_scalar(s, size, pos);
+}
+
+bool validate_utf8(std::string_view str)
+{
+    return find_invalid_utf8(str) == std::string_view::npos;
+}
+
+size_t count_codepoints(std::string_view str)
+{
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(str.data());
+    size_t size = str.size();
+    size_t pos = 0;
+    size_t res = 0;
+#ifdef WOBBLE_STR_X86_SIMD
+    if (cpu_has_avx2())
+        res = count_codepoints_avx2(s, size, pos);
+    else
+        res = count_codepoints_sse2(s, size, pos);
+#endif
+    for ( ; pos < size; ++pos)
+        res += (s[pos] & 0xc0) != 0x80;
+    return res;
+}
+
+namespace {
+
+constexpr char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// Map every byte to its base64 value. Invalid characters decode as 0.
+struct InvBase64
+{
+    uint8_t values[256] = {};
+
+    constexpr InvBase64()
+    {
+        for (unsigned i = 0; i < 64; ++i)
+            values[static_cast<uint8_t>(base64_chars[i])] = i;
+    }
+
+    uint8_t operator[](uint8_t c) const { return values[c]; }
+};
+
+constexpr InvBase64 invbase64;
+
+/**
+ * Base64 encoding kernel.
+ *
+ * It encodes as many whole triplets from src as it can efficiently handle,
+ * writing them to dst, and returns the number of input bytes consumed. The
+ * rest is left to the scalar code.
+ */
+typedef size_t (*base64_encode_kernel)(const uint8_t* src, size_t size, char* dst);
+
+/**
+ * Base64 decoding kernel.
+ *
+ * It decodes as many whole quadruplets from src as it can efficiently handle,
+ * writing them to dst, and returns the number of input characters consumed.
+ * It stops early when it finds characters that need the scalar code to deal
+ * with, like padding or invalid characters.
+ */
+typedef size_t (*base64_decode_kernel)(const uint8_t* src, size_t size, uint8_t* dst);
+
+size_t encode_base64_none(const uint8_t*, size_t, char*) { return 0; }
+size_t decode_base64_none(const uint8_t*, size_t, uint8_t*) { return 0; }
+
+/// Encode all of src, adding padding at the end
+void encode_base64_scalar(const uint8_t* src, size_t size, char* dst)
+{
+    // Pack every triplet into 24 bits, divide them in 4 6-bit values and use
+    // them as indexes in the base64 char array
+    size_t i = 0;
+    for ( ; i + 3 <= size; i += 3, dst += 4)
+    {
+        unsigned enc = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        dst[0] = base64_chars[(enc >> 18) & 63];
+        dst[1] = base64_chars[(enc >> 12) & 63];
+        dst[2] = base64_chars[(enc >> 6) & 63];
+        dst[3] = base64_chars[enc & 63];
+    }
+
+    switch (size - i)
+    {
+        case 1: {
+            unsigned enc = src[i] << 16;
+            dst[0] = base64_chars[(enc >> 18) & 63];
+            dst[1] = base64_chars[(enc >> 12) & 63];
+            dst[2] = '=';
+            dst[3] = '=';
+            break;
+        }
+        case 2: {
+            unsigned enc = (src[i] << 16) | (src[i + 1] << 8);
+            dst[0] = base64_chars[(enc >> 18) & 63];
+            dst[1] = base64_chars[(enc >> 12) & 63];
+            dst[2] = base64_chars[(enc >> 6) & 63];
+            dst[3] = '=';
+            break;
+        }
+    }
+}
+
+/**
+ * Decode all of src, treating missing characters in the last quadruplet as
+ * zeroes. Padding is not removed.
+ */
+void decode_base64_scalar(const uint8_t* src, size_t size, uint8_t* dst)
+{
+    // Pack every quadruplet into 24 bits, and split them in 3 8-bit values
+    size_t i = 0;
+    for ( ; i + 4 <= size; i += 4, dst += 3)
+    {
+        unsigned enc = (invbase64[src[i]] << 18)
+                     | (invbase64[src[i + 1]] << 12)
+                     | (invbase64[src[i + 2]] << 6)
+                     | invbase64[src[i + 3]];
+        dst[0] = enc >> 16;
+        dst[1] = enc >> 8;
+        dst[2] = enc;
+    }
+
+    if (i == size)
+        return;
+
+    unsigned enc = invbase64[src[i]] << 18;
+    if (i + 1 < size)
+        enc |= invbase64[src[i + 1]] << 12;
+    if (i + 2 < size)
+        enc |= invbase64[src[i + 2]] << 6;
+    dst[0] = enc >> 16;
+    dst[1] = enc >> 8;
+    dst[2] = enc;
+}
+
+#ifdef WOBBLE_STR_X86_SIMD
+/*
+ * Vectorized base64, based on the algorithms described by Wojciech Muła and
+ * Daniel Lemire in "Faster Base64 Encoding and Decoding using AVX2
+ * Instructions" (2018).
+ */
+
+__attribute__((target("sse4.1")))
+size_t encode_base64_sse41(const uint8_t* src, size_t size, char* dst)
+{
+    // Spread 12 input bytes in 4 32-bit lanes of 3 bytes each
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    // Offsets to add to a 6-bit value to get its base64 character, indexed
+    // by its range
+    const __m128i shift_lut = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+    // Each iteration reads 16 bytes but only consumes 12 of them
+    size_t i = 0;
+    for ( ; i + 16 <= size; i += 12, dst += 16)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        in = _mm_shuffle_epi8(in, spread);
+
+        // Split each triplet into 4 bytes of 6 bits each
+        __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(t1, t3);
+
+        // Map 0..51 to 0, 52..61 to 1..10, 62 to 11, 63 to 12, then 0..25 to
+        // 13, and look up the offset to add
+        __m128i range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+        __m128i res = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, range), idx);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), res);
+    }
+    return i;
+}
+
+__attribute__((target("sse4.1")))
+size_t decode_base64_sse41(const uint8_t* src, size_t size, uint8_t* dst)
+{
+    // Gather the 3 bytes of each 32-bit lane at the beginning of the vector
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // Each iteration writes 16 bytes but only produces 12 of them: stop early
+    // enough to have room for the extra 4
+    size_t i = 0;
+    for ( ; i + 24 <= size; i += 16, dst += 12)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        // Classify characters by range. Bytes >= 0x80 are negative in signed
+        // comparisons, and fail all checks
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+        __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+        __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+
+        // Leave invalid characters and padding to the scalar code
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            break;
+
+        __m128i shift = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                    _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+                _mm_or_si128(
+                    _mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                    _mm_or_si128(
+                        _mm_and_si128(plus, _mm_set1_epi8(62 - '+')),
+                        _mm_and_si128(slash, _mm_set1_epi8(63 - '/')))));
+        __m128i values = _mm_add_epi8(in, shift);
+
+        // Merge each pair of 6-bit values into 12 bits, then each pair of
+        // 12-bit values into 24 bits
+        __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(merged, pack));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t encode_base64_avx2(const uint8_t* src, size_t size, char* dst)
+{
+    const __m256i spread = _mm256_setr_epi8(
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift_lut = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+    // Each iteration reads 28 bytes but only consumes 24 of them
+    size_t i = 0;
+    for ( ; i + 28 <= size; i += 24, dst += 32)
+    {
+        // Load 12 bytes in each 128-bit lane
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, spread);
+
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+
+        __m256i range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+        range = _mm256_or_si256(range, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        __m256i res = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, range), idx);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), res);
+    }
+    return i + encode_base64_sse41(src + i, size - i, dst);
+}
+
+__attribute__((target("avx2")))
+size_t decode_base64_avx2(const uint8_t* src, size_t size, uint8_t* dst)
+{
+    const __m256i pack = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // Each iteration writes 32 bytes but only produces 24 of them: stop early
+    // enough to have room for the extra 8
+    size_t i = 0;
+    for ( ; i + 48 <= size; i += 32, dst += 24)
+    {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+        __m256i plus = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+        __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+        if (_mm256_movemask_epi8(valid) != -1)
+            break;
+
+        __m256i shift = _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                    _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+                _mm256_or_si256(
+                    _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                    _mm256_or_si256(
+                        _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')),
+                        _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')))));
+        __m256i values = _mm256_add_epi8(in, shift);
+
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack);
+        // Join the 12 bytes of each lane
+        merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), merged);
+    }
+    return i + decode_base64_sse41(src + i, size - i, dst);
+}
+#endif
+
+/// Kernels currently in use for base64 encoding and decoding
+struct Base64Kernels
+{
+    base64_encode_kernel encode = encode_base64_none;
+    base64_decode_kernel decode = decode_base64_none;
+
+    Base64Kernels() { set(Base64Impl::AUTO); }
+
+    void set(Base64Impl impl)
+    {
+        if (!base64_impl_supported(impl))
+            throw std::runtime_error("base64 implementation not supported on this CPU");
+
+        switch (impl)
         {
-            if (res.size() > 0)
-                res.resize(res.size() - 1);
-            if (i == 0 || res.size() == 0 )
+            case Base64Impl::AUTO:
+                if (base64_impl_supported(Base64Impl::AVX2))
+                    set(Base64Impl::AVX2);
+                else if (base64_impl_supported(Base64Impl::SSE41))
+                    set(Base64Impl::SSE41);
+                else
+                    set(Base64Impl::SCALAR);
                 break;
+            case Base64Impl::SCALAR:
+                encode = encode_base64_none;
+                decode = decode_base64_none;
+                break;
+#ifdef WOBBLE_STR_X86_SIMD
+            case Base64Impl::SSE41:
+                encode = encode_base64_sse41;
+                decode = decode_base64_sse41;
+                break;
+            case Base64Impl::AVX2:
+                encode = encode_base64_avx2;
+                decode = decode_base64_avx2;
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+};
+
+Base64Kernels& base64_kernels()
+{
+    static Base64Kernels kernels;
+    return kernels;
+}
+
+/// Append the encoding of whole triplets to out
+void append_base64_triplets(const uint8_t* src, size_t size, std::string& out)
+{
+    size_t pos = out.size();
+    out.resize(pos + size / 3 * 4);
+    char* dst = &out[pos];
+
+    size_t done = base64_kernels().encode(src, size, dst);
+    encode_base64_scalar(src + done, size - done, dst + done / 3 * 4);
+}
+
+/// Append the decoding of whole quadruplets to out, honoring padding at the end of the last one
+void append_base64_quadruplets(const uint8_t* src, size_t size, std::string& out)
+{
+    if (!size) return;
+
+    size_t pos = out.size();
+    out.resize(pos + size / 4 * 3);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(&out[pos]);
+
+    size_t done = base64_kernels().decode(src, size, dst);
+    decode_base64_scalar(src + done, size - done, dst + done / 4 * 3);
+
+    unsigned pad = 0;
+    while (pad < 3 && src[size - pad - 1] == '=')
+        ++pad;
+    out.resize(out.size() - pad);
+}
+
+bool is_base64_whitespace(uint8_t c)
+{
+    return c == '\n' || c == '\r' || c == ' ' || c == '\t';
+}
+
+}
+
+
+/*
+ * Base64Encoder
+ */
+
+void Base64Encoder::encode(const void* data, size_t size, std::string& out)
+{
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    // Complete the leftover triplet from the previous chunk
+    if (partial_size)
+    {
+        if (partial_size + size < 3)
+        {
+            memcpy(partial + partial_size, src, size);
+            partial_size += size;
+            return;
+        }
+        uint8_t triplet[3];
+        memcpy(triplet, partial, partial_size);
+        memcpy(triplet + partial_size, src, 3 - partial_size);
+        src += 3 - partial_size;
+        size -= 3 - partial_size;
+        partial_size = 0;
+        append_base64_triplets(triplet, 3, out);
+    }
+
+    size_t whole = size - size % 3;
+    append_base64_triplets(src, whole, out);
+
+    partial_size = size - whole;
+    memcpy(partial, src + whole, partial_size);
+}
+
+void Base64Encoder::flush(std::string& out)
+{
+    if (!partial_size) return;
+    size_t pos = out.size();
+    out.resize(pos + 4);
+    encode_base64_scalar(partial, partial_size, &out[pos]);
+    partial_size = 0;
+}
+
+
+/*
+ * Base64Decoder
+ */
+
+void Base64Decoder::decode(const void* data, size_t size, std::string& out)
+{
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    const uint8_t* end = src + size;
+
+    while (src != end)
+    {
+        // Complete the leftover quadruplet, one character at a time
+        if (partial_size)
+        {
+            if (!is_base64_whitespace(*src))
+            {
+                partial[partial_size++] = *src;
+                if (partial_size == 4)
+                {
+                    append_base64_quadruplets(partial, 4, out);
+                    partial_size = 0;
+                }
+            }
+            ++src;
+            continue;
+        }
+
+        // Decode all the whole quadruplets up to the next whitespace
+        const uint8_t* run_end = src;
+        while (run_end != end && !is_base64_whitespace(*run_end))
+            ++run_end;
+        size_t run_size = run_end - src;
+        size_t whole = run_size - run_size % 4;
+
+        // Padding can only be trimmed at the end of a quadruplet: stop the
+        // bulk decoding at the first one with padding, so that the result
+        // does not depend on how the input is split
+        if (const void* eq = memchr(src, '=', whole))
+        {
+            size_t bulk = (static_cast<const uint8_t*>(eq) - src) / 4 * 4;
+            append_base64_quadruplets(src, bulk, out);
+            append_base64_quadruplets(src + bulk, 4, out);
+            src += bulk + 4;
+            continue;
         }
 
+        append_base64_quadruplets(src, whole, out);
+        partial_size = run_size - whole;
+        memcpy(partial, src + whole, partial_size);
+
+        src = run_end;
+        if (src != end)
+            ++src;
+    }
+}
+
+void Base64Decoder::flush(std::string& out)
+{
+    if (!partial_size) return;
+    // Like decode_base64, treat missing characters as zeroes
+    size_t pos = out.size();
+    out.resize(pos + 3);
+    decode_base64_scalar(partial, partial_size, reinterpret_cast<uint8_t*>(&out[pos]));
+    // Remove trailing padding
+    unsigned pad = 0;
+    while (pad < partial_size && partial[partial_size - pad - 1] == '=')
+        ++pad;
+    out.resize(out.size() - std::min(pad, 3u));
+    partial_size = 0;
+}
+
+
+bool base64_impl_supported(Base64Impl impl)
+{
+    switch (impl)
+    {
+        case Base64Impl::AUTO:
+        case Base64Impl::SCALAR:
+            return true;
+#ifdef WOBBLE_STR_X86_SIMD
+        case Base64Impl::SSE41:
+            return __builtin_cpu_supports("sse4.1");
+        case Base64Impl::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+void base64_set_impl(Base64Impl impl)
+{
+    base64_kernels().set(impl);
+}
+
+std::string encode_base64(const std::string& str)
+{
+    return encode_base64(str.data(), str.size());
+}
+
+std::string encode_base64(const void* data, size_t size)
+{
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    std::string res((size + 2) / 3 * 4, 0);
+    char* dst = &res[0];
+
+    size_t done = base64_kernels().encode(src, size, dst);
+    encode_base64_scalar(src + done, size - done, dst + done / 3 * 4);
+
+    return res;
+}
+
+std::string decode_base64(const std::string& str)
+{
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(str.data());
+    size_t size = str.size();
+    std::string res((size + 3) / 4 * 3, 0);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(&res[0]);
+
+    size_t done = base64_kernels().decode(src, size, dst);
+    decode_base64_scalar(src + done, size - done, dst + done / 4 * 3);
+
+    // Remove trailing padding
+    size_t pad = 0;
+    while (pad < size && str[size - pad - 1] == '=')
+        ++pad;
+    res.resize(res.size() - std::min(pad, res.size()));
+
     return res;
 }
 
@@ -9,69 +9,232 @@
  */
 
 #include <string>
+#include <string_view>
 #include <functional>
+#include <memory>
 #include <sstream>
+#include <charconv>
+#include <iterator>
+#include <type_traits>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <vector>
 
 namespace wobble {
 namespace str {
 
 /// Check if a string starts with the given substring
-inline bool startswith(const std::string& str, const std::string& part)
+inline bool startswith(std::string_view str, std::string_view part)
 {
     if (str.size() < part.size())
         return false;
-    return str.substr(0, part.size()) == part;
+    return str.compare(0, part.size(), part) == 0;
 }
 
 /// Check if a string ends with the given substring
-inline bool endswith(const std::string& str, const std::string& part)
+inline bool endswith(std::string_view str, std::string_view part)
 {
     if (str.size() < part.size())
         return false;
-    return str.substr(str.size() - part.size()) == part;
+    return str.compare(str.size() - part.size(), part.size(), part) == 0;
+}
+
+namespace impl {
+
+/// Throw the exception corresponding to a std::from_chars error
+[[noreturn]] void throw_parse_error(std::string_view str, std::errc err);
+
 }
 
 /**
- * Stringify and join a sequence of objects
+ * Parse the whole of str as a number of type T, storing it in result.
+ *
+ * Integers are parsed in the given base, and floating point numbers in fixed
+ * or scientific notation, ignoring base. Parsing does not depend on the
+ * locale, and does not accept leading whitespace or '+' signs.
+ *
+ * Returns std::errc() on success, std::errc::invalid_argument if str is not
+ * entirely a number, and std::errc::result_out_of_range if the value does not
+ * fit in T. On error, result is left unchanged.
+ */
+template<typename T>
+std::errc parse(std::string_view str, T& result, int base=10)
+{
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, "str::parse only supports numbers");
+    const char* end = str.data() + str.size();
+    T value;
+    std::from_chars_result res;
+    if constexpr (std::is_floating_point_v<T>)
+        res = std::from_chars(str.data(), end, value);
+    else
+        res = std::from_chars(str.data(), end, value, base);
+    if (res.ec != std::errc())
+        return res.ec;
+    if (res.ptr != end)
+        return std::errc::invalid_argument;
+    result = value;
+    return std::errc();
+}
+
+/**
+ * Parse the whole of str as a decimal number of type T.
+ *
+ * Throws std::invalid_argument if str is not a number, and std::out_of_range
+ * if it does not fit in T.
+ */
+template<typename T>
+T parse(std::string_view str)
+{
+    T res;
+    std::errc err = parse(str, res);
+    if (err != std::errc())
+        impl::throw_parse_error(str, err);
+    return res;
+}
+
+/**
+ * Append the decimal representation of an integer or floating point number
+ * to out.
+ *
+ * Floating point numbers are formatted with the shortest representation that
+ * parses back to the same value.
+ */
+template<typename T>
+void format_append(std::string& out, T value)
+{
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, "str::format_append only supports numbers");
+    char buf[64];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, res.ptr);
+}
+
+/**
+ * Append value to out in fixed notation, with the given number of digits
+ * after the decimal point
+ */
+void format_fixed_append(std::string& out, double value, int precision);
+
+namespace impl {
+
+/// Check if join can append T as a string without formatting it
+template<typename T>
+constexpr bool join_is_string = std::is_convertible_v<const T&, std::string_view>;
+
+/**
+ * Append the string representation of val to out, which can be a std::string
+ * or a str::Appender.
+ *
+ * Numbers are formatted like format_append, characters are appended as they
+ * are, and other types fall back to their std::ostream operator<<.
+ */
+template<typename OUT, typename T>
+void append_value(OUT& out, const T& val)
+{
+    if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>)
+    {
+        if (val)
+            out.append(val, strlen(val));
+        else
+            out.append("(null)", 6);
+    }
+    else if constexpr (join_is_string<T>)
+    {
+        std::string_view s(val);
+        out.append(s.data(), s.size());
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+        out.append(val ? "1" : "0", 1);
+    else if constexpr (std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>)
+        out.append(reinterpret_cast<const char*>(&val), 1);
+    else if constexpr (std::is_arithmetic_v<T>)
+    {
+        char buf[64];
+        auto res = std::to_chars(buf, buf + sizeof(buf), val);
+        out.append(buf, res.ptr - buf);
+    }
+    else
+    {
+        std::ostringstream res;
+        res << val;
+        std::string s = res.str();
+        out.append(s.data(), s.size());
+    }
+}
+
+}
+
+/**
+ * Stringify and join a sequence of objects, appending the result to out.
+ *
+ * When the items are strings and the iterators can be traversed more than
+ * once, the final size is computed in advance so that out is grown at most
+ * once.
  */
 template<typename ITER>
-std::string join(const std::string& sep, const ITER& begin, const ITER& end)
+void join_into(std::string& out, std::string_view sep, const ITER& begin, const ITER& end)
 {
-    std::stringstream res;
+    typedef std::decay_t<decltype(*begin)> value_type;
+    typedef typename std::iterator_traits<ITER>::iterator_category category;
+    if constexpr (impl::join_is_string<value_type> && std::is_base_of_v<std::forward_iterator_tag, category>)
+    {
+        size_t size = 0;
+        size_t count = 0;
+        for (ITER i = begin; i != end; ++i, ++count)
+            size += std::string_view(*i).size();
+        if (count)
+            size += sep.size() * (count - 1);
+        out.reserve(out.size() + size);
+    }
+
     bool first = true;
     for (ITER i = begin; i != end; ++i)
     {
         if (first)
             first = false;
         else
-            res << sep;
-        res << *i;
+            out.append(sep);
+        impl::append_value(out, *i);
     }
-    return res.str();
+}
+
+/**
+ * Stringify and join an iterable container, appending the result to out
+ */
+template<typename ITEMS>
+void join_into(std::string& out, std::string_view sep, const ITEMS& items)
+{
+    using std::begin;
+    using std::end;
+    join_into(out, sep, begin(items), end(items));
+}
+
+/**
+ * Stringify and join a sequence of objects
+ */
+template<typename ITER>
+std::string join(std::string_view sep, const ITER& begin, const ITER& end)
+{
+    std::string res;
+    join_into(res, sep, begin, end);
+    return res;
 }
 
 /**
  * Stringify and join an iterable container
  */
 template<typename ITEMS>
-std::string join(const std::string& sep, const ITEMS& items)
+std::string join(std::string_view sep, const ITEMS& items)
 {
-    std::stringstream res;
-    bool first = true;
-    for (const auto& i: items)
-    {
-        if (first)
-            first = false;
-        else
-            res << sep;
-        res << i;
-    }
-    return res.str();
+    std::string res;
+    join_into(res, sep, items);
+    return res;
 }
 
 /**
  * Return the substring of 'str' without all leading spaces.
+ *
+ * Spaces are the ASCII whitespace characters, as in CharClass::SPACE.
  */
 std::string lstrip(const std::string& str);
 
@@ -85,25 +248,79 @@ std::string rstrip(const std::string& str);
  */
 std::string strip(const std::string& str);
 
-/// Return an uppercased copy of str
-inline std::string upper(const std::string& str)
-{
-    std::string res;
-    res.reserve(str.size());
-    for (std::string::const_iterator i = str.begin(); i != str.end(); ++i)
-        res += ::toupper(*i);
-    return res;
-}
+/**
+ * Same as lstrip, but return a view inside \a str instead of a copy
+ */
+std::string_view lstrip_view(std::string_view str);
+
+/**
+ * Same as rstrip, but return a view inside \a str instead of a copy
+ */
+std::string_view rstrip_view(std::string_view str);
+
+/**
+ * Same as strip, but return a view inside \a str instead of a copy
+ */
+std::string_view strip_view(std::string_view str);
+
+/**
+ * Return an uppercased copy of str.
+ *
+ * Only ASCII letters are converted, regardless of the current locale.
+ */
+std::string upper(const std::string& str);
+
+/**
+ * Return a lowercased copy of str.
+ *
+ * Only ASCII letters are converted, regardless of the current locale.
+ */
+std::string lower(const std::string& str);
+
+/// Uppercase the ASCII letters in the given buffer
+void upper_inplace(char* buf, size_t size);
+
+/// Uppercase the ASCII letters in the given string
+inline void upper_inplace(std::string& str) { upper_inplace(&str[0], str.size()); }
+
+/// Lowercase the ASCII letters in the given buffer
+void lower_inplace(char* buf, size_t size);
+
+/// Lowercase the ASCII letters in the given string
+inline void lower_inplace(std::string& str) { lower_inplace(&str[0], str.size()); }
 
-/// Return a lowercased copy of str
-inline std::string lower(const std::string& str)
+/**
+ * ASCII character classes, matching those of the C locale.
+ */
+enum class CharClass
 {
-    std::string res;
-    res.reserve(str.size());
-    for (std::string::const_iterator i = str.begin(); i != str.end(); ++i)
-        res += ::tolower(*i);
-    return res;
-}
+    /// Space, \\t, \\n, \\v, \\f, \\r
+    SPACE,
+    /// 0-9
+    DIGIT,
+    /// A-Z, a-z
+    ALPHA,
+    /// 0-9, A-Z, a-z
+    ALNUM,
+    /// 0-9, A-F, a-f
+    XDIGIT,
+    /// A-Z
+    UPPER,
+    /// a-z
+    LOWER,
+};
+
+/**
+ * Return the position of the first character of \a str that is not in
+ * \a cls, or std::string_view::npos if all characters are in \a cls.
+ */
+size_t find_first_not_of(std::string_view str, CharClass cls);
+
+/**
+ * Return the position of the last character of \a str that is not in
+ * \a cls, or std::string_view::npos if all characters are in \a cls.
+ */
+size_t find_last_not_of(std::string_view str, CharClass cls);
 
 /// Given a pathname, return the file name without its path
 std::string basename(const std::string& pathname);
@@ -111,12 +328,28 @@ std::string basename(const std::string& pathname);
 /// Given a pathname, return the directory name without the file name
 std::string dirname(const std::string& pathname);
 
+/**
+ * Same as basename, but return a view inside \a pathname instead of a copy
+ */
+std::string_view basename_view(std::string_view pathname);
+
+/**
+ * Same as dirname, but return a view inside \a pathname instead of a copy.
+ *
+ * When the result is "." or "/", the view may point to a static string
+ * instead.
+ */
+std::string_view dirname_view(std::string_view pathname);
+
 /// Append path2 to path1, adding slashes when appropriate
 void appendpath(std::string& dest, const char* path2);
 
 /// Append path2 to path1, adding slashes when appropriate
 void appendpath(std::string& dest, const std::string& path2);
 
+/// Append path2 to path1, adding slashes when appropriate
+void appendpath(std::string& dest, std::string_view path2);
+
 /// Append an arbitrary number of path components to \a dest
 template<typename S1, typename S2, typename... Args>
 void appendpath(std::string& dest, S1 first, S2 second, Args... next)
@@ -141,11 +374,457 @@ std::string joinpath(Args... components)
  */
 std::string normpath(const std::string& pathname);
 
+/// Normalise a pathname
+std::string normpath(std::string_view pathname);
+
+/// Normalise a pathname
+std::string normpath(const char* pathname);
+
+/**
+ * Storage for many strings, allocated in large blocks and released all at
+ * once.
+ *
+ * Strings stored in the arena are returned as std::string_view objects that
+ * stay valid until the arena is cleared or destroyed. Each is followed by a
+ * 0 byte, so that its data() can also be used as a C string.
+ *
+ * Strings larger than a quarter of the block size get a block of their own,
+ * to avoid wasting the rest of the current one.
+ *
+ * Example code:
+ * \code
+ *   str::Arena arena;
+ *   std::vector<std::string_view> paths;
+ *   for (const auto& name: names)
+ *       paths.push_back(str::joinpath(arena, {root, name}));
+ * \endcode
+ */
+class Arena
+{
+public:
+    static constexpr size_t default_block_size = 65536;
+
+protected:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    /// Free space at the end of the current block
+    char* cur = nullptr;
+    size_t avail = 0;
+    size_t block_size;
+
+    /// Allocate when there is not enough space in the current block
+    char* allocate_slow(size_t size);
+
+public:
+    explicit Arena(size_t block_size=default_block_size);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /// Allocate size bytes of uninitialized storage
+    char* allocate(size_t size)
+    {
+        if (size > avail)
+            return allocate_slow(size);
+        char* res = cur;
+        cur += size;
+        avail -= size;
+        return res;
+    }
+
+    /**
+     * Give back the end of the last allocation, when only the first used
+     * bytes of the size bytes allocated at ptr are needed
+     */
+    void shrink(char* ptr, size_t size, size_t used)
+    {
+        if (ptr + size == cur)
+        {
+            cur = ptr + used;
+            avail += size - used;
+        }
+    }
+
+    /// Copy a string into the arena
+    std::string_view store(std::string_view str);
+
+    /// Copy the concatenation of several strings into the arena
+    std::string_view concat(std::initializer_list<std::string_view> parts);
+
+    /// Release all strings, keeping one block of storage for reuse
+    void clear();
+
+    /// Total size of the memory blocks allocated by the arena
+    size_t capacity() const;
+};
+
+/**
+ * Normalise a pathname like normpath(), storing the result in \a arena
+ */
+std::string_view normpath(Arena& arena, std::string_view pathname);
+
+/**
+ * Join paths like joinpath(), storing the result in \a arena
+ */
+std::string_view joinpath(Arena& arena, std::initializer_list<std::string_view> components);
+
+/**
+ * Buffer for building and normalising pathnames without allocating memory.
+ *
+ * Paths shorter than inline_size are stored inside the object itself, and
+ * only longer paths are moved to the heap. The contents are always
+ * 0-terminated, so c_str() can be passed directly to system calls.
+ */
+class PathBuffer
+{
+public:
+    /// Size of the inline storage, including the trailing 0
+    static constexpr size_t inline_size = 256;
+
+protected:
+    char* buf;
+    size_t len = 0;
+    size_t cap = inline_size;
+    char inline_buf[inline_size];
+
+    /// Make sure that the buffer can hold size characters plus the trailing 0
+    void reserve(size_t size);
+
+public:
+    PathBuffer();
+    explicit PathBuffer(std::string_view path);
+    PathBuffer(const PathBuffer& o);
+    PathBuffer(PathBuffer&& o);
+    ~PathBuffer();
+    PathBuffer& operator=(const PathBuffer& o);
+    PathBuffer& operator=(PathBuffer&& o);
+
+    const char* c_str() const { return buf; }
+    const char* data() const { return buf; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    std::string_view view() const { return std::string_view(buf, len); }
+    operator std::string_view() const { return view(); }
+    std::string str() const { return std::string(buf, len); }
+
+    /// Truncate the path to the empty string
+    void clear();
+
+    /// Replace the contents with path
+    void assign(std::string_view path);
+
+    /// Append a path, adding a slash when appropriate, like appendpath
+    PathBuffer& append(std::string_view path);
+
+    /// Append two or more paths, adding slashes when appropriate
+    template<typename S, typename... Args>
+    PathBuffer& append(std::string_view path, S next, Args... rest)
+    {
+        append(path);
+        return append(next, rest...);
+    }
+
+    /**
+     * Normalise the path in place, in a single pass, in the same way as
+     * normpath().
+     */
+    void normalize();
+
+    /**
+     * Resolve a relative path against cwd, then normalise it.
+     *
+     * Absolute paths are only normalised.
+     */
+    void make_absolute(std::string_view cwd);
+
+    /// Return the last component of the path, like basename_view()
+    std::string_view basename() const { return basename_view(view()); }
+
+    /// Return the path without its last component, like dirname_view()
+    std::string_view dirname() const { return dirname_view(view()); }
+};
+
+/**
+ * Buffer for building strings, as a lightweight replacement for
+ * std::ostringstream.
+ *
+ * Short strings are built in inline storage without allocating memory, and
+ * clear() keeps any allocated storage, so that an Appender can be reused to
+ * build many strings.
+ *
+ * operator<< appends strings and characters as they are, and numbers
+ * formatted like format_append. Other types fall back to their std::ostream
+ * operator<<.
+ *
+ * Example code:
+ * \code
+ *   str::Appender msg;
+ *   msg << "cannot read " << count << " bytes from " << pathname;
+ *   throw std::runtime_error(msg.str());
+ * \endcode
+ */
+class Appender
+{
+public:
+    /// Size of the inline storage, including the trailing 0
+    static constexpr size_t inline_size = 128;
+
+protected:
+    char* buf;
+    size_t len = 0;
+    size_t cap = inline_size;
+    char inline_buf[inline_size];
+
+public:
+    Appender();
+    Appender(const Appender& o);
+    Appender(Appender&& o);
+    ~Appender();
+    Appender& operator=(const Appender& o);
+    Appender& operator=(Appender&& o);
+
+    const char* c_str() const { return buf; }
+    const char* data() const { return buf; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    std::string_view view() const { return std::string_view(buf, len); }
+    operator std::string_view() const { return view(); }
+    std::string str() const { return std::string(buf, len); }
+
+    /// Empty the buffer, keeping its storage
+    void clear();
+
+    /// Make sure that the buffer can hold size characters plus the trailing 0
+    void reserve(size_t size);
+
+    /// Append size bytes from s
+    Appender& append(const char* s, size_t size)
+    {
+        if (!size)
+            return *this;
+        if (len + size >= cap)
+        {
+            // s may point inside the buffer that is about to be reallocated
+            if (s >= buf && s < buf + len)
+            {
+                size_t offset = s - buf;
+                reserve(len + size);
+                s = buf + offset;
+            } else
+                reserve(len + size);
+        }
+        memcpy(buf + len, s, size);
+        len += size;
+        buf[len] = 0;
+        return *this;
+    }
+
+    /// Append a string
+    Appender& append(std::string_view s) { return append(s.data(), s.size()); }
+
+    /// Append the string representation of val
+    template<typename T>
+    Appender& operator<<(const T& val)
+    {
+        impl::append_value(*this, val);
+        return *this;
+    }
+};
+
+/**
+ * Substring search, with the needle preprocessed once to search many
+ * haystacks.
+ *
+ * Needles of up to tiny_needle_size bytes are searched with memchr on their
+ * first byte, and longer needles with a vectorized filter on their first and
+ * last bytes, when the CPU supports it.
+ *
+ * Needles longer than short_needle_size are also prepared for the Two-Way
+ * algorithm, which takes linear time in the worst case: the search switches
+ * to it if the filter finds too many false candidates, and it is used
+ * directly when vector instructions are not available.
+ *
+ * Constructing a Searcher never allocates, and costs almost nothing for
+ * needles that do not need Two-Way.
+ *
+ * The needle is not copied, and needs to outlive the Searcher.
+ */
+class Searcher
+{
+public:
+    /// Maximum needle size for searching with memchr on the first byte
+    static constexpr size_t tiny_needle_size = 3;
+    /// Maximum needle size for searching without Two-Way as a fallback
+    static constexpr size_t short_needle_size = 32;
+
+protected:
+    std::string_view needle;
+    /// True if using the Two-Way algorithm
+    bool two_way = false;
+    /// Critical factorization position of the needle, minus one
+    size_t critical = 0;
+    /// Period of the needle, or the shift to use if it is not periodic
+    size_t period = 0;
+    /// Length of the needle prefix known to match after shifting by period
+    size_t period_memory = 0;
+    /**
+     * Bitmap of the bytes in the needle, used by Two-Way to skip windows
+     * whose last byte does not occur in the needle
+     */
+    uint64_t byteset[4] = {};
+
+    /**
+     * Search needles of up to tiny_needle_size bytes with memchr on their
+     * first byte, checking the rest at each candidate
+     */
+    size_t find_tiny(std::string_view haystack, size_t pos) const
+    {
+        const char* h = haystack.data();
+        // Last position where a match can start
+        const char* last = h + haystack.size() - needle.size();
+        for (const char* cur = h + pos; cur <= last; ++cur)
+        {
+            cur = static_cast<const char*>(memchr(cur, needle[0], last - cur + 1));
+            if (!cur)
+                break;
+            if (memcmp(cur + 1, needle.data() + 1, needle.size() - 1) == 0)
+                return cur - h;
+        }
+        return std::string_view::npos;
+    }
+
+    void prepare_two_way();
+    size_t find_long(std::string_view haystack, size_t pos) const;
+    size_t find_two_way(std::string_view haystack, size_t pos) const;
+
+public:
+    explicit Searcher(std::string_view needle)
+        : needle(needle)
+    {
+        // Short needles have a bounded cost for checking each candidate, and
+        // need no preprocessing
+        if (needle.size() > short_needle_size)
+            prepare_two_way();
+    }
+
+    /// Return the needle
+    std::string_view pattern() const { return needle; }
+
+    /**
+     * Return the position of the first occurrence of the needle in haystack
+     * at or after pos, or std::string_view::npos if it is not found
+     */
+    size_t find(std::string_view haystack, size_t pos=0) const
+    {
+        if (pos > haystack.size())
+            return std::string_view::npos;
+        if (needle.empty())
+            return pos;
+        if (haystack.size() - pos < needle.size())
+            return std::string_view::npos;
+        // Short separators are the common case: keep them inline
+        if (needle.size() <= tiny_needle_size)
+            return find_tiny(haystack, pos);
+        return find_long(haystack, pos);
+    }
+
+    /// Check if haystack contains the needle
+    bool contained_in(std::string_view haystack) const { return find(haystack) != std::string_view::npos; }
+};
+
+/**
+ * Split a string where a given substring is found, without copying it.
+ *
+ * This works like Split, but it does not take a copy of the string and its
+ * iterators yield std::string_view tokens that point inside it: the string
+ * and the separator need to outlive the splitter and all its iterators.
+ *
+ * Example code:
+ * \code
+ *   for (std::string_view tok: str::SplitView(my_string, "/"))
+ *       process(tok);
+ * \endcode
+ */
+struct SplitView
+{
+    /// String to split
+    std::string_view str;
+    /// Separator
+    std::string_view sep;
+    /**
+     * If true, skip empty tokens, effectively grouping consecutive separators
+     * as if they were a single one
+     */
+    bool skip_empty;
+
+    SplitView(std::string_view str, std::string_view sep, bool skip_empty=false)
+        : str(str), sep(sep), skip_empty(skip_empty) {}
+
+    class const_iterator
+    {
+    protected:
+        /// String to split
+        std::string_view str;
+        /// Separator
+        std::string_view sep;
+        /// Skip empty tokens
+        bool skip_empty = false;
+        /// False if this is an end iterator
+        bool valid = false;
+        /// Current token
+        std::string_view cur;
+        /// Position of the first character of the next token
+        size_t end = 0;
+
+        /// Move end past all the consecutive separators that start at its position
+        void skip_separators();
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = int;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        /// Begin iterator
+        const_iterator(const SplitView& split);
+        /// End iterator
+        const_iterator() {}
+
+        const_iterator& operator++();
+        const std::string_view& operator*() const { return cur; }
+        const std::string_view* operator->() const { return &cur; }
+
+        /// Return the part of the string that has not been tokenized yet
+        std::string_view remainder() const;
+
+        /// Return true if this is the end iterator
+        bool is_end() const { return !valid; }
+
+        bool operator==(const const_iterator& ti) const;
+        bool operator!=(const const_iterator& ti) const;
+    };
+
+    /// Return the begin iterator to split a string on instances of sep
+    const_iterator begin() const { return const_iterator(*this); }
+
+    /// Return the end iterator to string split
+    const_iterator end() const { return const_iterator(); }
+};
+
 /**
  * Split a string where a given substring is found
  *
  * This does a similar work to the split functions of perl, python and ruby.
  *
+ * This keeps a copy of the string, and yields each token as a std::string. It
+ * is implemented on top of SplitView, which can be used directly to tokenize
+ * without allocating.
+ *
  * Example code:
  * \code
  *   str::Split splitter(my_string, "/");
@@ -171,14 +850,10 @@ struct Split
     class const_iterator
     {
     protected:
-        const Split* split = nullptr;
+        /// Position in the string
+        SplitView::const_iterator pos;
         /// Current token
         std::string cur;
-        /// Position of the first character of the next token
-        size_t end = 0;
-
-        /// Move end past all the consecutive separators that start at its position
-        void skip_separators();
 
     public:
         using iterator_category = std::input_iterator_tag;
@@ -210,10 +885,247 @@ struct Split
     const_iterator end() { return const_iterator(); }
 };
 
+/**
+ * Split a string where sep is found, like SplitView, appending the tokens to
+ * \a out.
+ *
+ * The string is copied once into \a arena, and the tokens point inside the
+ * copy, so they remain valid as long as the arena and not as long as str.
+ */
+void split_into(std::vector<std::string_view>& out, Arena& arena, std::string_view str, std::string_view sep, bool skip_empty=false);
+
+/**
+ * Set of bytes, for searching any of them in a string.
+ *
+ * Sets of a single byte are searched with memchr, and sets of ASCII
+ * characters are searched with vectorized code when the CPU supports it.
+ */
+class ByteSet
+{
+protected:
+    /// Membership of each byte
+    bool table[256] = {};
+    /// For each low nibble, bitmap of the high nibbles 0-7 in the set
+    uint8_t nibbles[16] = {};
+    /// Number of bytes in the set
+    unsigned count = 0;
+    /// True if all the bytes in the set are ASCII
+    bool ascii = true;
+    /// The first byte in the set
+    char first = 0;
+
+public:
+    ByteSet() = default;
+    /// Create a set with all the bytes in chars
+    explicit ByteSet(std::string_view chars);
+
+    /// Add a byte to the set
+    void add(char c);
+
+    /// Check if c is in the set
+    bool contains(char c) const { return table[static_cast<unsigned char>(c)]; }
+
+    /// Return the number of bytes in the set
+    unsigned size() const { return count; }
+
+    /**
+     * Return the position of the first byte of str that is in the set,
+     * starting from pos, or std::string_view::npos if none is found
+     */
+    size_t find_in(std::string_view str, size_t pos=0) const;
+
+    /**
+     * Return the position of the first byte of str that is not in the set,
+     * starting from pos, or std::string_view::npos if none is found
+     */
+    size_t find_not_in(std::string_view str, size_t pos=0) const;
+};
+
+/**
+ * Split a string on any of a set of separator characters, without copying
+ * it.
+ *
+ * Like SplitView, tokens are yielded as std::string_view pointing inside
+ * str. Iterators refer to the Tokenizer, which needs to outlive them.
+ *
+ * Example code:
+ * \code
+ *   str::Tokenizer tok(line, " \t,;", true);
+ *   tok.quote = '"';
+ *   for (std::string_view field: tok)
+ *      process(field);
+ * \endcode
+ */
+struct Tokenizer
+{
+    /// String to split
+    std::string_view str;
+    /// Separator characters
+    ByteSet separators;
+    /**
+     * If true, skip empty tokens, effectively grouping consecutive separators
+     * as if they were a single one
+     */
+    bool skip_empty;
+    /**
+     * Maximum number of splits to perform: after that, the rest of the
+     * string is returned as the last token, unchanged
+     */
+    size_t max_splits = std::string_view::npos;
+    /**
+     * If not 0, a token that starts with this character extends to the
+     * matching closing quote, ignoring separators in between. When the
+     * closing quote is at the end of the token, the quotes are removed.
+     *
+     * Doubled quotes inside a quoted token do not close it, and they are
+     * yielded unchanged, since tokens point inside str.
+     */
+    char quote = 0;
+
+    Tokenizer(std::string_view str, std::string_view separators, bool skip_empty=false)
+        : str(str), separators(separators), skip_empty(skip_empty) {}
+
+    class const_iterator
+    {
+    protected:
+        /// Tokenizer being iterated
+        const Tokenizer* tok = nullptr;
+        /// Current token
+        std::string_view cur;
+        /// Position of the first character of the next token
+        size_t end = 0;
+        /// Number of splits performed so far
+        size_t splits = 0;
+
+        /**
+         * Return the position of the separator that ends the token starting
+         * at end, or npos if it extends to the end of the string.
+         *
+         * If the token starts with a quoted section, closing_quote is set to
+         * the position of its closing quote, otherwise to npos.
+         */
+        size_t token_end(size_t& closing_quote) const;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = int;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        /// Begin iterator
+        const_iterator(const Tokenizer& tok);
+        /// End iterator
+        const_iterator() {}
+
+        const_iterator& operator++();
+        const std::string_view& operator*() const { return cur; }
+        const std::string_view* operator->() const { return &cur; }
+
+        /// Return the part of the string that has not been tokenized yet
+        std::string_view remainder() const;
+
+        /// Return true if this is the end iterator
+        bool is_end() const { return !tok; }
+
+        bool operator==(const const_iterator& ti) const;
+        bool operator!=(const const_iterator& ti) const;
+    };
+
+    /// Return the begin iterator
+    const_iterator begin() const { return const_iterator(*this); }
+
+    /// Return the end iterator
+    const_iterator end() const { return const_iterator(); }
+};
+
+/**
+ * Glob pattern, compiled once for fast repeated matching.
+ *
+ * Patterns use the shell wildcards understood by fnmatch(3) without flags:
+ * '*' matches any sequence of characters, including '/', '?' matches any
+ * single byte, "[...]" matches a set of bytes, with ranges and negation via
+ * '!' or '^', and a backslash makes the next character literal. Character
+ * classes like "[:alpha:]" are not supported.
+ *
+ * Additionally, "{a,b,c}" matches any of the comma-separated alternatives,
+ * and more patterns can be added with add(): the Glob matches a string if any
+ * of its patterns do.
+ *
+ * Matching rejects most strings by checking the literal prefix and the
+ * minimum length of each pattern first. An empty Glob matches nothing.
+ */
+class Glob
+{
+protected:
+    enum class Op : uint8_t
+    {
+        LITERAL,
+        ANY_CHAR,
+        ANY_STRING,
+        CHAR_SET,
+    };
+
+    struct Token
+    {
+        Op op;
+        /// Text for LITERAL tokens
+        std::string literal;
+        /// Index in sets for CHAR_SET tokens
+        unsigned set = 0;
+    };
+
+    struct Pattern
+    {
+        std::vector<Token> tokens;
+        /// Literal text that all matching strings start with
+        std::string prefix;
+        /// Minimum length of a matching string
+        size_t min_size = 0;
+        /// True if the pattern contains '*', and can match longer strings
+        bool variable_size = false;
+    };
+
+    std::vector<Pattern> patterns;
+    std::vector<ByteSet> sets;
+
+    /// Compile a pattern without alternatives
+    void compile(std::string_view pattern);
+
+    /// Check if str matches a compiled pattern
+    bool match(const Pattern& pattern, std::string_view str) const;
+
+public:
+    Glob() = default;
+    Glob(std::string_view pattern);
+    Glob(const std::string& pattern) : Glob(std::string_view(pattern)) {}
+    Glob(const char* pattern) : Glob(std::string_view(pattern)) {}
+
+    /// Add a pattern, expanding its {...} alternatives
+    void add(std::string_view pattern);
+
+    /// Remove all patterns
+    void clear();
+
+    /// Check if there are no patterns
+    bool empty() const { return patterns.empty(); }
+
+    /// Check if str matches any of the patterns
+    bool match(std::string_view str) const;
+};
+
 /**
  * Escape the string so it can safely used as a C string inside double quotes
  */
+std::string encode_cstring(std::string_view str);
 std::string encode_cstring(const std::string& str);
+inline std::string encode_cstring(const char* str) { return encode_cstring(std::string_view(str)); }
+
+/**
+ * Escape the string so it can safely used as a C string inside double quotes,
+ * appending the result to \a out.
+ */
+void encode_cstring_append(std::string& out, std::string_view str);
 
 /**
  * Unescape a C string, stopping at the first double quotes or at the end of
@@ -221,15 +1133,101 @@ std::string encode_cstring(const std::string& str);
  *
  * lenParsed is set to the number of characters that were pased (which can be
  * greather than the size of the resulting string in case escapes were found)
+ *
+ * \\x is followed by up to 2 hexadecimal digits, and yields the byte they
+ * encode: "\\x41" decodes to "A".
+ *
+ * Invalid escape sequences are decoded leniently: unknown escapes yield the
+ * escaped character, and \\x without hex digits yields a 0 byte.
  */
+std::string decode_cstring(std::string_view str, size_t& lenParsed);
 std::string decode_cstring(const std::string& str, size_t& lenParsed);
+inline std::string decode_cstring(const char* str, size_t& lenParsed) { return decode_cstring(std::string_view(str), lenParsed); }
+
+/**
+ * Unescape a C string like decode_cstring, appending the result to \a out
+ * and rejecting invalid escape sequences.
+ *
+ * Returns true on success, setting lenParsed as in decode_cstring. If an
+ * invalid escape sequence is found, decoding stops, lenParsed is set to the
+ * offset of its backslash, and false is returned.
+ */
+bool decode_cstring_append(std::string& out, std::string_view str, size_t& lenParsed);
 
 /// Urlencode a string
 std::string encode_url(const std::string& str);
 
+/**
+ * Urlencode a string, appending the result to \a out.
+ *
+ * This allows to reuse the same buffer when building large urls.
+ */
+void encode_url_append(std::string& out, std::string_view str);
+
 /// Decode an urlencoded string
 std::string decode_url(const std::string& str);
 
+/**
+ * Decode an urlencoded string, appending the result to \a out.
+ *
+ * A truncated escape sequence at the end of the string is ignored.
+ */
+void decode_url_append(std::string& out, std::string_view str);
+
+/// Case of the letters used by encode_hex
+enum class HexCase
+{
+    LOWER,
+    UPPER,
+};
+
+/// Encode a string as hexadecimal digits, two per byte
+std::string encode_hex(std::string_view str, HexCase hex_case=HexCase::LOWER);
+
+/// Encode a buffer as hexadecimal digits
+std::string encode_hex(const void* data, size_t size, HexCase hex_case=HexCase::LOWER);
+
+/// Encode a string as hexadecimal digits, appending the result to \a out
+void encode_hex_append(std::string& out, std::string_view str, HexCase hex_case=HexCase::LOWER);
+
+/// Encode a buffer as hexadecimal digits, appending the result to \a out
+void encode_hex_append(std::string& out, const void* data, size_t size, HexCase hex_case=HexCase::LOWER);
+
+/**
+ * Decode a string of hexadecimal digits, in either case.
+ *
+ * Throws std::invalid_argument if the string has an odd length or contains
+ * characters that are not hexadecimal digits.
+ */
+std::string decode_hex(std::string_view str);
+
+/**
+ * Decode a string of hexadecimal digits, appending the result to \a out.
+ *
+ * In case of errors, out is left unchanged.
+ */
+void decode_hex_append(std::string& out, std::string_view str);
+
+/**
+ * Return the offset of the first invalid UTF-8 sequence in str, or
+ * std::string_view::npos if str is valid UTF-8.
+ *
+ * Overlong encodings, surrogates, code points past U+10FFFF and sequences
+ * truncated at the end of the string are invalid.
+ */
+size_t find_invalid_utf8(std::string_view str);
+
+/// Check if str is valid UTF-8
+bool validate_utf8(std::string_view str);
+
+/**
+ * Count the code points in a UTF-8 string.
+ *
+ * This counts the bytes that are not continuation bytes, and it does not
+ * validate the string: use validate_utf8() for that.
+ */
+size_t count_codepoints(std::string_view str);
+
 /// Encode a string in Base64
 std::string encode_base64(const std::string& str);
 
@@ -239,6 +1237,95 @@ std::string encode_base64(const void* data, size_t size);
 /// Decode a string encoded in Base64
 std::string decode_base64(const std::string& str);
 
+/**
+ * Incremental Base64 encoder.
+ *
+ * Data can be fed in chunks of any size: incomplete triplets are kept until
+ * the next call, and the result is the same as calling encode_base64 on the
+ * concatenation of all the chunks.
+ */
+class Base64Encoder
+{
+protected:
+    /// Bytes left over from the previous chunk
+    unsigned char partial[2];
+    /// Number of bytes in partial
+    unsigned partial_size = 0;
+
+public:
+    /// Encode a chunk of data, appending the result to \a out
+    void encode(const void* data, size_t size, std::string& out);
+
+    /**
+     * Encode the leftover data, with padding, appending the result to \a out.
+     *
+     * After this, the encoder can be used to encode a new stream.
+     */
+    void flush(std::string& out);
+};
+
+/**
+ * Incremental Base64 decoder.
+ *
+ * Data can be fed in chunks of any size: incomplete quadruplets are kept
+ * until the next call.
+ *
+ * Compared to decode_base64, whitespace is skipped, so that line-wrapped
+ * input can be decoded, and padding is honored at the end of every
+ * quadruplet, so that concatenated streams can be decoded.
+ */
+class Base64Decoder
+{
+protected:
+    /// Characters left over from the previous chunk
+    unsigned char partial[4];
+    /// Number of characters in partial
+    unsigned partial_size = 0;
+
+public:
+    /// Decode a chunk of data, appending the result to \a out
+    void decode(const void* data, size_t size, std::string& out);
+
+    /**
+     * Decode the leftover data, appending the result to \a out.
+     *
+     * After this, the decoder can be used to decode a new stream.
+     */
+    void flush(std::string& out);
+};
+
+/**
+ * Implementations available for encode_base64 and decode_base64.
+ *
+ * The vectorized implementations are only available on x86 CPUs that support
+ * the corresponding instruction sets.
+ */
+enum class Base64Impl
+{
+    /// Use the fastest implementation supported by the CPU
+    AUTO,
+    /// Portable implementation
+    SCALAR,
+    /// Vectorized implementation using SSE4.1 instructions
+    SSE41,
+    /// Vectorized implementation using AVX2 instructions
+    AVX2,
+};
+
+/// Check if the given base64 implementation can be used on this CPU
+bool base64_impl_supported(Base64Impl impl);
+
+/**
+ * Select the implementation used by encode_base64 and decode_base64.
+ *
+ * The default is Base64Impl::AUTO, which is what normal code should use: this
+ * is meant for testing and benchmarking, and it is not thread safe.
+ *
+ * Throws std::runtime_error if the implementation is not supported on this
+ * CPU.
+ */
+void base64_set_impl(Base64Impl impl);
+
 }
 }
 #endif
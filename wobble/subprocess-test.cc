@@ -88,6 +88,27 @@ add_method("stdout", []() {
     wassert(actual(read) == "5\n");
 });
 
+add_method("stdout_records", []() {
+    // Parse the output of a child process as it is produced
+    Popen cmd_seq({"seq", "1", "100000"});
+    cmd_seq.set_stdout(Redirect::PIPE);
+    cmd_seq.fork();
+
+    sys::NamedFileDescriptor out(cmd_seq.get_stdout(), "stdout");
+    sys::RecordReader lines(out, "\n", 4096);
+    unsigned count = 0;
+    unsigned long long sum = 0;
+    for (auto line: lines)
+    {
+        ++count;
+        sum += std::stoul(std::string(line));
+    }
+    cmd_seq.wait();
+    wassert(actual(cmd_seq.returncode()) == 0);
+    wassert(actual(count) == 100000u);
+    wassert(actual(sum) == 5000050000ull);
+});
+
 add_method("stdout_to_file", []() {
     Popen cmd_wc;
     cmd_wc.args.push_back("wc");
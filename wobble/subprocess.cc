@@ -1,5 +1,6 @@
 #include "subprocess.h"
 #include "sys.h"
+#include "string.h"
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -10,7 +11,6 @@
 #include <cstring>
 #include <system_error>
 #include <algorithm>
-#include <sstream>
 
 namespace wobble {
 namespace subprocess {
@@ -469,7 +469,7 @@ void Child::kill() { send_signal(SIGKILL); }
 
 std::string Child::format_raw_returncode(int raw_returncode)
 {
-    std::stringstream b_status;
+    std::string b_status;
 
     bool exited_normally = WIFEXITED(raw_returncode);
     int exit_code = exited_normally ? WEXITSTATUS(raw_returncode) : -1;
@@ -479,16 +479,20 @@ std::string Child::format_raw_returncode(int raw_returncode)
 
     if (exited_normally)
         if (exit_code == 0)
-            b_status << "terminated successfully";
+            b_status += "terminated successfully";
         else
-            b_status << "exited with code " << exit_code;
+        {
+            b_status += "exited with code ";
+            str::format_append(b_status, exit_code);
+        }
     else
     {
-        b_status << "was interrupted, killed by signal " << signal;
-        if (dumped_core) b_status << " (core dumped)";
+        b_status += "was interrupted, killed by signal ";
+        str::format_append(b_status, signal);
+        if (dumped_core) b_status += " (core dumped)";
     }
 
-    return b_status.str();
+    return b_status;
 }
 
 
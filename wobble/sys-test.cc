@@ -1,11 +1,15 @@
 #include "tests.h"
 #include "sys.h"
+#include "string.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <cstring>
 #include <set>
+#include <mutex>
+#include <vector>
 #include <unistd.h>
 
 using namespace std;
@@ -43,6 +47,85 @@ add_method("timestamp", []() {
     wassert(actual(sys::timestamp("testfile", 0)) == 0);
 });
 
+add_method("file_info", []() {
+    using namespace wobble;
+    system("rm -rf testdir testlink");
+    FileInfo missing("testdir");
+    wassert(actual(missing.exists()).isfalse());
+    wassert(actual(missing.isdir()).isfalse());
+    wassert_throws(std::system_error, missing.stat("testdir"));
+
+    mkdir("testdir", 0777);
+    write_file("testdir/file", "test");
+    symlink("testdir/file", "testlink");
+
+    // One call answers all questions
+    FileInfo info("testdir/file");
+    wassert(actual(info.exists()).istrue());
+    wassert(actual(info.isreg()).istrue());
+    wassert(actual(info.isdir()).isfalse());
+    wassert(actual(info.size()) == 4u);
+    wassert(actual(info.inode()) == sys::inode("testdir/file"));
+    wassert(actual(info.mtime()) == sys::timestamp("testdir/file"));
+
+    struct stat st;
+    sys::stat("testdir/file", st);
+    wassert(actual(info.inode()) == st.st_ino);
+    wassert(actual(info.dev()) == st.st_dev);
+    wassert(actual(info.mtim().tv_nsec) == st.st_mtim.tv_nsec);
+    wassert(actual(info.blksize()) == st.st_blksize);
+
+    // Device nodes keep their device number and block size
+    struct stat devnull;
+    wassert(actual(::stat("/dev/null", &devnull)) == 0);
+    wassert_true(info.stat_ifexists("/dev/null"));
+    wassert(actual(info.ischr()).istrue());
+    wassert(actual(info.rdev()) == devnull.st_rdev);
+    wassert(actual(major(info.rdev())) == 1u);
+    wassert(actual(minor(info.rdev())) == 3u);
+    sys::stat("/dev/null", st);
+    wassert(actual(st.st_rdev) == devnull.st_rdev);
+    wassert(actual(st.st_blksize) == devnull.st_blksize);
+    wassert(actual(S_ISCHR(st.st_mode)).istrue());
+
+    // Only the requested fields are needed
+    wassert_true(info.stat_ifexists("testdir", FileInfo::TYPE, FileInfo::DONT_SYNC));
+    wassert(actual(info.mask() & FileInfo::TYPE) == FileInfo::TYPE);
+    wassert(actual(info.isdir()).istrue());
+
+    // Symlinks
+    wassert_true(info.stat_ifexists("testlink", FileInfo::TYPE));
+    wassert(actual(info.isreg()).istrue());
+    wassert_true(info.stat_ifexists("testlink", FileInfo::TYPE, AT_SYMLINK_NOFOLLOW));
+    wassert(actual(info.islnk()).istrue());
+    wassert(actual(sys::islnk("testlink")).isfalse());
+
+    // Relative to a directory, and on an open file
+    Path dir("testdir", O_DIRECTORY);
+    wassert_true(info.statat_ifexists(dir, "file", FileInfo::SIZE));
+    wassert(actual(info.size()) == 4u);
+    wassert(actual(info.statat_ifexists(dir, "missing")).isfalse());
+    File file("testdir/file", O_RDONLY);
+    info.fstat(file, FileInfo::SIZE | FileInfo::TYPE);
+    wassert(actual(info.isreg()).istrue());
+    wassert(actual(info.size()) == 4u);
+
+    // Fields that were not filled read as 0, whatever the kernel returned
+    info.fstat(file, FileInfo::TYPE);
+    if (!(info.mask() & FileInfo::SIZE))
+        wassert(actual(info.size()) == 0u);
+    if (!(info.mask() & FileInfo::INO))
+        wassert(actual(info.inode()) == 0u);
+    if (!(info.mask() & FileInfo::MTIME))
+        wassert(actual(info.mtime()) == 0);
+
+    // A missing file in the middle of the path is not a missing file
+    write_file("testdir/notadir", "");
+    wassert_throws(std::system_error, info.stat_ifexists("testdir/notadir/file"));
+
+    unlink("testlink");
+});
+
 add_method("write_file_atomically", []() {
     string test("ciao");
     write_file_atomically("testfile", test);
@@ -53,6 +136,52 @@ add_method("write_file_atomically", []() {
     wassert(actual(read_file("testfile")) == "");
 });
 
+add_method("read_file_view", []() {
+    // Small files are read into a buffer
+    write_file("testfile", "ciao");
+    FileContents small = read_file_view("testfile");
+    wassert(actual(small.is_mapped()).isfalse());
+    wassert(actual(small.view() == "ciao").istrue());
+
+    write_file("testfile", "");
+    FileContents empty = read_file_view("testfile", 0, 0);
+    wassert(actual(empty.is_mapped()).isfalse());
+    wassert(actual(empty.empty()).istrue());
+
+    // Large files are mapped
+    std::string data(FileContents::default_mmap_threshold * 2, 'x');
+    data[10] = 'y';
+    write_file("testfile", data);
+    FileContents large = read_file_view("testfile", FileContents::POPULATE | FileContents::SEQUENTIAL);
+    wassert(actual(large.is_mapped()).istrue());
+    wassert(actual(large.size()) == data.size());
+    wassert(actual(large.view() == data).istrue());
+    wassert(actual(read_file("testfile") == data).istrue());
+
+    // Moving keeps the contents valid
+    FileContents moved(std::move(large));
+    wassert(actual(moved.view() == data).istrue());
+    moved = read_file_view("testfile", 0, data.size() + 1);
+    wassert(actual(moved.is_mapped()).isfalse());
+    wassert(actual(moved.str() == data).istrue());
+
+    // Files in /proc have size 0
+    FileContents status = read_file_view("/proc/self/status");
+    wassert(actual(status.str()).contains("Pid:"));
+    wassert(actual(read_file("/proc/self/status")).contains("Pid:"));
+
+    // Pipes are read until EOF
+    int fds[2];
+    wassert(actual(pipe(fds)) == 0);
+    wassert(actual(::write(fds[1], "pipe data", 9)) == 9);
+    ::close(fds[1]);
+    FileContents piped = read_file_view("/proc/self/fd/" + to_string(fds[0]));
+    ::close(fds[0]);
+    wassert(actual(piped.view() == "pipe data").istrue());
+
+    wassert_throws(std::system_error, read_file_view("testfile-missing"));
+});
+
 add_method("directory_iterate", []() {
     Path dir("/", O_DIRECTORY);
 
@@ -89,6 +218,72 @@ add_method("directory_iterate", []() {
     wassert(actual(dir.faccessat("wobble_unit_test_file_expected_not_to_be_there", F_OK)).isfalse());
 });
 
+add_method("dir_reader", []() {
+    using namespace wobble;
+    system("rm -rf testdir");
+    mkdir("testdir", 0777);
+    set<string> expected;
+    for (unsigned i = 0; i < 500; ++i)
+    {
+        string name = "file" + to_string(i);
+        write_file("testdir/" + name, "");
+        expected.insert(name);
+    }
+    mkdir("testdir/subdir", 0777);
+    symlink("subdir", "testdir/link");
+    expected.insert("subdir");
+    expected.insert("link");
+
+    // Use a small buffer to need several getdents64 calls
+    DirReader reader("testdir", 1024);
+    set<string> found;
+    DirEntry entry;
+    while (reader.next(entry))
+    {
+        wassert(actual(entry.name.data()[entry.name.size()]) == 0);
+        found.insert(string(entry.name));
+        if (entry.name == "subdir" && entry.type != DT_UNKNOWN)
+            wassert(actual(entry.isdir()).istrue());
+        if (entry.name == "link" && entry.type != DT_UNKNOWN)
+            wassert(actual(entry.islnk()).istrue());
+    }
+    wassert(actual(found.size()) == expected.size() + 2);
+    wassert(actual(found.find("..") != found.end()).istrue());
+    wassert(actual(reader.next(entry)).isfalse());
+
+    // Batch reading skips . and ..
+    Path dir("testdir", O_DIRECTORY);
+    DirReader batch_reader(dir, 4096);
+    vector<DirEntry> batch;
+    found.clear();
+    unsigned batches = 0;
+    while (batch_reader.read_batch(batch))
+    {
+        ++batches;
+        // Resolve types as if the file system had not provided them
+        for (auto& e: batch)
+            e.type = DT_UNKNOWN;
+        batch_reader.resolve_types(batch);
+        for (const auto& e: batch)
+        {
+            found.insert(string(e.name));
+            if (e.name == "subdir")
+                wassert(actual(e.isdir()).istrue());
+            else if (e.name == "link")
+                wassert(actual(e.islnk()).istrue());
+            else
+                wassert(actual(e.isreg()).istrue());
+        }
+    }
+    wassert(actual(batches) > 1u);
+    wassert(actual(batch.empty()).istrue());
+    wassert(actual(found == expected).istrue());
+
+    wassert_throws(std::system_error, DirReader("testdir/file0"));
+
+    system("rm -rf testdir");
+});
+
 add_method("openat_ifexists", []() {
     Path dir("/etc", O_DIRECTORY);
 
@@ -101,6 +296,156 @@ add_method("openat_ifexists", []() {
 });
 
 
+add_method("base64", []() {
+    std::string data;
+    for (unsigned i = 0; i < 100000; ++i)
+        data += (char)(i * 31);
+    write_file("testfile", data);
+
+    {
+        File in("testfile", O_RDONLY);
+        File out("testfile.b64", O_WRONLY | O_CREAT | O_TRUNC);
+        encode_base64(in, out, 1000);
+    }
+    wassert(actual(read_file("testfile.b64")) == wobble::str::encode_base64(data));
+
+    {
+        File in("testfile.b64", O_RDONLY);
+        File out("testfile.dec", O_WRONLY | O_CREAT | O_TRUNC);
+        decode_base64(in, out, 999);
+    }
+    wassert(actual(read_file("testfile.dec")) == data);
+});
+
+add_method("abspath", []() {
+    std::string cwd = getcwd();
+    wassert(actual(abspath("foo/../bar")) == cwd + "/bar");
+    wassert(actual(abspath("/foo/../bar")) == "/bar");
+
+    wobble::str::PathBuffer path("..//x");
+    abspath(path);
+    wassert(actual(path.str()) == wobble::str::joinpath(wobble::str::dirname(cwd), "x"));
+
+    makedirs("abspath");
+    wobble::sys::chdir("abspath");
+    try {
+        wassert(actual(abspath("foo")) == cwd + "/abspath/foo");
+    } catch (...) {
+        wobble::sys::chdir(cwd);
+        throw;
+    }
+    wobble::sys::chdir(cwd);
+    wassert(actual(abspath("foo")) == cwd + "/foo");
+
+    // Directory changes not made through sys::chdir are also seen
+    wassert(actual(::chdir("abspath")) == 0);
+    std::string changed = abspath("foo");
+    wassert(actual(::chdir(cwd.c_str())) == 0);
+    wassert(actual(changed) == cwd + "/abspath/foo");
+
+    wobble::str::PathBuffer based("../x");
+    abspath(based, "/a/b");
+    wassert(actual(based.str()) == "/a/x");
+});
+
+add_method("mapped_lines", []() {
+    auto read_lines = [](MappedLines& lines) {
+        std::vector<std::string> res;
+        for (auto line: lines)
+            res.emplace_back(line);
+        return res;
+    };
+
+    write_file("testfile", "");
+    {
+        MappedLines lines("testfile");
+        wassert(actual(read_lines(lines).size()) == 0u);
+    }
+
+    write_file("testfile", "foo\r\n\nbar\r\nbaz");
+    {
+        MappedLines lines("testfile");
+        auto res = read_lines(lines);
+        wassert(actual(res.size()) == 4u);
+        wassert(actual(res[0]) == "foo\r");
+        wassert(actual(res[1]) == "");
+        wassert(actual(res[2]) == "bar\r");
+        wassert(actual(res[3]) == "baz");
+    }
+    {
+        File in("testfile", O_RDONLY);
+        MappedLines lines(in, true);
+        std::string_view line;
+        wassert(actual(lines.next(line)).istrue());
+        wassert(actual(line == "foo").istrue());
+        wassert(actual(lines.next(line)).istrue());
+        wassert(actual(line == "").istrue());
+        wassert(actual(lines.next(line)).istrue());
+        wassert(actual(line == "bar").istrue());
+        wassert(actual(lines.next(line)).istrue());
+        wassert(actual(line == "baz").istrue());
+        wassert(actual(lines.next(line)).isfalse());
+    }
+
+    // Lines that cross window boundaries, and lines longer than a window
+    std::string data;
+    std::vector<std::string> expected;
+    for (unsigned i = 0; i < 2000; ++i)
+    {
+        expected.emplace_back(i * 7 % 61, 'a' + i % 26);
+        if (i % 500 == 0)
+            expected.back() += std::string(20000, 'x');
+        data += expected.back();
+        data += '\n';
+    }
+    write_file("testfile", data);
+    {
+        MappedLines lines("testfile", false, 4096);
+        wassert(actual(read_lines(lines) == expected).istrue());
+    }
+});
+
+add_method("record_reader", []() {
+    auto read_records = [](const std::string& data, const std::string& sep, size_t buffer_size) {
+        int fds[2];
+        if (::pipe(fds) == -1)
+            throw std::system_error(errno, std::system_category(), "cannot create pipe");
+        ManagedNamedFileDescriptor in(fds[0], "pipe read end");
+        ManagedNamedFileDescriptor out(fds[1], "pipe write end");
+        out.write_all_or_throw(data.data(), data.size());
+        out.close();
+
+        std::vector<std::string> res;
+        RecordReader reader(in, sep, buffer_size);
+        for (auto rec: reader)
+            res.emplace_back(rec);
+        return res;
+    };
+
+    wassert(actual(read_records("", "\n", 16).size()) == 0u);
+    wassert(actual(wobble::str::join("|", read_records("a\n\nb\nc", "\n", 16))) == "a||b|c");
+    wassert(actual(wobble::str::join("|", read_records("a\n", "\n", 16))) == "a");
+
+    // Records and multibyte separators spanning buffer boundaries, and
+    // records longer than the buffer
+    std::string data;
+    std::vector<std::string> expected;
+    for (unsigned i = 0; i < 500; ++i)
+    {
+        expected.emplace_back(i % 37, 'a' + i % 26);
+        data += expected.back();
+        data += "\r\n";
+    }
+    for (size_t size: { 1, 2, 3, 7, 16, 100, 65536 })
+    {
+        WOBBLE_TEST_INFO(info);
+        info() << "buffer size " << size;
+        wassert(actual(read_records(data, "\r\n", size) == expected).istrue());
+    }
+
+    wassert_throws(std::invalid_argument, read_records("", "", 16));
+});
+
 add_method("makedirs", []() {
     wassert(actual(makedirs("makedirs/foo/bar/baz")).istrue());
     wassert(actual(isdir("makedirs/foo/bar/baz")).istrue());
@@ -120,6 +465,225 @@ add_method("rmtree", []() {
     rmtree_ifexists("foo");
 });
 
+add_method("rmtree_parallel", []() {
+    using namespace wobble;
+    // Deep and wide tree, with more directories than allowed open fds
+    makedirs("rmtree_outside");
+    write_file("rmtree_outside/keep", "");
+    std::string deep = "foo";
+    for (unsigned i = 0; i < 20; ++i)
+    {
+        deep += "/d" + to_string(i);
+        makedirs(deep);
+        write_file(deep + "/file", "");
+    }
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        std::string dir = "foo/wide" + to_string(i);
+        makedirs(dir + "/sub");
+        for (unsigned j = 0; j < 300; ++j)
+            write_file(dir + "/f" + to_string(j), "");
+    }
+    symlink("../rmtree_outside", "foo/outside");
+
+    RmtreeOptions opts;
+    opts.threads = 4;
+    opts.max_open_fds = 1;
+    opts.progress_interval = 100;
+    unsigned progress_calls = 0;
+    RmtreeStats last;
+    opts.progress = [&](const RmtreeStats& stats) { ++progress_calls; last = stats; };
+
+    RmtreeStats stats = rmtree("foo/", opts);
+    wassert(actual(exists("foo")).isfalse());
+    wassert(actual(stats.files) == 20u + 8u * 300u + 1u);
+    wassert(actual(stats.dirs) == 1u + 20u + 8u * 2u);
+    wassert(actual(progress_calls) > 1u);
+    wassert(actual(last.files) == stats.files);
+    wassert(actual(last.dirs) == stats.dirs);
+
+    // Symlinks are deleted, not followed
+    wassert(actual(exists("rmtree_outside/keep")).istrue());
+
+    wassert(actual(rmtree_ifexists("foo", opts)).isfalse());
+    wassert(actual(rmtree_ifexists("rmtree_outside", opts)).istrue());
+    wassert_throws(std::system_error, rmtree("rmtree_outside", opts));
+});
+
+add_method("rmtree_deep", []() {
+    using namespace wobble;
+    // Trees deeper than PATH_MAX, with very few open directories allowed
+    std::string name(100, 'd');
+    for (unsigned threads: { 1u, 4u })
+    {
+        WOBBLE_TEST_INFO(info);
+        info() << "threads: " << threads;
+        rmtree_ifexists("rmtree_deep");
+        makedirs("rmtree_deep");
+        std::unique_ptr<Path> dir(new Path("rmtree_deep", O_DIRECTORY));
+        for (unsigned i = 0; i < 300; ++i)
+        {
+            dir->mkdirat(name.c_str());
+            ::close(dir->openat("file", O_WRONLY | O_CREAT, 0666));
+            dir.reset(new Path(*dir, name.c_str(), O_DIRECTORY));
+        }
+        dir.reset();
+
+        RmtreeOptions opts;
+        opts.threads = threads;
+        opts.max_open_fds = 1;
+        RmtreeStats stats = rmtree("rmtree_deep", opts);
+        wassert(actual(exists("rmtree_deep")).isfalse());
+        wassert(actual(stats.files) == 300u);
+        wassert(actual(stats.dirs) == 301u);
+    }
+});
+
+add_method("walk", []() {
+    using namespace wobble;
+    rmtree_ifexists("walk");
+    set<string> all;
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        string dir = "a" + to_string(i);
+        makedirs("walk/" + dir + "/sub");
+        all.insert(dir);
+        all.insert(dir + "/sub");
+        for (unsigned j = 0; j < 20; ++j)
+        {
+            string name = dir + "/sub/f" + to_string(j) + (j % 2 ? ".txt" : ".dat");
+            write_file("walk/" + name, "test");
+            all.insert(name);
+        }
+    }
+    makedirs("walk/skip/deep");
+    write_file("walk/skip/deep/file.txt", "");
+    all.insert("skip");
+    all.insert("skip/deep");
+    all.insert("skip/deep/file.txt");
+    // Symlink loop, not followed by default
+    symlink("..", "walk/a0/sub/loop");
+    all.insert("a0/sub/loop");
+
+    std::mutex mutex;
+    set<string> found;
+    auto collect = [&](const WalkEntry& e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        found.insert(string(e.path));
+    };
+
+    WalkOptions opts;
+    opts.threads = 4;
+    opts.max_open_fds = 2;
+    sys::walk("walk", collect, opts);
+    wassert(actual(found == all).istrue());
+
+    // Glob filters and pruning
+    opts.include = str::Glob("*.txt");
+    opts.exclude = str::Glob("a[5-9]");
+    opts.descend = [](const WalkEntry& e) { return e.name != "skip"; };
+    found.clear();
+    sys::walk("walk", collect, opts);
+    wassert(actual(found.size()) == 5u * 10u);
+    for (const auto& name: found)
+        wassert(actual(name).matches("^a[0-4]/sub/f[0-9]+\\.txt$"));
+
+    // Batches, with metadata
+    opts = WalkOptions();
+    opts.threads = 2;
+    opts.include = str::Glob("*.dat");
+    opts.stat_mask = FileInfo::SIZE | FileInfo::TYPE;
+    size_t count = 0;
+    TreeWalker walker("walk", opts);
+    walker.walk_batches([&](const std::vector<WalkEntry>& batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& e: batch)
+        {
+            wassert(actual(e.depth) == 3u);
+            wassert(actual(e.info->isreg()).istrue());
+            wassert(actual(e.info->size()) == 4u);
+            ++count;
+        }
+    });
+    wassert(actual(count) == 100u);
+
+    // Following symlinks does not loop
+    opts = WalkOptions();
+    opts.follow_symlinks = true;
+    found.clear();
+    sys::walk("walk", collect, opts);
+    wassert(actual(found == all).istrue());
+
+    // Errors in callbacks stop the walk
+    wassert_throws(std::runtime_error, sys::walk("walk", [](const WalkEntry&) { throw std::runtime_error("test"); }));
+    wassert_throws(std::system_error, sys::walk("walk/missing", collect));
+
+    rmtree("walk");
+
+    // Paths longer than PATH_MAX, with few open directories allowed
+    std::string name(200, 'l');
+    {
+        makedirs("walk_long");
+        std::unique_ptr<Path> dir(new Path("walk_long", O_DIRECTORY));
+        for (unsigned i = 0; i < 60; ++i)
+        {
+            dir->mkdirat(name.c_str());
+            dir.reset(new Path(*dir, name.c_str(), O_DIRECTORY));
+        }
+        ::close(dir->openat("file", O_WRONLY | O_CREAT, 0666));
+    }
+    for (auto limits: { std::make_pair(8u, 4u), std::make_pair(1u, 1u) })
+    {
+        WOBBLE_TEST_INFO(info);
+        info() << "threads: " << limits.first << ", max_open_fds: " << limits.second;
+        opts = WalkOptions();
+        opts.threads = limits.first;
+        opts.max_open_fds = limits.second;
+        unsigned count = 0;
+        unsigned max_depth = 0;
+        size_t max_path = 0;
+        sys::walk("walk_long", [&](const WalkEntry& e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++count;
+            max_depth = std::max(max_depth, e.depth);
+            max_path = std::max(max_path, e.path.size());
+        }, opts);
+        wassert(actual(count) == 61u);
+        wassert(actual(max_depth) == 61u);
+        wassert(actual(max_path) == 60u * 201u + 4u);
+    }
+    rmtree("walk_long");
+
+    // A directory replaced by a symlink during the walk does not take it
+    // outside the tree, also when opening a path of several components
+    rmtree_ifexists("walk_swap");
+    rmtree_ifexists("walk_outside");
+    makedirs("walk_swap/a/b/c");
+    makedirs("walk_outside/b/c");
+    write_file("walk_outside/b/c/secret", "");
+    opts = WalkOptions();
+    opts.threads = 1;
+    opts.max_open_fds = 1;
+    opts.descend = [](const WalkEntry& e) {
+        if (e.path == "a/b")
+        {
+            sys::rename("walk_swap/a", "walk_swap/a.moved");
+            wassert(actual(symlink("../walk_outside", "walk_swap/a")) == 0);
+        }
+        return true;
+    };
+    std::vector<string> errors;
+    opts.on_error = [&](std::string_view path, const std::system_error&) { errors.emplace_back(path); };
+    found.clear();
+    sys::walk("walk_swap", collect, opts);
+    wassert(actual(found.count("a/b/c")) == 0u);
+    wassert(actual(found.count("a/b/c/secret")) == 0u);
+    wassert(actual(errors.size()) == 1u);
+    wassert(actual(errors[0]) == "a/b");
+    rmtree("walk_swap");
+    rmtree("walk_outside");
+});
+
 add_method("which", []() {
     wassert(actual(which("ls")).endswith("/bin/ls"));
 });
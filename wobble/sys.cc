@@ -3,18 +3,41 @@
 #include <cstddef>
 #include <cstring>
 #include <exception>
-#include <sstream>
 #include <system_error>
 #include <cerrno>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <utime.h>
 #include <alloca.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifndef WOBBLE_HAVE_STATX
+// Without a configure-time check, assume statx(2) is declared from glibc 2.28
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 28))
+#define WOBBLE_HAVE_STATX 1
+#else
+#define WOBBLE_HAVE_STATX 0
+#endif
+#endif
+
+// openat2(2) has no glibc wrapper, and is called with syscall(2)
+#if defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define WOBBLE_HAVE_OPENAT2 1
+#else
+#define WOBBLE_HAVE_OPENAT2 0
+#endif
 
 namespace {
 
@@ -33,109 +56,253 @@ inline const char* to_cstring(const char* s)
 namespace wobble {
 namespace sys {
 
-std::unique_ptr<struct stat> stat(const std::string& pathname)
+/*
+ * FileInfo
+ */
+
+#if WOBBLE_HAVE_STATX
+static_assert(FileInfo::TYPE == STATX_TYPE && FileInfo::MODE == STATX_MODE
+        && FileInfo::NLINK == STATX_NLINK && FileInfo::UID == STATX_UID
+        && FileInfo::GID == STATX_GID && FileInfo::ATIME == STATX_ATIME
+        && FileInfo::MTIME == STATX_MTIME && FileInfo::CTIME == STATX_CTIME
+        && FileInfo::INO == STATX_INO && FileInfo::SIZE == STATX_SIZE
+        && FileInfo::BLOCKS == STATX_BLOCKS && FileInfo::BASIC_STATS == STATX_BASIC_STATS,
+        "FileInfo mask bits differ from statx(2)");
+static_assert(FileInfo::DONT_SYNC == AT_STATX_DONT_SYNC && FileInfo::FORCE_SYNC == AT_STATX_FORCE_SYNC,
+        "FileInfo sync flags differ from statx(2)");
+
+namespace {
+/// Set when statx is not available at runtime (ENOSYS), to skip trying it
+std::atomic<bool> statx_unsupported(false);
+}
+#endif
+
+int FileInfo::load(int dirfd, const char* pathname, unsigned mask, int flags)
 {
-    std::unique_ptr<struct stat> res(new struct stat);
-    if (::stat(pathname.c_str(), res.get()) == -1)
+#if WOBBLE_HAVE_STATX
+    if (!statx_unsupported.load(std::memory_order_relaxed))
     {
-        if (errno == ENOENT)
-            return std::unique_ptr<struct stat>();
-        else
-            throw std::system_error(errno, std::system_category(), "cannot stat " + pathname);
+        struct statx stx;
+        if (::statx(dirfd, pathname, flags, mask, &stx) == 0)
+        {
+            m_exists = true;
+            m_mask = stx.stx_mask;
+            m_mode = stx.stx_mode;
+            m_nlink = stx.stx_nlink;
+            m_uid = stx.stx_uid;
+            m_gid = stx.stx_gid;
+            m_ino = stx.stx_ino;
+            m_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            m_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+            m_size = stx.stx_size;
+            m_blocks = stx.stx_blocks;
+            m_blksize = stx.stx_blksize;
+            m_atim = { (time_t)stx.stx_atime.tv_sec, (long)stx.stx_atime.tv_nsec };
+            m_mtim = { (time_t)stx.stx_mtime.tv_sec, (long)stx.stx_mtime.tv_nsec };
+            m_ctim = { (time_t)stx.stx_ctime.tv_sec, (long)stx.stx_ctime.tv_nsec };
+
+            // Do not expose what the kernel left in fields it did not fill
+            if (!(m_mask & TYPE)) m_mode &= ~S_IFMT;
+            if (!(m_mask & MODE)) m_mode &= S_IFMT;
+            if (!(m_mask & NLINK)) m_nlink = 0;
+            if (!(m_mask & UID)) m_uid = 0;
+            if (!(m_mask & GID)) m_gid = 0;
+            if (!(m_mask & INO)) m_ino = 0;
+            if (!(m_mask & SIZE)) m_size = 0;
+            if (!(m_mask & BLOCKS)) m_blocks = 0;
+            if (!(m_mask & ATIME)) m_atim = { 0, 0 };
+            if (!(m_mask & MTIME)) m_mtim = { 0, 0 };
+            if (!(m_mask & CTIME)) m_ctim = { 0, 0 };
+            return 0;
+        }
+        if (errno != ENOSYS)
+        {
+            *this = FileInfo();
+            return errno;
+        }
+        statx_unsupported.store(true, std::memory_order_relaxed);
     }
+#else
+    // fstatat always fills all the basic fields
+    (void)mask;
+#endif
+
+    // fstatat does not know about the statx sync flags
+    struct stat st;
+    if (::fstatat(dirfd, pathname, &st, flags & ~(DONT_SYNC | FORCE_SYNC)) == -1)
+    {
+        *this = FileInfo();
+        return errno;
+    }
+    m_exists = true;
+    m_mask = BASIC_STATS;
+    m_mode = st.st_mode;
+    m_nlink = st.st_nlink;
+    m_uid = st.st_uid;
+    m_gid = st.st_gid;
+    m_ino = st.st_ino;
+    m_dev = st.st_dev;
+    m_rdev = st.st_rdev;
+    m_size = st.st_size;
+    m_blocks = st.st_blocks;
+    m_blksize = st.st_blksize;
+    m_atim = st.st_atim;
+    m_mtim = st.st_mtim;
+    m_ctim = st.st_ctim;
+    return 0;
+}
+
+FileInfo::FileInfo(const std::string& pathname, unsigned mask, int flags)
+{
+    stat_ifexists(pathname.c_str(), mask, flags);
+}
+
+void FileInfo::stat(const char* pathname, unsigned mask, int flags)
+{
+    if (int e = load(AT_FDCWD, pathname, mask, flags))
+        throw std::system_error(e, std::system_category(), std::string("cannot stat ") + pathname);
+}
+
+bool FileInfo::stat_ifexists(const char* pathname, unsigned mask, int flags)
+{
+    return statat_ifexists(AT_FDCWD, pathname, mask, flags);
+}
+
+void FileInfo::statat(int dirfd, const char* pathname, unsigned mask, int flags)
+{
+    if (int e = load(dirfd, pathname, mask, flags))
+        throw std::system_error(e, std::system_category(), std::string("cannot stat ") + pathname);
+}
+
+bool FileInfo::statat_ifexists(int dirfd, const char* pathname, unsigned mask, int flags)
+{
+    int e = load(dirfd, pathname, mask, flags);
+    if (e == 0)
+        return true;
+    if (e == ENOENT)
+        return false;
+    throw std::system_error(e, std::system_category(), std::string("cannot stat ") + pathname);
+}
+
+void FileInfo::fstat(int fd, unsigned mask)
+{
+    if (int e = load(fd, "", mask, AT_EMPTY_PATH))
+        throw std::system_error(e, std::system_category(), "cannot fstat file descriptor " + std::to_string(fd));
+}
+
+void FileInfo::to_stat(struct stat& st) const
+{
+    memset(&st, 0, sizeof(st));
+    st.st_mode = m_mode;
+    st.st_nlink = m_nlink;
+    st.st_uid = m_uid;
+    st.st_gid = m_gid;
+    st.st_ino = m_ino;
+    st.st_dev = m_dev;
+    st.st_rdev = m_rdev;
+    st.st_size = m_size;
+    st.st_blocks = m_blocks;
+    st.st_blksize = m_blksize;
+    st.st_atim = m_atim;
+    st.st_mtim = m_mtim;
+    st.st_ctim = m_ctim;
+}
+
+std::unique_ptr<struct stat> stat(const std::string& pathname)
+{
+    FileInfo info(pathname);
+    if (!info.exists())
+        return std::unique_ptr<struct stat>();
+    std::unique_ptr<struct stat> res(new struct stat);
+    info.to_stat(*res);
     return res;
 }
 
 void stat(const std::string& pathname, struct stat& st)
 {
-    if (::stat(pathname.c_str(), &st) == -1)
-        throw std::system_error(errno, std::system_category(), "cannot stat " + pathname);
+    FileInfo info;
+    info.stat(pathname.c_str());
+    info.to_stat(st);
 }
 
 #define common_stat_body(testfunc) \
-    struct stat st; \
-    if (::stat(pathname.c_str(), &st) == -1) { \
-        if (errno == ENOENT) \
-            return false; \
-        else \
-            throw std::system_error(errno, std::system_category(), "cannot stat " + pathname); \
-    } \
-    return testfunc(st.st_mode)
+    FileInfo info; \
+    return info.stat_ifexists(pathname.c_str(), FileInfo::TYPE) && info.testfunc()
 
 bool isdir(const std::string& pathname)
 {
-    common_stat_body(S_ISDIR);
+    common_stat_body(isdir);
 }
 
 bool isblk(const std::string& pathname)
 {
-    common_stat_body(S_ISBLK);
+    common_stat_body(isblk);
 }
 
 bool ischr(const std::string& pathname)
 {
-    common_stat_body(S_ISCHR);
+    common_stat_body(ischr);
 }
 
 bool isfifo(const std::string& pathname)
 {
-    common_stat_body(S_ISFIFO);
+    common_stat_body(isfifo);
 }
 
 bool islnk(const std::string& pathname)
 {
-    common_stat_body(S_ISLNK);
+    common_stat_body(islnk);
 }
 
 bool isreg(const std::string& pathname)
 {
-    common_stat_body(S_ISREG);
+    common_stat_body(isreg);
 }
 
 bool issock(const std::string& pathname)
 {
-    common_stat_body(S_ISSOCK);
+    common_stat_body(issock);
 }
 
 #undef common_stat_body
 
 time_t timestamp(const std::string& file)
 {
-    struct stat st;
-    stat(file, st);
-    return st.st_mtime;
+    FileInfo info;
+    info.stat(file.c_str(), FileInfo::MTIME);
+    return info.mtime();
 }
 
 time_t timestamp(const std::string& file, time_t def)
 {
-    auto st = sys::stat(file);
-    return st.get() ? st->st_mtime : def;
+    FileInfo info;
+    return info.stat_ifexists(file.c_str(), FileInfo::MTIME) ? info.mtime() : def;
 }
 
 size_t size(const std::string& file)
 {
-    struct stat st;
-    stat(file, st);
-    return (size_t)st.st_size;
+    FileInfo info;
+    info.stat(file.c_str(), FileInfo::SIZE);
+    return info.size();
 }
 
 size_t size(const std::string& file, size_t def)
 {
-    auto st = sys::stat(file);
-    return st.get() ? (size_t)st->st_size : def;
+    FileInfo info;
+    return info.stat_ifexists(file.c_str(), FileInfo::SIZE) ? info.size() : def;
 }
 
 ino_t inode(const std::string& file)
 {
-    struct stat st;
-    stat(file, st);
-    return st.st_ino;
+    FileInfo info;
+    info.stat(file.c_str(), FileInfo::INO);
+    return info.inode();
 }
 
 ino_t inode(const std::string& file, ino_t def)
 {
-    auto st = sys::stat(file);
-    return st.get() ? st->st_ino : def;
+    FileInfo info;
+    return info.stat_ifexists(file.c_str(), FileInfo::INO) ? info.inode() : def;
 }
 
 
@@ -186,10 +353,25 @@ mode_t umask(mode_t mask)
 
 std::string abspath(const std::string& pathname)
 {
-    if (pathname[0] == '/')
-        return str::normpath(pathname);
-    else
-        return str::normpath(str::joinpath(sys::getcwd(), pathname));
+    str::PathBuffer res(pathname);
+    abspath(res);
+    return res.str();
+}
+
+void abspath(str::PathBuffer& path)
+{
+    if (!path.empty() && path.c_str()[0] == '/')
+    {
+        path.normalize();
+        return;
+    }
+
+    path.make_absolute(sys::getcwd());
+}
+
+void abspath(str::PathBuffer& path, std::string_view cwd)
+{
+    path.make_absolute(cwd);
 }
 
 
@@ -228,9 +410,12 @@ MMap::~MMap()
 
 void MMap::munmap()
 {
+    if (addr == MAP_FAILED)
+        return;
     if (::munmap(addr, length) == -1)
         throw std::system_error(errno, std::system_category(), "cannot unmap memory");
     addr = MAP_FAILED;
+    length = 0;
 }
 
 
@@ -692,15 +877,15 @@ Path::iterator::iterator()
 }
 
 Path::iterator::iterator(Path& dir)
-    : path(&dir)
+    : path(&dir), dir(new DirReader(dir)), cur_entry(new struct dirent)
 {
-    this->dir = dir.fdopendir();
     operator++();
 }
 
+Path::iterator::iterator(iterator&& o) = default;
+
 Path::iterator::~iterator()
 {
-    if (dir) closedir(dir);
 }
 
 bool Path::iterator::operator==(const iterator& i) const
@@ -718,18 +903,19 @@ bool Path::iterator::operator!=(const iterator& i) const
 
 void Path::iterator::operator++()
 {
-    errno = 0;
-    cur_entry = readdir(dir);
-    if (cur_entry == nullptr)
+    DirEntry entry;
+    if (!dir->next(entry))
     {
-        if (errno) path->throw_error("cannot readdir");
-
         // Turn into an end iterator
-        free(cur_entry);
-        cur_entry = nullptr;
-        closedir(dir);
-        dir = nullptr;
+        cur_entry.reset();
+        dir.reset();
+        return;
     }
+    cur_entry->d_ino = entry.ino;
+    cur_entry->d_off = 0;
+    cur_entry->d_reclen = sizeof(struct dirent);
+    cur_entry->d_type = entry.type;
+    memcpy(cur_entry->d_name, entry.name.data(), entry.name.size() + 1);
 }
 
 bool Path::iterator::isdir() const
@@ -741,9 +927,9 @@ bool Path::iterator::isdir() const
         return false;
 #endif
     // No d_type, we'll need to stat
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISDIR(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.isdir();
 }
 
 bool Path::iterator::isblk() const
@@ -755,9 +941,9 @@ bool Path::iterator::isblk() const
         return false;
 #endif
     // No d_type, we'll need to stat
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISBLK(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.isblk();
 }
 
 bool Path::iterator::ischr() const
@@ -769,9 +955,9 @@ bool Path::iterator::ischr() const
         return false;
 #endif
     // No d_type, we'll need to stat
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISCHR(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.ischr();
 }
 
 bool Path::iterator::isfifo() const
@@ -783,9 +969,9 @@ bool Path::iterator::isfifo() const
         return false;
 #endif
     // No d_type, we'll need to stat
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISFIFO(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.isfifo();
 }
 
 bool Path::iterator::islnk() const
@@ -796,9 +982,9 @@ bool Path::iterator::islnk() const
     if (cur_entry->d_type != DT_UNKNOWN)
         return false;
 #endif
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISLNK(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.islnk();
 }
 
 bool Path::iterator::isreg() const
@@ -809,9 +995,9 @@ bool Path::iterator::isreg() const
     if (cur_entry->d_type != DT_UNKNOWN)
         return false;
 #endif
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISREG(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.isreg();
 }
 
 bool Path::iterator::issock() const
@@ -822,9 +1008,9 @@ bool Path::iterator::issock() const
     if (cur_entry->d_type != DT_UNKNOWN)
         return false;
 #endif
-    struct stat st;
-    path->fstatat(cur_entry->d_name, st);
-    return S_ISSOCK(st.st_mode);
+    FileInfo info;
+    info.statat(*path, cur_entry->d_name, FileInfo::TYPE);
+    return info.issock();
 }
 
 Path Path::iterator::open_path(int flags) const
@@ -833,23 +1019,6 @@ Path Path::iterator::open_path(int flags) const
 }
 
 
-void Path::rmtree()
-{
-    for (auto i = begin(); i != end(); ++i)
-    {
-        if (strcmp(i->d_name, ".") == 0 || strcmp(i->d_name, "..") == 0) continue;
-        if (i.isdir())
-        {
-            Path sub(*this, i->d_name);
-            sub.rmtree();
-        }
-        else
-            unlinkat(i->d_name);
-    }
-    // TODO: is there a way to do this using fd instead?
-    rmdir(name());
-}
-
 std::string Path::mkdtemp(const std::string& prefix)
 {
     char* fbuf = (char*)alloca(prefix.size() + 7);
@@ -874,6 +1043,1097 @@ std::string Path::mkdtemp(char* pathname_template)
     throw std::system_error(errno, std::system_category(), std::string("mkdtemp failed on ") + pathname_template);
 }
 
+
+/*
+ * DirReader
+ */
+
+namespace {
+
+/**
+ * Fixed header of the records returned by getdents64.
+ *
+ * The 0-terminated name follows d_type, and starts before the end of the
+ * structure because of its tail padding
+ */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+};
+
+/// Offset of the name in a getdents64 record
+constexpr size_t linux_dirent64_name_offset = offsetof(linux_dirent64, d_type) + 1;
+
+}
+
+DirReader::DirReader(Path& dir, size_t buffer_size)
+    : fd(dir.openat(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC), dir.name()),
+      buf(new char[buffer_size]), buf_size(buffer_size)
+{
+}
+
+DirReader::DirReader(const std::string& pathname, size_t buffer_size)
+    : fd(::open(pathname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), pathname),
+      buf(new char[buffer_size]), buf_size(buffer_size)
+{
+    if (fd == -1)
+        fd.throw_error("cannot open directory");
+}
+
+DirReader::DirReader(int dirfd, const std::string& pathname, size_t buffer_size)
+    : fd(dirfd, pathname), owned(false), buf(new char[buffer_size]), buf_size(buffer_size)
+{
+}
+
+DirReader::~DirReader()
+{
+    if (owned && fd != -1)
+        ::close(fd);
+}
+
+void DirReader::reset(int dirfd, const std::string& pathname)
+{
+    if (owned && fd != -1)
+        ::close(fd);
+    fd = NamedFileDescriptor(dirfd, pathname);
+    owned = false;
+    buf_len = 0;
+    buf_pos = 0;
+    at_end = false;
+}
+
+bool DirReader::fill()
+{
+    if (at_end)
+        return false;
+    long res = syscall(SYS_getdents64, (int)fd, buf.get(), buf_size);
+    if (res == -1)
+        fd.throw_error("cannot read directory entries");
+    buf_len = res;
+    buf_pos = 0;
+    if (res == 0)
+    {
+        at_end = true;
+        return false;
+    }
+    return true;
+}
+
+bool DirReader::next(DirEntry& entry)
+{
+    if (buf_pos == buf_len && !fill())
+        return false;
+    const char* rec = buf.get() + buf_pos;
+    // Records are 8-byte aligned and at least as long as the header
+    linux_dirent64 header;
+    memcpy(&header, rec, sizeof(header));
+    buf_pos += header.d_reclen;
+    entry.name = rec + linux_dirent64_name_offset;
+    entry.ino = header.d_ino;
+    entry.type = header.d_type;
+    return true;
+}
+
+bool DirReader::read_batch(std::vector<DirEntry>& out)
+{
+    out.clear();
+    while (out.empty())
+    {
+        if (buf_pos == buf_len && !fill())
+            return false;
+        DirEntry entry;
+        while (buf_pos < buf_len)
+        {
+            next(entry);
+            if (!entry.is_dots())
+                out.emplace_back(entry);
+        }
+    }
+    return true;
+}
+
+void DirReader::resolve_types(std::vector<DirEntry>& entries, int flags)
+{
+    std::vector<DirEntry*> unknown;
+    for (auto& e: entries)
+        if (e.type == DT_UNKNOWN)
+            unknown.emplace_back(&e);
+    if (unknown.empty())
+        return;
+
+    std::sort(unknown.begin(), unknown.end(), [](const DirEntry* a, const DirEntry* b) { return a->ino < b->ino; });
+
+    FileInfo info;
+    for (auto e: unknown)
+        if (info.statat_ifexists(fd, e->name.data(), FileInfo::TYPE, flags))
+            e->type = IFTODT(info.mode());
+}
+
+/*
+ * rmtree
+ */
+
+namespace {
+
+/// Directory being deleted by TreeRemover
+struct RmtreeDir
+{
+    std::shared_ptr<RmtreeDir> parent;
+    /// Name in the parent directory
+    std::string name;
+    /// File descriptor, or -1 if it is currently closed
+    int fd = -1;
+    /// Number of operations currently using fd
+    unsigned fd_users = 0;
+    /// Scans, file batches and subdirectories not yet done
+    std::atomic<size_t> pending{1};
+
+    RmtreeDir(std::shared_ptr<RmtreeDir> parent, std::string_view name)
+        : parent(std::move(parent)), name(name) {}
+    RmtreeDir(const RmtreeDir&) = delete;
+    RmtreeDir& operator=(const RmtreeDir&) = delete;
+    ~RmtreeDir()
+    {
+        if (fd != -1) ::close(fd);
+    }
+
+    std::string path() const
+    {
+        if (!parent) return name;
+        return parent->path() + "/" + name;
+    }
+};
+
+/// Names of files to unlink in a directory, handed over to another thread
+struct RmtreeFiles
+{
+    str::Arena arena;
+    std::vector<std::string_view> names;
+};
+
+/// Buffers reused by a thread across the directories it scans
+struct RmtreeBuffers
+{
+    DirReader reader{-1, std::string()};
+    std::vector<DirEntry> entries;
+    std::vector<std::string_view> files;
+    std::vector<std::string_view> subdirs;
+};
+
+struct RmtreeTask
+{
+    std::shared_ptr<RmtreeDir> dir;
+    /**
+     * If set, unlink these files, else scan dir. A task with files keeps the
+     * file descriptor of dir in use until it runs
+     */
+    std::unique_ptr<RmtreeFiles> files;
+};
+
+/**
+ * Delete a directory tree with a pool of threads.
+ *
+ * Each directory has a count of pending work (its own scan, file batches
+ * handed over to other threads, and subdirectories): the one that brings it
+ * to zero deletes the directory and decrements the count of its parent.
+ */
+class TreeRemover
+{
+    /// Minimum number of files in a batch handed over to another thread
+    static const size_t handover_size = 128;
+
+    const RmtreeOptions& opts;
+    unsigned max_threads;
+    unsigned max_open_fds;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<RmtreeTask> tasks;
+    std::vector<std::thread> threads;
+    unsigned idle = 0;
+    bool stop = false;
+    std::exception_ptr error;
+    /// Directory file descriptors currently open, not counting the root's parent
+    unsigned open_fds = 0;
+
+    std::atomic<size_t> count_files{0};
+    std::atomic<size_t> count_dirs{0};
+    std::mutex progress_mutex;
+    std::atomic<size_t> next_progress;
+
+    RmtreeStats stats() const
+    {
+        RmtreeStats res;
+        res.files = count_files.load();
+        res.dirs = count_dirs.load();
+        return res;
+    }
+
+    void notify_progress()
+    {
+        if (!opts.progress) return;
+        size_t total = count_files.load(std::memory_order_relaxed) + count_dirs.load(std::memory_order_relaxed);
+        if (total < next_progress.load(std::memory_order_relaxed)) return;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        if (total < next_progress.load(std::memory_order_relaxed)) return;
+        next_progress.store(total + opts.progress_interval, std::memory_order_relaxed);
+        opts.progress(stats());
+    }
+
+    /// Get a file descriptor for dir, reopening it if needed. Call with mutex held
+    int acquire_fd(RmtreeDir& dir)
+    {
+        if (dir.fd == -1)
+        {
+            int parent_fd = acquire_fd(*dir.parent);
+            int fd = ::openat(parent_fd, dir.name.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd == -1)
+            {
+                int e = errno;
+                release_fd(*dir.parent);
+                throw std::system_error(e, std::system_category(), "cannot reopen directory " + dir.path());
+            }
+            // Count the new descriptor first, so that going over the limit
+            // closes the parent and not the directory about to be used
+            dir.fd = fd;
+            ++open_fds;
+            release_fd(*dir.parent);
+        }
+        ++dir.fd_users;
+        return dir.fd;
+    }
+
+    /// Stop using the file descriptor of dir. Call with mutex held
+    void release_fd(RmtreeDir& dir)
+    {
+        if (--dir.fd_users == 0 && open_fds > max_open_fds && dir.parent)
+        {
+            ::close(dir.fd);
+            dir.fd = -1;
+            --open_fds;
+        }
+    }
+
+    /// Queue tasks, starting a new thread if there is enough work. Call with mutex held
+    void push(RmtreeTask&& task)
+    {
+        tasks.emplace_back(std::move(task));
+        if (idle)
+            cond.notify_one();
+        else if (tasks.size() > 4 && threads.size() + 1 < max_threads && !stop)
+            threads.emplace_back([this] { worker(); });
+    }
+
+    /// Check if handing over work to another thread would help
+    bool can_hand_over()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return idle || threads.size() + 1 < max_threads;
+    }
+
+    void add_subdirs(const std::shared_ptr<RmtreeDir>& dir, std::vector<std::string_view>& names)
+    {
+        if (names.empty()) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        dir->pending += names.size();
+        for (auto name: names)
+            push(RmtreeTask{std::make_shared<RmtreeDir>(dir, name), nullptr});
+        names.clear();
+    }
+
+    /**
+     * Unlink files in dir, adding to subdirs the names that turn out to be
+     * directories
+     */
+    void unlink_files(RmtreeDir& dir, int fd, const std::vector<std::string_view>& names, std::vector<std::string_view>& subdirs)
+    {
+        for (auto name: names)
+        {
+            // Names are views into a 0-terminated buffer
+            if (::unlinkat(fd, name.data(), 0) == 0)
+                ++count_files;
+            else if (errno == EISDIR)
+                // DT_UNKNOWN entry that is a directory
+                subdirs.emplace_back(name);
+            else if (errno != ENOENT)
+                throw std::system_error(errno, std::system_category(), "cannot unlink " + dir.path() + "/" + std::string(name));
+        }
+        notify_progress();
+    }
+
+    /**
+     * Get a file descriptor for the parent of dir. If it is closed, reopen it
+     * as ".." of dir when possible, instead of walking down from the nearest
+     * open ancestor. Call with mutex held
+     */
+    int acquire_parent_fd(RmtreeDir& dir)
+    {
+        RmtreeDir& parent = *dir.parent;
+        if (parent.fd == -1 && dir.fd != -1)
+        {
+            int fd = ::openat(dir.fd, "..", O_PATH | O_DIRECTORY | O_CLOEXEC);
+            if (fd == -1)
+                throw std::system_error(errno, std::system_category(), "cannot reopen directory " + parent.path());
+            parent.fd = fd;
+            ++open_fds;
+        }
+        return acquire_fd(parent);
+    }
+
+    /**
+     * Mark one pending operation on dir as done, deleting it if it was the
+     * last one.
+     *
+     * If holding_fd is true, the caller is using the file descriptor of dir,
+     * and this releases it.
+     */
+    void done(std::shared_ptr<RmtreeDir> dir, bool holding_fd)
+    {
+        while (true)
+        {
+            int parent_fd;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (dir->pending.fetch_sub(1) != 1)
+                {
+                    if (holding_fd)
+                        release_fd(*dir);
+                    return;
+                }
+                // Nobody else is using dir: its descriptor is only needed
+                // to reopen the parent
+                parent_fd = acquire_parent_fd(*dir);
+                if (dir->fd != -1)
+                {
+                    ::close(dir->fd);
+                    dir->fd = -1;
+                    --open_fds;
+                }
+                dir->fd_users = 0;
+            }
+            int res = ::unlinkat(parent_fd, dir->name.c_str(), AT_REMOVEDIR);
+            if (res == -1 && errno != ENOENT)
+            {
+                int e = errno;
+                std::lock_guard<std::mutex> lock(mutex);
+                release_fd(*dir->parent);
+                throw std::system_error(e, std::system_category(), "cannot remove directory " + dir->path());
+            }
+            ++count_dirs;
+            notify_progress();
+
+            if (!dir->parent->parent)
+            {
+                // This was the root: we are done
+                std::lock_guard<std::mutex> lock(mutex);
+                release_fd(*dir->parent);
+                stop = true;
+                cond.notify_all();
+                return;
+            }
+            // Keep using the parent descriptor for the next iteration
+            dir = dir->parent;
+            holding_fd = true;
+        }
+    }
+
+    void scan(const std::shared_ptr<RmtreeDir>& dir, RmtreeBuffers& buffers)
+    {
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (dir->fd == -1)
+            {
+                int parent_fd = acquire_fd(*dir->parent);
+                lock.unlock();
+                fd = ::openat(parent_fd, dir->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                int e = errno;
+                lock.lock();
+                if (fd != -1)
+                {
+                    // As in acquire_fd, let the limit close the parent
+                    dir->fd = fd;
+                    ++open_fds;
+                }
+                release_fd(*dir->parent);
+                if (fd == -1 && e == ENOENT)
+                {
+                    // Deleted in the meantime
+                    lock.unlock();
+                    done(dir, false);
+                    return;
+                }
+                if (fd == -1)
+                    throw std::system_error(e, std::system_category(), "cannot open directory " + dir->path());
+            }
+            else
+                fd = dir->fd;
+            ++dir->fd_users;
+        }
+
+        DirReader& reader = buffers.reader;
+        reader.reset(fd, dir->name);
+        std::vector<DirEntry>& entries = buffers.entries;
+        std::vector<std::string_view>& files = buffers.files;
+        std::vector<std::string_view>& subdirs = buffers.subdirs;
+        subdirs.clear();
+        while (true)
+        {
+            try {
+                if (!reader.read_batch(entries))
+                    break;
+            } catch (std::system_error& e) {
+                throw std::system_error(e.code(), "cannot read directory " + dir->path());
+            }
+            files.clear();
+            for (const auto& e: entries)
+                if (e.type == DT_DIR)
+                    subdirs.emplace_back(e.name);
+                else
+                    files.emplace_back(e.name);
+
+            if (files.size() >= handover_size && can_hand_over())
+            {
+                std::unique_ptr<RmtreeFiles> batch(new RmtreeFiles);
+                batch->names.reserve(files.size());
+                for (auto name: files)
+                    batch->names.emplace_back(batch->arena.store(name));
+                std::lock_guard<std::mutex> lock(mutex);
+                ++dir->pending;
+                ++dir->fd_users;
+                push(RmtreeTask{dir, std::move(batch)});
+            } else
+                unlink_files(*dir, fd, files, subdirs);
+
+            add_subdirs(dir, subdirs);
+        }
+
+        done(dir, true);
+    }
+
+    void unlink_batch(const std::shared_ptr<RmtreeDir>& dir, const RmtreeFiles& files)
+    {
+        // The descriptor was kept open when the batch was queued
+        int fd = dir->fd;
+        std::vector<std::string_view> subdirs;
+        unlink_files(*dir, fd, files.names, subdirs);
+        add_subdirs(dir, subdirs);
+        done(dir, true);
+    }
+
+    void worker()
+    {
+        RmtreeBuffers buffers;
+        while (true)
+        {
+            RmtreeTask task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ++idle;
+                cond.wait(lock, [this] { return stop || !tasks.empty(); });
+                --idle;
+                if (stop) return;
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            }
+
+            try {
+                if (task.files)
+                    unlink_batch(task.dir, *task.files);
+                else
+                    scan(task.dir, buffers);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                stop = true;
+                tasks.clear();
+                cond.notify_all();
+                return;
+            }
+        }
+    }
+
+public:
+    explicit TreeRemover(const RmtreeOptions& opts)
+        : opts(opts), next_progress(opts.progress_interval)
+    {
+        max_threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+        // The directory being scanned needs to stay open for its
+        // subdirectories, or each of them would reopen all its ancestors
+        max_open_fds = std::max(1u, opts.max_open_fds);
+    }
+
+    RmtreeStats run(Path& path)
+    {
+        // Delete the root relative to its parent directory
+        std::string_view name = path.name();
+        while (name.size() > 1 && name.back() == '/')
+            name.remove_suffix(1);
+        auto parent = std::make_shared<RmtreeDir>(nullptr, str::dirname_view(name));
+        parent->fd = ::open(parent->name.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (parent->fd == -1)
+            throw std::system_error(errno, std::system_category(), "cannot open directory " + parent->name);
+        // Never close it before the end
+        parent->fd_users = 1;
+
+        auto root = std::make_shared<RmtreeDir>(parent, str::basename_view(name));
+        root->fd = path.openat(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        open_fds = 1;
+        tasks.emplace_back(RmtreeTask{root, nullptr});
+        root.reset();
+
+        // The calling thread is also a worker
+        worker();
+
+        std::vector<std::thread> started;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            cond.notify_all();
+            started = std::move(threads);
+        }
+        for (auto& t: started)
+            t.join();
+        tasks.clear();
+
+        if (error)
+            std::rethrow_exception(error);
+
+        RmtreeStats res = stats();
+        if (opts.progress)
+            opts.progress(res);
+        return res;
+    }
+};
+
+}
+
+void Path::rmtree()
+{
+    rmtree(RmtreeOptions());
+}
+
+RmtreeStats Path::rmtree(const RmtreeOptions& opts)
+{
+    TreeRemover remover(opts);
+    return remover.run(*this);
+}
+
+/*
+ * TreeWalker
+ */
+
+namespace {
+
+/// Directory visited by TreeWalkerRun
+struct WalkDir
+{
+    std::shared_ptr<WalkDir> parent;
+    /// Path relative to the root, empty for the root
+    std::string path;
+    unsigned depth;
+    /**
+     * Ancestor that this is opened relative to, or nullptr for the root
+     * directory file descriptor. Its fd is kept open until this directory
+     * has been visited
+     */
+    WalkDir* base;
+    /// Open file descriptor, kept while subdirectories still need to open relative to it
+    int fd = -1;
+    /**
+     * Operations that still need fd: the visit of this directory, and visits
+     * of directories that have this as base
+     */
+    std::atomic<size_t> fd_users{1};
+    /// Device and inode, used to detect loops when following symlinks
+    dev_t dev = 0;
+    ino_t ino = 0;
+
+    WalkDir(std::shared_ptr<WalkDir> parent, std::string path, unsigned depth, WalkDir* base)
+        : parent(std::move(parent)), path(std::move(path)), depth(depth), base(base) {}
+    WalkDir(const WalkDir&) = delete;
+    WalkDir& operator=(const WalkDir&) = delete;
+    ~WalkDir()
+    {
+        if (fd != -1) ::close(fd);
+    }
+
+    /// Path relative to base
+    const char* base_path() const
+    {
+        if (!base || base->path.empty())
+            return path.c_str();
+        return path.c_str() + base->path.size() + 1;
+    }
+};
+
+/// Buffers reused by a thread across the directories it visits
+struct WalkBuffers
+{
+    DirReader reader{-1, std::string()};
+    std::vector<DirEntry> entries;
+    std::vector<DirEntry*> links;
+    std::vector<unsigned char> follow;
+    std::vector<FileInfo> infos;
+    std::vector<unsigned> order;
+    std::vector<WalkEntry> batch;
+    str::Arena paths{16384};
+    std::string prefix;
+};
+
+#if WOBBLE_HAVE_OPENAT2
+/// Set when openat2 is not available at runtime (ENOSYS), to skip trying it
+std::atomic<bool> openat2_unsupported(false);
+#endif
+
+/**
+ * Open pathname relative to dirfd, failing if any of its components is a
+ * symbolic link, and not only the last one as with O_NOFOLLOW
+ */
+int openat_nofollow(int dirfd, const char* pathname, int flags)
+{
+#if WOBBLE_HAVE_OPENAT2
+    if (!openat2_unsupported.load(std::memory_order_relaxed))
+    {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags;
+        how.resolve = RESOLVE_NO_SYMLINKS | RESOLVE_BENEATH;
+        int fd = syscall(SYS_openat2, dirfd, pathname, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS)
+            return fd;
+        openat2_unsupported.store(true, std::memory_order_relaxed);
+    }
+#endif
+
+    // Open one component at a time
+    std::string path(pathname);
+    int cur = dirfd;
+    size_t start = 0;
+    for (size_t end; (end = path.find('/', start)) != std::string::npos; start = end + 1)
+    {
+        path[end] = 0;
+        int fd = ::openat(cur, path.c_str() + start, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int e = errno;
+        if (cur != dirfd) ::close(cur);
+        if (fd == -1)
+        {
+            errno = e;
+            return -1;
+        }
+        cur = fd;
+    }
+    int fd = ::openat(cur, path.c_str() + start, flags | O_NOFOLLOW);
+    int e = errno;
+    if (cur != dirfd) ::close(cur);
+    errno = e;
+    return fd;
+}
+
+/// Work queue of one thread
+struct WalkQueue
+{
+    std::mutex mutex;
+    std::deque<std::shared_ptr<WalkDir>> dirs;
+};
+
+class TreeWalkerRun
+{
+    /**
+     * Longest path used to open a directory relative to an ancestor: past
+     * it, the parent is kept open instead even if it exceeds max_open_fds
+     */
+    static const size_t max_base_path = 2048;
+
+    const WalkOptions& opts;
+    std::function<void(const std::vector<WalkEntry>&)> dest;
+    unsigned max_threads;
+    /// Root directory, for opening directories relative to it
+    int root_fd = -1;
+    std::string root_name;
+
+    std::vector<std::unique_ptr<WalkQueue>> queues;
+    /// Directories in queues
+    std::atomic<size_t> queued{0};
+    /// Directories in queues or being visited
+    std::atomic<size_t> outstanding{0};
+    std::atomic<unsigned> open_fds{0};
+    std::atomic<bool> stop{false};
+
+    /// Protects the members below, and is used to wait for work
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::thread> threads;
+    unsigned idle = 0;
+    std::exception_ptr error;
+
+    void push(unsigned self, std::shared_ptr<WalkDir>&& dir)
+    {
+        ++outstanding;
+        ++queued;
+        size_t size;
+        {
+            WalkQueue& queue = *queues[self];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.dirs.emplace_back(std::move(dir));
+            size = queue.dirs.size();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle)
+            cond.notify_one();
+        else if (size > 2 && threads.size() + 1 < max_threads && !stop)
+        {
+            unsigned idx = threads.size() + 1;
+            threads.emplace_back([this, idx] { worker(idx); });
+        }
+    }
+
+    /// Take a directory from our queue, or steal one from another queue
+    std::shared_ptr<WalkDir> pop(unsigned self)
+    {
+        std::shared_ptr<WalkDir> res;
+        {
+            WalkQueue& queue = *queues[self];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.dirs.empty())
+            {
+                res = std::move(queue.dirs.back());
+                queue.dirs.pop_back();
+            }
+        }
+        for (unsigned i = 1; !res && i < queues.size(); ++i)
+        {
+            // Steal from the other end, which has directories closer to the
+            // root and likely more work under them
+            WalkQueue& queue = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.dirs.empty())
+            {
+                res = std::move(queue.dirs.front());
+                queue.dirs.pop_front();
+            }
+        }
+        if (res)
+            --queued;
+        return res;
+    }
+
+    /// Stop using the file descriptor of dir
+    void release_fd(WalkDir& dir)
+    {
+        if (dir.fd_users.fetch_sub(1) == 1 && dir.fd != -1)
+        {
+            ::close(dir.fd);
+            dir.fd = -1;
+            --open_fds;
+        }
+    }
+
+    /// Open dir, returning false if it should be skipped
+    bool open(WalkDir& dir)
+    {
+        int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        if (!opts.follow_symlinks)
+            flags |= O_NOFOLLOW;
+
+        int base_fd = dir.base ? dir.base->fd : root_fd;
+        const char* path = dir.base_path();
+        int fd;
+        if (opts.follow_symlinks || !strchr(path, '/'))
+            fd = ::openat(base_fd, path, flags);
+        else
+            // Do not let a directory replaced by a symlink in the middle of
+            // path take the walk outside the tree
+            fd = openat_nofollow(base_fd, path, flags);
+        if (fd == -1)
+        {
+            if (errno == ENOENT)
+                return false;
+            throw std::system_error(errno, std::system_category(), "cannot open directory " + root_name + "/" + dir.path);
+        }
+        dir.fd = fd;
+        ++open_fds;
+
+        if (opts.follow_symlinks)
+        {
+            FileInfo info;
+            info.fstat(fd, FileInfo::INO);
+            dir.dev = info.dev();
+            dir.ino = info.inode();
+            for (const WalkDir* a = dir.parent.get(); a; a = a->parent.get())
+                if (a->dev == dir.dev && a->ino == dir.ino)
+                    return false;
+        }
+        return true;
+    }
+
+    void visit(unsigned self, const std::shared_ptr<WalkDir>& dir, WalkBuffers& buffers)
+    {
+        if (dir->depth > 0)
+        {
+            try {
+                if (!open(*dir))
+                {
+                    release_visit(*dir);
+                    return;
+                }
+            } catch (std::system_error& e) {
+                if (!opts.on_error) throw;
+                opts.on_error(dir->path, e);
+                release_visit(*dir);
+                return;
+            }
+        }
+
+        DirReader& reader = buffers.reader;
+        reader.reset(dir->fd, root_name + "/" + dir->path);
+        std::vector<DirEntry>& entries = buffers.entries;
+        std::vector<DirEntry*>& links = buffers.links;
+        std::vector<unsigned char>& follow = buffers.follow;
+        std::vector<FileInfo>& infos = buffers.infos;
+        std::vector<unsigned>& order = buffers.order;
+        std::vector<WalkEntry>& batch = buffers.batch;
+        str::Arena& paths = buffers.paths;
+        std::string& prefix = buffers.prefix;
+        prefix.assign(dir->path);
+        if (!prefix.empty())
+            prefix += '/';
+
+        while (!stop)
+        {
+            try {
+                if (!reader.read_batch(entries))
+                    break;
+            } catch (std::system_error& e) {
+                if (!opts.on_error) throw;
+                opts.on_error(dir->path, e);
+                break;
+            }
+
+            if (!opts.exclude.empty())
+                entries.erase(std::remove_if(entries.begin(), entries.end(),
+                            [&](const DirEntry& e) { return opts.exclude.match(e.name); }), entries.end());
+
+            reader.resolve_types(entries);
+
+            // Find out which symlinks point to directories
+            follow.assign(entries.size(), 0);
+            if (opts.follow_symlinks)
+            {
+                links.clear();
+                for (auto& e: entries)
+                    if (e.type == DT_LNK)
+                        links.emplace_back(&e);
+                std::sort(links.begin(), links.end(), [](const DirEntry* a, const DirEntry* b) { return a->ino < b->ino; });
+                FileInfo info;
+                for (auto e: links)
+                    if (info.statat_ifexists(dir->fd, e->name.data(), FileInfo::TYPE, 0) && info.isdir())
+                        follow[e - entries.data()] = 1;
+            }
+
+            // Build the entries to report
+            paths.clear();
+            batch.clear();
+            for (const auto& e: entries)
+            {
+                if (!opts.include.empty() && !opts.include.match(e.name))
+                    continue;
+                WalkEntry we;
+                we.path = paths.concat({prefix, e.name});
+                we.name = we.path.substr(prefix.size());
+                we.dirfd = dir->fd;
+                we.ino = e.ino;
+                we.type = e.type;
+                we.depth = dir->depth + 1;
+                batch.emplace_back(we);
+            }
+
+            if (opts.stat_mask)
+            {
+                // Stat in inode order, then point the entries to the results
+                order.resize(batch.size());
+                for (unsigned i = 0; i < order.size(); ++i)
+                    order[i] = i;
+                std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return batch[a].ino < batch[b].ino; });
+                infos.resize(batch.size());
+                for (unsigned i: order)
+                    infos[i].statat_ifexists(dir->fd, batch[i].name.data(), opts.stat_mask, opts.stat_flags);
+                for (unsigned i = 0; i < batch.size(); ++i)
+                    batch[i].info = &infos[i];
+            }
+
+            if (!batch.empty())
+                dest(batch);
+
+            // Queue subdirectories
+            for (unsigned i = 0; i < entries.size(); ++i)
+            {
+                const DirEntry& e = entries[i];
+                if (e.type != DT_DIR && !follow[i])
+                    continue;
+                if (opts.descend)
+                {
+                    WalkEntry we;
+                    std::string_view path = paths.concat({prefix, e.name});
+                    we.path = path;
+                    we.name = path.substr(prefix.size());
+                    we.dirfd = dir->fd;
+                    we.ino = e.ino;
+                    we.type = e.type;
+                    we.depth = dir->depth + 1;
+                    if (!opts.descend(we))
+                        continue;
+                }
+                std::string path(prefix);
+                path += e.name;
+                // Over the limit, share the base of dir, which stays open
+                // while dir is visited, unless the path gets too long
+                WalkDir* base = dir->base;
+                size_t base_size = base && !base->path.empty() ? base->path.size() + 1 : 0;
+                if (open_fds.load(std::memory_order_relaxed) < opts.max_open_fds
+                        || path.size() - base_size > max_base_path)
+                    base = dir.get();
+                if (base)
+                    ++base->fd_users;
+                push(self, std::make_shared<WalkDir>(dir, std::move(path), dir->depth + 1, base));
+            }
+        }
+
+        release_visit(*dir);
+    }
+
+    /// Release the file descriptors used by the visit of dir
+    void release_visit(WalkDir& dir)
+    {
+        release_fd(dir);
+        if (dir.base)
+            release_fd(*dir.base);
+    }
+
+    void worker(unsigned idx)
+    {
+        WalkBuffers buffers;
+        while (true)
+        {
+            std::shared_ptr<WalkDir> dir = pop(idx);
+            if (!dir)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ++idle;
+                cond.wait(lock, [this] { return stop || queued > 0; });
+                --idle;
+                if (stop) return;
+                continue;
+            }
+
+            try {
+                visit(idx, dir, buffers);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                stop = true;
+                cond.notify_all();
+                return;
+            }
+            dir.reset();
+
+            if (outstanding.fetch_sub(1) == 1)
+            {
+                // Nothing queued and nothing being visited: we are done
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+                cond.notify_all();
+                return;
+            }
+        }
+    }
+
+public:
+    TreeWalkerRun(const WalkOptions& opts, std::function<void(const std::vector<WalkEntry>&)> dest)
+        : opts(opts), dest(std::move(dest))
+    {
+        max_threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < max_threads; ++i)
+            queues.emplace_back(new WalkQueue);
+    }
+
+    ~TreeWalkerRun()
+    {
+        if (root_fd != -1) ::close(root_fd);
+    }
+
+    void run(const std::string& root)
+    {
+        root_name = root;
+        root_fd = ::open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (root_fd == -1)
+            throw std::system_error(errno, std::system_category(), "cannot open directory " + root);
+
+        auto dir = std::make_shared<WalkDir>(nullptr, std::string(), 0, nullptr);
+        dir->fd = ::openat(root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir->fd == -1)
+            throw std::system_error(errno, std::system_category(), "cannot open directory " + root);
+        if (opts.follow_symlinks)
+        {
+            FileInfo info;
+            info.fstat(dir->fd, FileInfo::INO);
+            dir->dev = info.dev();
+            dir->ino = info.inode();
+        }
+        ++open_fds;
+        push(0, std::move(dir));
+
+        // The calling thread is also a worker
+        worker(0);
+
+        std::vector<std::thread> started;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            cond.notify_all();
+            started = std::move(threads);
+        }
+        for (auto& t: started)
+            t.join();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+}
+
+TreeWalker::TreeWalker(const std::string& root, WalkOptions opts)
+    : root(root), opts(std::move(opts))
+{
+}
+
+void TreeWalker::walk(std::function<void(const WalkEntry&)> dest)
+{
+    walk_batches([&](const std::vector<WalkEntry>& batch) {
+        for (const auto& e: batch)
+            dest(e);
+    });
+}
+
+void TreeWalker::walk_batches(std::function<void(const std::vector<WalkEntry>&)> dest)
+{
+    TreeWalkerRun run(opts, std::move(dest));
+    run.run(root);
+}
+
+void walk(const std::string& root, std::function<void(const WalkEntry&)> dest, WalkOptions opts)
+{
+    TreeWalker walker(root, std::move(opts));
+    walker.walk(std::move(dest));
+}
+
 /*
  * File
  */
@@ -980,21 +2240,96 @@ void Tempdir::rmtree_on_exit(bool val)
 }
 
 
+namespace {
+
+/**
+ * Read fd until EOF, appending to out.
+ *
+ * size_hint is the expected file size, or 0 if not known: it is only used to
+ * size the buffer, since files in /proc report 0 and files can change size
+ * while being read
+ */
+void read_until_eof(FileDescriptor& fd, std::string& out, size_t size_hint)
+{
+    size_t pos = out.size();
+    // One byte more than the hint, to detect EOF without resizing
+    out.resize(pos + (size_hint ? size_hint + 1 : 4096));
+    while (true)
+    {
+        size_t res = fd.read(&out[pos], out.size() - pos);
+        if (res == 0)
+            break;
+        pos += res;
+        if (pos == out.size())
+            out.resize(out.size() * 2);
+    }
+    out.resize(pos);
+}
+
+}
+
 std::string read_file(const std::string& file)
 {
     File in(file, O_RDONLY);
 
-    // Get the file size
-    struct stat st;
-    in.fstat(st);
+    FileInfo info;
+    info.fstat(in, FileInfo::TYPE | FileInfo::SIZE);
 
-    if (st.st_size == 0)
-        return std::string();
+    if (info.isreg() && info.size() >= FileContents::default_mmap_threshold)
+    {
+        // mmap large files, to avoid zero-filling the string before reading
+        MMap src = in.mmap(info.size(), PROT_READ, MAP_SHARED);
+        return std::string((const char*)src, info.size());
+    }
 
-    // mmap the input file
-    MMap src = in.mmap(st.st_size, PROT_READ, MAP_SHARED);
+    std::string res;
+    read_until_eof(in, res, info.isreg() ? info.size() : 0);
+    return res;
+}
 
-    return std::string((const char*)src, st.st_size);
+FileContents::FileContents()
+    : m_mapped(MAP_FAILED, 0)
+{
+}
+
+FileContents::FileContents(MMap&& mapped)
+    : m_mapped(std::move(mapped))
+{
+}
+
+FileContents::FileContents(std::string&& buffer)
+    : m_mapped(MAP_FAILED, 0), m_buffer(std::move(buffer))
+{
+}
+
+FileContents read_file_view(const std::string& file, unsigned flags, size_t mmap_threshold)
+{
+    File in(file, O_RDONLY);
+
+    FileInfo info;
+    info.fstat(in, FileInfo::TYPE | FileInfo::SIZE);
+
+    if (info.isreg() && info.size() > 0 && info.size() >= mmap_threshold)
+    {
+        int mmap_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (flags & FileContents::POPULATE)
+            mmap_flags |= MAP_POPULATE;
+#endif
+        void* addr = ::mmap(nullptr, info.size(), PROT_READ, mmap_flags, in, 0);
+        // If the file cannot be mapped, fall back to reading it
+        if (addr != MAP_FAILED)
+        {
+            MMap mapped(addr, info.size());
+            if (flags & FileContents::SEQUENTIAL)
+                ::madvise(addr, info.size(), MADV_SEQUENTIAL);
+            return FileContents(std::move(mapped));
+        }
+    }
+
+    std::string buffer;
+    read_until_eof(in, buffer, info.isreg() ? info.size() : 0);
+    return FileContents(std::move(buffer));
 }
 
 void write_file(const std::string& file, const std::string& data, mode_t mode)
@@ -1032,6 +2367,232 @@ void write_file_atomically(const std::string& file, const void* data, size_t siz
         throw std::system_error(errno, std::system_category(), "cannot rename " + out.name() + " to " + file);
 }
 
+void encode_base64(FileDescriptor& in, FileDescriptor& out, size_t chunk_size)
+{
+    std::unique_ptr<char[]> buf(new char[chunk_size]);
+    std::string encoded;
+    str::Base64Encoder encoder;
+    while (size_t size = in.read(buf.get(), chunk_size))
+    {
+        encoded.clear();
+        encoder.encode(buf.get(), size, encoded);
+        out.write_all_or_retry(encoded);
+    }
+    encoded.clear();
+    encoder.flush(encoded);
+    out.write_all_or_retry(encoded);
+}
+
+void decode_base64(FileDescriptor& in, FileDescriptor& out, size_t chunk_size)
+{
+    std::unique_ptr<char[]> buf(new char[chunk_size]);
+    std::string decoded;
+    str::Base64Decoder decoder;
+    while (size_t size = in.read(buf.get(), chunk_size))
+    {
+        decoded.clear();
+        decoder.decode(buf.get(), size, decoded);
+        out.write_all_or_retry(decoded);
+    }
+    decoded.clear();
+    decoder.flush(decoded);
+    out.write_all_or_retry(decoded);
+}
+
+
+/*
+ * MappedLines
+ */
+
+MappedLines::MappedLines(FileDescriptor& fd, bool strip_cr, size_t window_size)
+    : owned(std::string()), fd(fd), strip_cr(strip_cr), map(MAP_FAILED, 0)
+{
+    init(window_size);
+}
+
+MappedLines::MappedLines(const std::string& pathname, bool strip_cr, size_t window_size)
+    : owned(pathname, O_RDONLY), fd(owned), strip_cr(strip_cr), map(MAP_FAILED, 0)
+{
+    init(window_size);
+}
+
+void MappedLines::init(size_t window_size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    this->window_size = std::max(page_size, (window_size + page_size - 1) / page_size * page_size);
+
+    struct stat st;
+    fd.fstat(st);
+    file_size = st.st_size;
+}
+
+void MappedLines::map_window(size_t offset, size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page_size * page_size;
+    size_t length = std::min(size, file_size - start);
+
+    // Unmap the old window first, to keep at most one mapped at a time
+    map.munmap();
+    map = fd.mmap(length, PROT_READ, MAP_SHARED, start);
+    ::madvise(map, length, MADV_SEQUENTIAL);
+    map_offset = start;
+    map_size = length;
+}
+
+bool MappedLines::next(std::string_view& line)
+{
+    if (pos >= file_size)
+        return false;
+
+    if (pos < map_offset || pos >= map_offset + map_size)
+        map_window(pos, window_size);
+
+    // File offset where the search for the end of line starts
+    size_t scan = pos;
+    size_t len;
+    while (true)
+    {
+        const char* base = static_cast<const char*>(map) - map_offset;
+        const char* nl = static_cast<const char*>(memchr(base + scan, '\n', map_offset + map_size - scan));
+        if (nl)
+        {
+            len = nl - (base + pos);
+            break;
+        }
+
+        scan = map_offset + map_size;
+        if (scan == file_size)
+        {
+            // Last line, without a trailing newline
+            len = file_size - pos;
+            break;
+        }
+
+        // The line continues past the end of the window: map a larger window
+        // starting at the beginning of the line
+        map_window(pos, std::max(window_size, map_size * 2));
+    }
+
+    const char* start = static_cast<const char*>(map) + (pos - map_offset);
+    pos += len + 1;
+    if (strip_cr && len > 0 && start[len - 1] == '\r')
+        --len;
+    line = std::string_view(start, len);
+    return true;
+}
+
+MappedLines::const_iterator::const_iterator(MappedLines& lines)
+    : lines(&lines)
+{
+    ++*this;
+}
+
+MappedLines::const_iterator& MappedLines::const_iterator::operator++()
+{
+    if (lines && !lines->next(cur))
+        lines = nullptr;
+    return *this;
+}
+
+
+/*
+ * RecordReader
+ */
+
+RecordReader::RecordReader(FileDescriptor& fd, std::string_view sep, size_t buffer_size)
+    : fd(fd), sep(sep), buf_size(std::max(buffer_size, sep.size() + 1))
+{
+    if (sep.empty())
+        throw std::invalid_argument("record separator cannot be empty");
+    buf.reset(new char[buf_size]);
+}
+
+bool RecordReader::fill()
+{
+    if (eof)
+        return false;
+
+    if (record_start > 0)
+    {
+        // Move the partial record to the beginning of the buffer
+        memmove(buf.get(), buf.get() + record_start, data_end - record_start);
+        data_end -= record_start;
+        scanned -= record_start;
+        record_start = 0;
+    }
+
+    if (data_end == buf_size)
+    {
+        // The record does not fit: grow the buffer
+        size_t new_size = buf_size * 2;
+        std::unique_ptr<char[]> new_buf(new char[new_size]);
+        memcpy(new_buf.get(), buf.get(), data_end);
+        buf = std::move(new_buf);
+        buf_size = new_size;
+    }
+
+    while (true)
+    {
+        ssize_t res = ::read(fd, buf.get() + data_end, buf_size - data_end);
+        if (res == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            fd.throw_error("cannot read");
+        }
+        if (res == 0)
+        {
+            eof = true;
+            return false;
+        }
+        data_end += res;
+        return true;
+    }
+}
+
+bool RecordReader::next(std::string_view& record)
+{
+    while (true)
+    {
+        std::string_view data(buf.get(), data_end);
+        size_t pos = data.find(sep, scanned);
+        if (pos != std::string_view::npos)
+        {
+            record = data.substr(record_start, pos - record_start);
+            record_start = scanned = pos + sep.size();
+            return true;
+        }
+
+        // The separator may begin in the last bytes read
+        if (data_end - record_start >= sep.size())
+            scanned = std::max(record_start, data_end - sep.size() + 1);
+
+        if (!fill())
+        {
+            if (record_start == data_end)
+                return false;
+            // Last record without a trailing separator
+            record = std::string_view(buf.get() + record_start, data_end - record_start);
+            record_start = scanned = data_end;
+            return true;
+        }
+    }
+}
+
+RecordReader::const_iterator::const_iterator(RecordReader& reader)
+    : reader(&reader)
+{
+    ++*this;
+}
+
+RecordReader::const_iterator& RecordReader::const_iterator::operator++()
+{
+    if (reader && !reader->next(cur))
+        reader = nullptr;
+    return *this;
+}
+
 #if 0
 void mkFilePath(const std::string& file)
 {
@@ -1094,14 +2655,14 @@ static bool impl_mkdir_ifmissing(String pathname, mode_t mode)
         // where pathname is a symbolic link, dangling or not."
         if (errno != EEXIST && errno != EISDIR)
         {
-            std::stringstream msg;
+            str::Appender msg;
             msg << "cannot create directory " << pathname;
             throw std::system_error(errno, std::system_category(), msg.str());
         }
 
         // Ensure that, if dir exists, it is a directory
-        std::unique_ptr<struct stat> st = sys::stat(pathname);
-        if (st.get() == NULL)
+        FileInfo info;
+        if (!info.stat_ifexists(to_cstring(pathname), FileInfo::TYPE))
         {
             // Either dir has just been deleted, or we hit a dangling
             // symlink.
@@ -1114,10 +2675,10 @@ static bool impl_mkdir_ifmissing(String pathname, mode_t mode)
             // stat and the lstat.
             continue;
         }
-        else if (!S_ISDIR(st->st_mode))
+        else if (!info.isdir())
         {
             // If it exists but it is not a directory, complain
-            std::stringstream msg;
+            str::Appender msg;
             msg << pathname << " exists but is not a directory";
             throw std::runtime_error(msg.str());
         }
@@ -1125,7 +2686,7 @@ static bool impl_mkdir_ifmissing(String pathname, mode_t mode)
             // If it exists and it is a directory, we're fine
             return false;
     }
-    std::stringstream msg;
+    str::Appender msg;
     msg << pathname << " exists and looks like a dangling symlink";
     throw std::runtime_error(msg.str());
 }
@@ -1186,12 +2747,22 @@ void rmdir(const std::string& pathname)
 }
 
 void rmtree(const std::string& pathname)
+{
+    rmtree(pathname, RmtreeOptions());
+}
+
+RmtreeStats rmtree(const std::string& pathname, const RmtreeOptions& opts)
 {
     Path path(pathname);
-    path.rmtree();
+    return path.rmtree(opts);
 }
 
 bool rmtree_ifexists(const std::string& pathname)
+{
+    return rmtree_ifexists(pathname, RmtreeOptions());
+}
+
+bool rmtree_ifexists(const std::string& pathname, const RmtreeOptions& opts)
 {
     int fd = open(pathname.c_str(), O_PATH);
     if (fd == -1)
@@ -1201,7 +2772,7 @@ bool rmtree_ifexists(const std::string& pathname)
         throw std::system_error(errno, std::system_category(), "cannot open path " + pathname);
     }
     Path path(fd, pathname);
-    path.rmtree();
+    path.rmtree(opts);
     return true;
 }
 
@@ -9,8 +9,12 @@
  */
 
 #include <string>
+#include <string_view>
 #include <memory>
+#include <vector>
+#include <functional>
 #include <iterator>
+#include <system_error>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -18,10 +22,149 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include "string.h"
 
 namespace wobble {
 namespace sys {
 
+/**
+ * File metadata, as returned by statx(2).
+ *
+ * Loading functions take a mask of FileInfo::TYPE, FileInfo::SIZE and
+ * similar constants to select which fields the kernel needs to compute:
+ * asking only for what is needed (like TYPE to tell directories from files)
+ * can save work on some filesystems. Fields not reported in mask() are left
+ * at 0. The kernel may fill more fields than requested, and mask() reports
+ * them too.
+ *
+ * Loading functions also take flags: AT_SYMLINK_NOFOLLOW to stat symbolic
+ * links instead of what they point to, and FileInfo::DONT_SYNC to accept
+ * cached metadata on network filesystems instead of querying the server.
+ *
+ * On systems without statx(2), it falls back to fstatat(2).
+ */
+class FileInfo
+{
+protected:
+    unsigned m_mask = 0;
+    bool m_exists = false;
+    mode_t m_mode = 0;
+    nlink_t m_nlink = 0;
+    uid_t m_uid = 0;
+    gid_t m_gid = 0;
+    ino_t m_ino = 0;
+    dev_t m_dev = 0;
+    dev_t m_rdev = 0;
+    off_t m_size = 0;
+    blkcnt_t m_blocks = 0;
+    blksize_t m_blksize = 0;
+    struct ::timespec m_atim = { 0, 0 };
+    struct ::timespec m_mtim = { 0, 0 };
+    struct ::timespec m_ctim = { 0, 0 };
+
+    /**
+     * Run statx, filling in the structure and returning 0 on success or the
+     * errno value on failure
+     */
+    int load(int dirfd, const char* pathname, unsigned mask, int flags);
+
+public:
+    /**
+     * Field mask bits, with the same values as the STATX_* constants of
+     * statx(2)
+     */
+    static constexpr unsigned TYPE = 0x0001;
+    static constexpr unsigned MODE = 0x0002;
+    static constexpr unsigned NLINK = 0x0004;
+    static constexpr unsigned UID = 0x0008;
+    static constexpr unsigned GID = 0x0010;
+    static constexpr unsigned ATIME = 0x0020;
+    static constexpr unsigned MTIME = 0x0040;
+    static constexpr unsigned CTIME = 0x0080;
+    static constexpr unsigned INO = 0x0100;
+    static constexpr unsigned SIZE = 0x0200;
+    static constexpr unsigned BLOCKS = 0x0400;
+    /// All the fields filled by stat(2)
+    static constexpr unsigned BASIC_STATS = 0x07ff;
+
+    /// Flag to accept cached metadata, like AT_STATX_DONT_SYNC
+    static constexpr int DONT_SYNC = 0x4000;
+    /// Flag to always query a network filesystem server, like AT_STATX_FORCE_SYNC
+    static constexpr int FORCE_SYNC = 0x2000;
+
+    FileInfo() = default;
+
+    /**
+     * stat() the given file. If it does not exist, exists() will return
+     * false. Raises exceptions in case of other errors.
+     */
+    explicit FileInfo(const std::string& pathname, unsigned mask=FileInfo::BASIC_STATS, int flags=0);
+
+    /// stat() the given file. Raises exceptions in case of errors, including if the file does not exist.
+    void stat(const char* pathname, unsigned mask=FileInfo::BASIC_STATS, int flags=0);
+
+    /// stat() the given file, returning false if it does not exist
+    bool stat_ifexists(const char* pathname, unsigned mask=FileInfo::BASIC_STATS, int flags=0);
+
+    /// stat() pathname relative to the directory dirfd
+    void statat(int dirfd, const char* pathname, unsigned mask=FileInfo::BASIC_STATS, int flags=0);
+
+    /// statat, but returns false if the file does not exist
+    bool statat_ifexists(int dirfd, const char* pathname, unsigned mask=FileInfo::BASIC_STATS, int flags=0);
+
+    /// stat() an open file descriptor
+    void fstat(int fd, unsigned mask=FileInfo::BASIC_STATS);
+
+    /// Fill a struct stat with the fields that have been loaded
+    void to_stat(struct stat& st) const;
+
+    /// True if the last load found the file
+    bool exists() const { return m_exists; }
+
+    /// Mask of the fields that have been filled
+    unsigned mask() const { return m_mask; }
+
+    /// File type and mode (file type bits require TYPE)
+    mode_t mode() const { return m_mode; }
+
+    bool isdir() const { return S_ISDIR(m_mode); }
+    bool isblk() const { return S_ISBLK(m_mode); }
+    bool ischr() const { return S_ISCHR(m_mode); }
+    bool isfifo() const { return S_ISFIFO(m_mode); }
+    bool islnk() const { return S_ISLNK(m_mode); }
+    bool isreg() const { return S_ISREG(m_mode); }
+    bool issock() const { return S_ISSOCK(m_mode); }
+
+    nlink_t nlink() const { return m_nlink; }
+    uid_t uid() const { return m_uid; }
+    gid_t gid() const { return m_gid; }
+    ino_t inode() const { return m_ino; }
+    /// Device containing the file (always filled)
+    dev_t dev() const { return m_dev; }
+    /// Device represented by the file, for device nodes (always filled)
+    dev_t rdev() const { return m_rdev; }
+    size_t size() const { return (size_t)m_size; }
+    blkcnt_t blocks() const { return m_blocks; }
+    /// Preferred block size for I/O (always filled)
+    blksize_t blksize() const { return m_blksize; }
+
+    const struct ::timespec& atim() const { return m_atim; }
+    const struct ::timespec& mtim() const { return m_mtim; }
+    const struct ::timespec& ctim() const { return m_ctim; }
+
+    /// File mtime
+    time_t mtime() const { return m_mtim.tv_sec; }
+};
+
+/**
+ * Return information about the given file, requesting only the fields in
+ * mask. If the file does not exist, the result's exists() is false.
+ */
+inline FileInfo file_info(const std::string& pathname, unsigned mask=FileInfo::BASIC_STATS, int flags=0)
+{
+    return FileInfo(pathname, mask, flags);
+}
+
 /**
  * stat() the given file and return the struct stat with the results.
  * If the file does not exist, return NULL.
@@ -99,6 +242,18 @@ mode_t umask(mode_t mask);
 /// Get the absolute path of a file
 std::string abspath(const std::string& pathname);
 
+/// Make a path absolute and normalise it, in place, like abspath()
+void abspath(str::PathBuffer& path);
+
+/**
+ * Make a path absolute and normalise it, in place, resolving relative paths
+ * against the given directory.
+ *
+ * This allows to look up the current directory only once when resolving
+ * many paths.
+ */
+void abspath(str::PathBuffer& path, std::string_view cwd);
+
 /**
  * Wraps a mmapped memory area, unmapping it on destruction.
  *
@@ -120,6 +275,7 @@ public:
 
     size_t size() const { return length; }
 
+    /// Unmap the memory area. Does nothing if it has already been unmapped
     void munmap();
 
     template<typename T>
@@ -357,6 +513,49 @@ struct ManagedNamedFileDescriptor : public NamedFileDescriptor
 };
 
 
+class DirReader;
+
+/// Counts of what has been deleted by rmtree
+struct RmtreeStats
+{
+    /// Number of non-directory entries deleted
+    size_t files = 0;
+    /// Number of directories deleted
+    size_t dirs = 0;
+};
+
+/**
+ * Options for rmtree.
+ *
+ * Directories are processed from an explicit work queue shared by a pool of
+ * threads, which are started only when there is enough work queued.
+ */
+struct RmtreeOptions
+{
+    /// Maximum number of threads used, including the calling one (0: one per CPU)
+    unsigned threads = 0;
+
+    /**
+     * Maximum number of directory file descriptors kept open between
+     * operations (at least 1). Directories whose descriptors have been
+     * closed are reopened relative to their parent, or as ".." of an open
+     * subdirectory, when needed.
+     */
+    unsigned max_open_fds = 64;
+
+    /**
+     * Function called with the running counts every progress_interval
+     * deleted entries, and once at the end with the final counts.
+     *
+     * It can be called from any of the worker threads, but never by two
+     * threads at the same time.
+     */
+    std::function<void(const RmtreeStats&)> progress;
+
+    /// Number of deleted entries between calls to progress
+    size_t progress_interval = 10000;
+};
+
 /**
  * Wrap a path on the file system opened with O_PATH.
  */
@@ -374,20 +573,16 @@ struct Path : public ManagedNamedFileDescriptor
         using reference = struct dirent&;
 
         Path* path = nullptr;
-        DIR* dir = nullptr;
-        struct dirent* cur_entry = nullptr;
+        std::unique_ptr<DirReader> dir;
+        /// Current entry, copied out of the DirReader buffer
+        std::unique_ptr<struct dirent> cur_entry;
 
         // End iterator
         iterator();
         // Start iteration on dir
         iterator(Path& dir);
         iterator(iterator&) = delete;
-        iterator(iterator&& o)
-            : dir(o.dir), cur_entry(o.cur_entry)
-        {
-            o.dir = nullptr;
-            o.cur_entry = nullptr;
-        }
+        iterator(iterator&& o);
         ~iterator();
         iterator& operator=(iterator&) = delete;
         iterator& operator=(iterator&&) = delete;
@@ -395,7 +590,7 @@ struct Path : public ManagedNamedFileDescriptor
         bool operator==(const iterator& i) const;
         bool operator!=(const iterator& i) const;
         struct dirent& operator*() const { return *cur_entry; }
-        struct dirent* operator->() const { return cur_entry; }
+        struct dirent* operator->() const { return cur_entry.get(); }
         void operator++();
 
         /// @return true if we refer to a directory, else false
@@ -489,11 +684,247 @@ struct Path : public ManagedNamedFileDescriptor
      */
     void rmtree();
 
+    /**
+     * Delete the directory pointed to by this Path, with all its contents,
+     * using the given options.
+     *
+     * The path must point to a directory, and it is itself deleted using
+     * unlinkat(2) relative to the parent directory of name().
+     */
+    RmtreeStats rmtree(const RmtreeOptions& opts);
+
     static std::string mkdtemp(const std::string& prefix);
     static std::string mkdtemp(const char* prefix);
     static std::string mkdtemp(char* pathname_template);
 };
 
+/**
+ * Directory entry read by DirReader.
+ *
+ * name points inside the DirReader buffer, and is only valid until the next
+ * read. It is followed by a 0 terminator, so name.data() can be passed to
+ * the *at functions.
+ */
+struct DirEntry
+{
+    std::string_view name;
+    ino_t ino = 0;
+    /// DT_* file type, which can be DT_UNKNOWN on some filesystems
+    unsigned char type = DT_UNKNOWN;
+
+    /// Check if this is the "." or ".." entry
+    bool is_dots() const
+    {
+        return name[0] == '.' && (name.size() == 1 || (name.size() == 2 && name[1] == '.'));
+    }
+
+    bool isdir() const { return type == DT_DIR; }
+    bool isblk() const { return type == DT_BLK; }
+    bool ischr() const { return type == DT_CHR; }
+    bool isfifo() const { return type == DT_FIFO; }
+    bool islnk() const { return type == DT_LNK; }
+    bool isreg() const { return type == DT_REG; }
+    bool issock() const { return type == DT_SOCK; }
+};
+
+/**
+ * Read directory entries with getdents64(2), into a buffer of the given size.
+ *
+ * readdir(3) uses a small buffer, which means a syscall every few hundred
+ * entries: on very large directories, a buffer of a megabyte or so reads
+ * thousands of entries at a time.
+ *
+ * Entries are returned as DirEntry views into the buffer, valid until the
+ * next call that reads from the directory.
+ */
+class DirReader
+{
+protected:
+    /// Directory, opened for reading
+    NamedFileDescriptor fd;
+    /// True if fd is closed by the destructor
+    bool owned = true;
+    std::unique_ptr<char[]> buf;
+    size_t buf_size;
+    size_t buf_len = 0;
+    size_t buf_pos = 0;
+    bool at_end = false;
+
+    /// Read the next chunk of entries. Returns false at the end of the directory
+    bool fill();
+
+public:
+    static const size_t default_buffer_size = 65536;
+
+    /// Read the directory pointed to by dir
+    explicit DirReader(Path& dir, size_t buffer_size=default_buffer_size);
+    /// Open pathname and read its entries
+    explicit DirReader(const std::string& pathname, size_t buffer_size=default_buffer_size);
+    /**
+     * Read from dirfd, a directory already open for reading, named pathname
+     * in error messages.
+     *
+     * dirfd is not closed by DirReader.
+     */
+    DirReader(int dirfd, const std::string& pathname, size_t buffer_size=default_buffer_size);
+    DirReader(const DirReader&) = delete;
+    DirReader(DirReader&&) = default;
+    ~DirReader();
+    DirReader& operator=(const DirReader&) = delete;
+    DirReader& operator=(DirReader&&) = delete;
+
+    /**
+     * Start reading dirfd, named pathname in error messages, reusing the
+     * buffer. As with the constructor, dirfd is not closed by DirReader.
+     */
+    void reset(int dirfd, const std::string& pathname);
+
+    /// Directory file descriptor, usable with the *at functions
+    NamedFileDescriptor& dirfd() { return fd; }
+
+    /**
+     * Read the next entry, including "." and "..".
+     *
+     * Returns false at the end of the directory.
+     */
+    bool next(DirEntry& entry);
+
+    /**
+     * Replace the contents of out with the entries read by the next
+     * getdents64 call, skipping "." and "..".
+     *
+     * Returns false, with out empty, at the end of the directory.
+     */
+    bool read_batch(std::vector<DirEntry>& out);
+
+    /**
+     * Fill in the type of DT_UNKNOWN entries with statx, requesting only
+     * FileInfo::TYPE.
+     *
+     * Entries are stat-ed in inode order, which is usually close to on-disk
+     * order. Symbolic links are not followed, consistently with what
+     * getdents64 reports. Entries deleted in the meantime are left as
+     * DT_UNKNOWN.
+     */
+    void resolve_types(std::vector<DirEntry>& entries, int flags=AT_SYMLINK_NOFOLLOW);
+};
+
+/**
+ * Entry found by TreeWalker.
+ *
+ * The string views and dirfd are only valid during the callback.
+ */
+struct WalkEntry
+{
+    /// Path relative to the root of the walk, like "dir/subdir/name"
+    std::string_view path;
+    /// Name of the entry, that is, the last component of path
+    std::string_view name;
+    /// Directory containing the entry, usable with the *at functions
+    int dirfd = -1;
+    ino_t ino = 0;
+    /**
+     * DT_* file type. DT_UNKNOWN types are resolved with statx, and symbolic
+     * links are reported as DT_LNK also when they are followed
+     */
+    unsigned char type = DT_UNKNOWN;
+    /// 1 for entries in the root directory, 2 for their contents, and so on
+    unsigned depth = 0;
+    /// Entry metadata if WalkOptions::stat_mask is set, else nullptr
+    const FileInfo* info = nullptr;
+
+    bool isdir() const { return type == DT_DIR; }
+    bool islnk() const { return type == DT_LNK; }
+    bool isreg() const { return type == DT_REG; }
+};
+
+/// Options for TreeWalker
+struct WalkOptions
+{
+    /// Maximum number of threads used, including the calling one (0: one per CPU)
+    unsigned threads = 0;
+
+    /**
+     * Maximum number of directory file descriptors kept open for opening
+     * subdirectories relative to them. When it is reached, subdirectories
+     * are opened relative to an ancestor that is still open, as long as the
+     * relative path stays short.
+     */
+    unsigned max_open_fds = 256;
+
+    /**
+     * Descend into symbolic links to directories. Directories already
+     * being visited in the same branch are not descended again, so that
+     * symlink loops are not followed.
+     */
+    bool follow_symlinks = false;
+
+    /**
+     * If not empty, only report entries whose name matches. Directories are
+     * descended into regardless.
+     */
+    str::Glob include;
+
+    /// Ignore entries whose name matches, and do not descend into them
+    str::Glob exclude;
+
+    /**
+     * Called for each directory to be descended into: return false to skip
+     * its contents
+     */
+    std::function<bool(const WalkEntry&)> descend;
+
+    /**
+     * If not 0, fill in WalkEntry::info for reported entries, requesting
+     * these FileInfo fields. Entries in a batch are stat-ed in inode order, which is
+     * usually close to the on-disk order in filesystems like ext4 and xfs
+     */
+    unsigned stat_mask = 0;
+
+    /// statx flags used with stat_mask
+    int stat_flags = AT_SYMLINK_NOFOLLOW;
+
+    /**
+     * Called when a directory cannot be opened or read, with its path
+     * relative to the root. If not set, the error is thrown and the walk
+     * stops. Directories deleted during the walk are skipped silently.
+     */
+    std::function<void(std::string_view path, const std::system_error& e)> on_error;
+};
+
+/**
+ * Walk a directory tree with a pool of threads.
+ *
+ * Each thread has its own queue of directories to visit, and takes work from
+ * the queues of other threads when it runs out. Subdirectories are opened
+ * with openat(2) relative to their parent.
+ *
+ * Callbacks are called concurrently from all the threads, and need to be
+ * thread safe. If a callback throws, the walk stops and the exception is
+ * rethrown by walk() or walk_batches().
+ */
+class TreeWalker
+{
+protected:
+    std::string root;
+    WalkOptions opts;
+
+public:
+    explicit TreeWalker(const std::string& root, WalkOptions opts=WalkOptions());
+
+    /// Call dest for each entry found
+    void walk(std::function<void(const WalkEntry&)> dest);
+
+    /**
+     * Call dest with the entries found, in batches of entries from the same
+     * directory
+     */
+    void walk_batches(std::function<void(const std::vector<WalkEntry>&)> dest);
+};
+
+/// Walk the tree at root, calling dest for each entry found
+void walk(const std::string& root, std::function<void(const WalkEntry&)> dest, WalkOptions opts=WalkOptions());
+
 
 /**
  * File in the file system
@@ -578,9 +1009,79 @@ public:
 };
 
 
-/// Read whole file into memory. Throws exceptions on failure.
+/**
+ * Read whole file into memory. Throws exceptions on failure.
+ *
+ * Files whose size is not known in advance, like pipes and /proc entries,
+ * are read until EOF.
+ */
 std::string read_file(const std::string &file);
 
+/**
+ * Contents of a file, as returned by read_file_view.
+ *
+ * Regular files above a size threshold are memory mapped, and the others are
+ * read into a buffer. Either way, the contents are available as a
+ * string_view that is valid as long as the FileContents object.
+ *
+ * As with any mapping, if a mapped file is truncated while in use, accessing
+ * the missing part raises SIGBUS.
+ */
+class FileContents
+{
+protected:
+    MMap m_mapped;
+    std::string m_buffer;
+
+public:
+    /// Map the file with MAP_POPULATE, to fault in all its pages in advance
+    static const unsigned POPULATE = 1;
+    /// Advise the kernel with MADV_SEQUENTIAL that the file will be read sequentially
+    static const unsigned SEQUENTIAL = 2;
+    /// Default minimum size of files that are memory mapped
+    static const size_t default_mmap_threshold = 65536;
+
+    FileContents();
+    /// Use the given mapping
+    explicit FileContents(MMap&& mapped);
+    /// Use the given buffer
+    explicit FileContents(std::string&& buffer);
+    FileContents(const FileContents&) = delete;
+    FileContents(FileContents&&) = default;
+    FileContents& operator=(const FileContents&) = delete;
+    FileContents& operator=(FileContents&&) = default;
+
+    /// Check if the contents are memory mapped
+    bool is_mapped() const { return m_mapped.size() > 0; }
+
+    std::string_view view() const
+    {
+        if (is_mapped())
+            return std::string_view(static_cast<const char*>(m_mapped), m_mapped.size());
+        return m_buffer;
+    }
+    operator std::string_view() const { return view(); }
+
+    const char* data() const { return view().data(); }
+    size_t size() const { return view().size(); }
+    bool empty() const { return size() == 0; }
+    std::string_view::const_iterator begin() const { return view().begin(); }
+    std::string_view::const_iterator end() const { return view().end(); }
+
+    /// Return a copy of the contents as a string
+    std::string str() const { return std::string(view()); }
+};
+
+/**
+ * Read a whole file into memory, without copying it if it can be memory
+ * mapped.
+ *
+ * Regular files of at least mmap_threshold bytes are memory mapped, using the
+ * FileContents::POPULATE and FileContents::SEQUENTIAL flags. Other files,
+ * including pipes and /proc entries, are read until EOF into a buffer.
+ */
+FileContents read_file_view(const std::string& file, unsigned flags=0, size_t mmap_threshold=FileContents::default_mmap_threshold);
+
 /**
  * Write \a data to \a file, replacing existing contents if it already exists.
  *
@@ -619,6 +1120,222 @@ void write_file_atomically(const std::string& file, const std::string& data, mod
  */
 void write_file_atomically(const std::string& file, const void* data, size_t size, mode_t mode=0777);
 
+/**
+ * Read \a in until EOF, and write its Base64 encoding to \a out.
+ *
+ * Data is processed in chunks of \a chunk_size bytes, so memory usage does
+ * not depend on the size of the input.
+ */
+void encode_base64(FileDescriptor& in, FileDescriptor& out, size_t chunk_size=196608);
+
+/**
+ * Read Base64 data from \a in until EOF, and write the decoded result to
+ * \a out.
+ *
+ * Data is processed in chunks of \a chunk_size bytes, so memory usage does
+ * not depend on the size of the input. Whitespace in the input is ignored.
+ */
+void decode_base64(FileDescriptor& in, FileDescriptor& out, size_t chunk_size=262144);
+
+/**
+ * Read the lines of a file as std::string_view, without copying them.
+ *
+ * The file is memory-mapped in windows of window_size bytes, which are moved
+ * forward as lines are read, so that large files are never mapped all at
+ * once. A line is only valid until the next line is read, except when the
+ * whole file fits in one window, in which case lines remain valid until the
+ * MappedLines object is destroyed.
+ *
+ * Lines are split on '\n', which is not included in the line. If strip_cr is
+ * true, a '\r' before the '\n' is also removed. A last line without a
+ * trailing newline is also returned.
+ *
+ * The file needs to be a regular file: files reporting a size of 0, like
+ * those in /proc, are read as empty.
+ *
+ * Example code:
+ * \code
+ *   sys::MappedLines lines("/var/log/syslog");
+ *   for (std::string_view line: lines)
+ *      process(line);
+ * \endcode
+ */
+class MappedLines
+{
+protected:
+    /// File opened by the pathname constructor
+    File owned;
+    /// File being read
+    FileDescriptor& fd;
+    /// Remove a '\r' before each '\n'
+    bool strip_cr;
+    /// Size of the mapping windows, rounded to a multiple of the page size
+    size_t window_size;
+    /// Size of the file
+    size_t file_size = 0;
+    /// Current mapping window
+    MMap map;
+    /// File offset of the start of the current mapping window
+    size_t map_offset = 0;
+    /// Size of the current mapping window
+    size_t map_size = 0;
+    /// File offset of the start of the next line
+    size_t pos = 0;
+
+    /// Map a window of at least size bytes containing offset
+    void map_window(size_t offset, size_t size);
+
+    void init(size_t window_size);
+
+public:
+    /// Default size of the mapping windows
+    static const size_t default_window_size = 64 * 1024 * 1024;
+
+    /// Read the lines of a file that is already open
+    MappedLines(FileDescriptor& fd, bool strip_cr=false, size_t window_size=default_window_size);
+
+    /// Open a file and read its lines
+    MappedLines(const std::string& pathname, bool strip_cr=false, size_t window_size=default_window_size);
+
+    MappedLines(const MappedLines&) = delete;
+    MappedLines& operator=(const MappedLines&) = delete;
+
+    /**
+     * Read the next line into \a line.
+     *
+     * Returns false when the end of the file has been reached.
+     */
+    bool next(std::string_view& line);
+
+    class const_iterator
+    {
+    protected:
+        MappedLines* lines = nullptr;
+        std::string_view cur;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = int;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        /// Begin iterator
+        const_iterator(MappedLines& lines);
+        /// End iterator
+        const_iterator() {}
+
+        const_iterator& operator++();
+        const std::string_view& operator*() const { return cur; }
+        const std::string_view* operator->() const { return &cur; }
+
+        bool operator==(const const_iterator& o) const { return lines == o.lines; }
+        bool operator!=(const const_iterator& o) const { return lines != o.lines; }
+    };
+
+    /// Return an iterator reading lines from the current position
+    const_iterator begin() { return const_iterator(*this); }
+
+    /// Return the end iterator
+    const_iterator end() { return const_iterator(); }
+};
+
+/**
+ * Read records from a file descriptor as std::string_view, using a reusable
+ * buffer.
+ *
+ * This works with inputs that cannot be memory-mapped, like pipes, sockets
+ * and terminals, and uses constant memory: the buffer only grows when a
+ * single record does not fit in it. Records that span across reads are
+ * handled transparently.
+ *
+ * A record is only valid until the next record is read. Records are
+ * separated by sep, which is not included in the record. A last record
+ * without a trailing separator is also returned.
+ *
+ * The file descriptor should be in blocking mode.
+ *
+ * Example code:
+ * \code
+ *   sys::FileDescriptor out(child.get_stdout());
+ *   sys::RecordReader lines(out);
+ *   for (std::string_view line: lines)
+ *      process(line);
+ * \endcode
+ */
+class RecordReader
+{
+protected:
+    /// File being read
+    FileDescriptor& fd;
+    /// Record separator
+    std::string sep;
+    /// Read buffer
+    std::unique_ptr<char[]> buf;
+    /// Size of buf
+    size_t buf_size;
+    /// Offset in buf of the start of the next record
+    size_t record_start = 0;
+    /// Offset in buf of the end of the data read so far
+    size_t data_end = 0;
+    /// Offset in buf of the data not yet searched for the separator
+    size_t scanned = 0;
+    /// True when the end of file has been reached
+    bool eof = false;
+
+    /// Read more data into the buffer, returning false at end of file
+    bool fill();
+
+public:
+    /**
+     * Read records separated by \a sep from \a fd, reading buffer_size
+     * bytes at a time
+     */
+    RecordReader(FileDescriptor& fd, std::string_view sep="\n", size_t buffer_size=65536);
+
+    RecordReader(const RecordReader&) = delete;
+    RecordReader& operator=(const RecordReader&) = delete;
+
+    /**
+     * Read the next record into \a record.
+     *
+     * Returns false when the end of the file has been reached.
+     */
+    bool next(std::string_view& record);
+
+    class const_iterator
+    {
+    protected:
+        RecordReader* reader = nullptr;
+        std::string_view cur;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = int;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        /// Begin iterator
+        const_iterator(RecordReader& reader);
+        /// End iterator
+        const_iterator() {}
+
+        const_iterator& operator++();
+        const std::string_view& operator*() const { return cur; }
+        const std::string_view* operator->() const { return &cur; }
+
+        bool operator==(const const_iterator& o) const { return reader == o.reader; }
+        bool operator!=(const const_iterator& o) const { return reader != o.reader; }
+    };
+
+    /// Return an iterator reading records from the current position
+    const_iterator begin() { return const_iterator(*this); }
+
+    /// Return the end iterator
+    const_iterator end() { return const_iterator(); }
+};
+
 #if 0
 // Create a temporary directory based on a template.
 std::string mkdtemp(std::string templ);
@@ -680,6 +1397,9 @@ void rmdir(const std::string& pathname);
 /// Delete the directory \a pathname and all its contents.
 void rmtree(const std::string& pathname);
 
+/// Delete the directory \a pathname and all its contents, using the given options.
+RmtreeStats rmtree(const std::string& pathname, const RmtreeOptions& opts);
+
 /**
  * Delete the directory \a pathname and all its contents.
  *
@@ -687,6 +1407,9 @@ void rmtree(const std::string& pathname);
  */
 bool rmtree_ifexists(const std::string& pathname);
 
+/// rmtree_ifexists using the given options
+bool rmtree_ifexists(const std::string& pathname, const RmtreeOptions& opts);
+
 /**
  * Rename src_pathname into dst_pathname.
  *
@@ -1,4 +1,5 @@
 #include "term.h"
+#include "string.h"
 #include <unistd.h>
 #include <cerrno>
 #include <system_error>
@@ -71,7 +72,7 @@ struct SGR
             first = false;
         else
             seq += ";";
-        seq += std::to_string(code);
+        str::format_append(seq, code);
     }
 
     void end()
@@ -1,7 +1,6 @@
 #include "testrunner.h"
 #include "tests.h"
 #include "term.h"
-#include <fnmatch.h>
 #include <map>
 #include <algorithm>
 
@@ -52,17 +51,29 @@ unsigned long long TestCaseResult::elapsed_ns() const
  * FilteringTestController
  */
 
-bool FilteringTestController::test_method_should_run(const std::string& fullname) const
+bool FilteringTestController::test_method_should_run(std::string_view fullname) const
 {
-    if (!allowlist.empty() && fnmatch(allowlist.c_str(), fullname.c_str(), 0) == FNM_NOMATCH)
+    if (!allowlist.empty() && !allowlist.match(fullname))
         return false;
 
-    if (!blocklist.empty() && fnmatch(blocklist.c_str(), fullname.c_str(), 0) != FNM_NOMATCH)
+    if (!blocklist.empty() && blocklist.match(fullname))
         return false;
 
     return true;
 }
 
+bool FilteringTestController::test_method_should_run(std::string_view test_case, std::string_view method) const
+{
+    // Without patterns there is no need to build the full name
+    if (allowlist.empty() && blocklist.empty())
+        return true;
+
+    fullname_buffer.assign(test_case.data(), test_case.size());
+    fullname_buffer += '.';
+    fullname_buffer.append(method.data(), method.size());
+    return test_method_should_run(fullname_buffer);
+}
+
 
 /*
  * SimpleTestController
@@ -82,7 +93,8 @@ bool SimpleTestController::test_case_begin(const TestCase& test_case, const Test
     // Skip test case if all its methods should not run
     bool should_run = false;
     for (const auto& m : test_case.methods)
-        should_run |= test_method_should_run(test_case.name + "." + m.name);
+        if ((should_run = test_method_should_run(test_case.name, m.name)))
+            break;
     if (!should_run) return false;
 
     fprintf(output, "%s: ", test_case.name.c_str());
@@ -103,8 +115,7 @@ void SimpleTestController::test_case_end(const TestCase& test_case, const TestCa
 
 bool SimpleTestController::test_method_begin(const TestMethod& test_method, const TestMethodResult& test_method_result)
 {
-    string name = test_method_result.test_case + "." + test_method.name;
-    return test_method_should_run(name);
+    return test_method_should_run(test_method_result.test_case, test_method.name);
 }
 
 void SimpleTestController::test_method_end(const TestMethod& test_method, const TestMethodResult& test_method_result)
@@ -129,16 +140,30 @@ void SimpleTestController::test_method_end(const TestMethod& test_method, const
 VerboseTestController::VerboseTestController(wobble::term::Terminal& output)
     : output(output) {}
 
-static void format_elapsed(char* buf, size_t size, unsigned long long elapsed_ns)
+static std::string format_elapsed(unsigned long long elapsed_ns)
 {
+    std::string res;
     if (elapsed_ns < 1000)
-        snprintf(buf, size, "%lluns", elapsed_ns);
+    {
+        str::format_append(res, elapsed_ns);
+        res += "ns";
+    }
     else if (elapsed_ns < 1000000)
-        snprintf(buf, size, "%lluµs", elapsed_ns / 1000);
+    {
+        str::format_append(res, elapsed_ns / 1000);
+        res += "µs";
+    }
     else if (elapsed_ns < 1000000000)
-        snprintf(buf, size, "%llums", elapsed_ns / 1000000);
+    {
+        str::format_append(res, elapsed_ns / 1000000);
+        res += "ms";
+    }
     else
-        snprintf(buf, size, "%.2fs", (double)(elapsed_ns / 1000000) / 1000.0);
+    {
+        str::format_fixed_append(res, (double)(elapsed_ns / 1000000) / 1000.0, 2);
+        res += 's';
+    }
+    return res;
 }
 
 bool VerboseTestController::test_case_begin(const TestCase& test_case, const TestCaseResult& test_case_result)
@@ -146,7 +171,8 @@ bool VerboseTestController::test_case_begin(const TestCase& test_case, const Tes
     // Skip test case if all its methods should not run
     bool should_run = false;
     for (const auto& m : test_case.methods)
-        should_run |= test_method_should_run(test_case.name + "." + m.name);
+        if ((should_run = test_method_should_run(test_case.name, m.name)))
+            break;
     if (!should_run) return false;
 
     fprintf(output, "%s: setup\n", output.color_fg(term::Terminal::bright, test_case.name).c_str());
@@ -158,26 +184,23 @@ void VerboseTestController::test_case_end(const TestCase& test_case, const TestC
     if (test_case_result.skipped)
         return;
 
-    char elapsed[32];
-    format_elapsed(elapsed, 32, test_case_result.elapsed_ns());
+    string elapsed = format_elapsed(test_case_result.elapsed_ns());
     string mark;
     if (test_case_result.is_success())
         mark = output.color_fg(term::Terminal::bright | term::Terminal::green, "success");
     else
         mark = output.color_fg(term::Terminal::bright | term::Terminal::red, "failed");
-    fprintf(output, "%s: %s (%s)\n", output.color_fg(term::Terminal::bright, test_case.name).c_str(), mark.c_str(), elapsed);
+    fprintf(output, "%s: %s (%s)\n", output.color_fg(term::Terminal::bright, test_case.name).c_str(), mark.c_str(), elapsed.c_str());
 }
 
 bool VerboseTestController::test_method_begin(const TestMethod& test_method, const TestMethodResult& test_method_result)
 {
-    string name = test_method_result.test_case + "." + test_method.name;
-    return test_method_should_run(name);
+    return test_method_should_run(test_method_result.test_case, test_method.name);
 }
 
 void VerboseTestController::test_method_end(const TestMethod& test_method, const TestMethodResult& test_method_result)
 {
-    char elapsed[32];
-    format_elapsed(elapsed, 32, test_method_result.elapsed_ns);
+    string elapsed = format_elapsed(test_method_result.elapsed_ns);
 
     if (test_method_result.skipped)
     {
@@ -189,12 +212,12 @@ void VerboseTestController::test_method_end(const TestMethod& test_method, const
     else if (test_method_result.is_success())
     {
         string mark = output.color_fg(term::Terminal::bright | term::Terminal::green, mark_success);
-        fprintf(output, "%s.%s: %s (%s)\n", test_method_result.test_case.c_str(), test_method.name.c_str(), mark.c_str(), elapsed);
+        fprintf(output, "%s.%s: %s (%s)\n", test_method_result.test_case.c_str(), test_method.name.c_str(), mark.c_str(), elapsed.c_str());
     }
     else
     {
         string mark = output.color_fg(term::Terminal::bright | term::Terminal::red, mark_fail);
-        fprintf(output, "%s.%s: %s (%s)\n", test_method_result.test_case.c_str(), test_method.name.c_str(), mark.c_str(), elapsed);
+        fprintf(output, "%s.%s: %s (%s)\n", test_method_result.test_case.c_str(), test_method.name.c_str(), mark.c_str(), elapsed.c_str());
         test_method_result.print_failure_details(output);
     }
 }
@@ -384,9 +407,8 @@ void TestResultStats::print_stats(wobble::term::Terminal& out)
         fprintf(out, "%zu slowest test cases:\n\n", count);
         for (size_t i = 0; i < count; ++i)
         {
-            char elapsed[32];
-            format_elapsed(elapsed, 32, slow_test_cases[i]->elapsed_ns());
-            fprintf(out, "  %s: %s\n", slow_test_cases[i]->test_case.c_str(), elapsed);
+            string elapsed = format_elapsed(slow_test_cases[i]->elapsed_ns());
+            fprintf(out, "  %s: %s\n", slow_test_cases[i]->test_case.c_str(), elapsed.c_str());
         }
     }
 
@@ -398,9 +420,8 @@ void TestResultStats::print_stats(wobble::term::Terminal& out)
         fprintf(out, "%zu slowest test methods:\n\n", count);
         for (size_t i = 0; i < count; ++i)
         {
-            char elapsed[32];
-            format_elapsed(elapsed, 32, slow_test_methods[i]->elapsed_ns);
-            fprintf(out, "  %s.%s: %s\n", slow_test_methods[i]->test_case.c_str(), slow_test_methods[i]->test_method.c_str(), elapsed);
+            string elapsed = format_elapsed(slow_test_methods[i]->elapsed_ns);
+            fprintf(out, "  %s.%s: %s\n", slow_test_methods[i]->test_case.c_str(), slow_test_methods[i]->test_method.c_str(), elapsed.c_str());
         }
     }
 }
@@ -1,6 +1,7 @@
 #ifndef WOBBLE_TESTSRUNNER_H
 #define WOBBLE_TESTSRUNNER_H
 
+#include "string.h"
 #include <string>
 #include <vector>
 #include <functional>
@@ -191,12 +192,22 @@ struct TestController
 struct FilteringTestController : public TestController
 {
     /// Any method not matching this glob expression will not be run
-    std::string allowlist;
+    str::Glob allowlist;
 
     /// Any method matching this glob expression will not be run
-    std::string blocklist;
+    str::Glob blocklist;
 
-    bool test_method_should_run(const std::string& fullname) const;
+    bool test_method_should_run(std::string_view fullname) const;
+
+    /**
+     * Check if the method test_case.method should run, without allocating
+     * memory for the full name at each call
+     */
+    bool test_method_should_run(std::string_view test_case, std::string_view method) const;
+
+protected:
+    /// Buffer used to build testcase.testmethod names
+    mutable std::string fullname_buffer;
 };
 
 
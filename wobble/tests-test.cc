@@ -1,5 +1,6 @@
 #include "tests.h"
 #include "sys.h"
+#include <iomanip>
 
 using namespace std;
 using namespace wobble;
@@ -110,6 +111,15 @@ class Tests : public TestCase
             wassert(actual(string("abc")) == buf);
         });
 
+        add_method("location_info", []() {
+            WOBBLE_TEST_INFO(info);
+            info() << "first";
+            // info() restarts from scratch, and accepts stream manipulators
+            std::ostream& out = info();
+            out << std::hex << 255 << std::setw(5) << 1 << std::endl;
+            wassert(actual(info.str()) == "ff    1\n");
+        });
+
         add_method("function", []() {
             wassert(actual_function([]() { throw std::runtime_error("foobar"); }).throws("ooba"));
         });
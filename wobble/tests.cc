@@ -11,7 +11,6 @@
 #include "string.h"
 #include "sys.h"
 #include <cmath>
-#include <iomanip>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <regex.h>
@@ -30,17 +29,24 @@ namespace tests {
 
 std::string TestStackFrame::format() const
 {
-    std::stringstream ss;
-    format(ss);
-    return ss.str();
+    str::Appender out;
+    format(out);
+    return out.str();
 }
 
-void TestStackFrame::format(std::ostream& out) const
+void TestStackFrame::format(str::Appender& out) const
 {
     out << file << ":" << line << ":" << call;
     if (!local_info.empty())
         out << " [" << local_info << "]";
-    out << endl;
+    out << '\n';
+}
+
+void TestStackFrame::format(std::ostream& out) const
+{
+    str::Appender buf;
+    format(buf);
+    out << buf.view();
 }
 
 
@@ -48,17 +54,24 @@ void TestStackFrame::format(std::ostream& out) const
  * TestStack
  */
 
-void TestStack::backtrace(std::ostream& out) const
+void TestStack::backtrace(str::Appender& out) const
 {
     for (const auto& frame: *this)
         frame.format(out);
 }
 
+void TestStack::backtrace(std::ostream& out) const
+{
+    str::Appender buf;
+    backtrace(buf);
+    out << buf.view();
+}
+
 std::string TestStack::backtrace() const
 {
-    std::stringstream ss;
-    backtrace(ss);
-    return ss.str();
+    str::Appender out;
+    backtrace(out);
+    return out.str();
 }
 
 
@@ -118,7 +131,7 @@ std::ostream& LocationInfo::operator()()
 void assert_startswith(const std::string& actual, const std::string& expected)
 {
     if (str::startswith(actual, expected)) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "'" << actual << "' does not start with '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -126,23 +139,23 @@ void assert_startswith(const std::string& actual, const std::string& expected)
 void assert_endswith(const std::string& actual, const std::string& expected)
 {
     if (str::endswith(actual, expected)) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "'" << actual << "' does not end with '" << expected << "'";
     throw TestFailed(ss.str());
 }
 
 void assert_contains(const std::string& actual, const std::string& expected)
 {
-    if (actual.find(expected) != std::string::npos) return;
-    std::stringstream ss;
+    if (str::Searcher(expected).contained_in(actual)) return;
+    str::Appender ss;
     ss << "'" << actual << "' does not contain '" << expected << "'";
     throw TestFailed(ss.str());
 }
 
 void assert_not_contains(const std::string& actual, const std::string& expected)
 {
-    if (actual.find(expected) == std::string::npos) return;
-    std::stringstream ss;
+    if (!str::Searcher(expected).contained_in(actual)) return;
+    str::Appender ss;
     ss << "'" << actual << "' contains '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -190,7 +203,7 @@ void assert_re_matches(const std::string& actual, const std::string& expected)
 {
     Regexp re(expected.c_str());
     if (re.search(actual.c_str())) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "'" << actual << "' does not match '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -199,7 +212,7 @@ void assert_not_re_matches(const std::string& actual, const std::string& expecte
 {
     Regexp re(expected.c_str());
     if (!re.search(actual.c_str())) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "'" << actual << "' should not match '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -228,13 +241,13 @@ void ActualCString::operator==(const char* expected) const
         ;
     else if (expected)
     {
-        std::stringstream ss;
+        str::Appender ss;
         ss << "actual value is nullptr instead of the expected string \"" << str::encode_cstring(expected) << "\"";
         throw TestFailed(ss.str());
     }
     else
     {
-        std::stringstream ss;
+        str::Appender ss;
         ss << "actual value is the string \"" << str::encode_cstring(_actual) << "\" instead of nullptr";
         throw TestFailed(ss.str());
     }
@@ -364,18 +377,22 @@ void ActualDouble::almost_equal(double expected, unsigned places) const
 {
     if (round((_actual - expected) * exp10(places)) == 0.0)
         return;
-    std::stringstream ss;
-    ss << std::setprecision(places) << fixed << _actual << " is different than the expected " << expected;
-    throw TestFailed(ss.str());
+    std::string msg;
+    str::format_fixed_append(msg, _actual, places);
+    msg += " is different than the expected ";
+    str::format_fixed_append(msg, expected, places);
+    throw TestFailed(msg);
 }
 
 void ActualDouble::not_almost_equal(double expected, unsigned places) const
 {
     if (round(_actual - expected * exp10(places)) != 0.0)
         return;
-    std::stringstream ss;
-    ss << std::setprecision(places) << fixed << _actual << " is the same as the expected " << expected;
-    throw TestFailed(ss.str());
+    std::string msg;
+    str::format_fixed_append(msg, _actual, places);
+    msg += " is the same as the expected ";
+    str::format_fixed_append(msg, expected, places);
+    throw TestFailed(msg);
 }
 
 void ActualFunction::throws(const std::string& what_match) const
@@ -441,10 +458,11 @@ void ActualFile::contents_equal(const std::vector<uint8_t>& data) const
 
 void ActualFile::contents_equal(const std::initializer_list<std::string>& lines) const
 {
-    std::vector<std::string> actual_lines;
-    std::string content = str::rstrip(sys::read_file(_actual));
+    std::vector<std::string_view> actual_lines;
+    std::string data = sys::read_file(_actual);
+    std::string_view content = str::rstrip_view(data);
 
-    str::Split splitter(content, "\n");
+    str::SplitView splitter(content, "\n");
     std::copy(splitter.begin(), splitter.end(), back_inserter(actual_lines));
 
     if (actual_lines.size() != lines.size())
@@ -454,8 +472,8 @@ void ActualFile::contents_equal(const std::initializer_list<std::string>& lines)
     auto ei = lines.begin();
     for (unsigned i = 0; i < actual_lines.size(); ++i, ++ai, ++ei)
     {
-        string actual_line = str::rstrip(*ai);
-        string expected_line = str::rstrip(*ei);
+        std::string_view actual_line = str::rstrip_view(*ai);
+        std::string_view expected_line = str::rstrip_view(*ei);
         if (*ai != *ei)
             throw TestFailed("file " + _actual + " actual contents differ from expected at line #" + std::to_string(i + 1) + " ('" + str::encode_cstring(actual_line) + "' instead of '" + str::encode_cstring(expected_line) + "')");
 
@@ -467,18 +485,19 @@ void ActualFile::contents_match(const std::string& data_re) const
     std::string content = sys::read_file(_actual);
     Regexp re(data_re.c_str());
     if (re.search(content.c_str())) return;
-    std::stringstream ss;
-    ss << "file " + _actual << " contains " << str::encode_cstring(content)
+    str::Appender ss;
+    ss << "file " << _actual << " contains " << str::encode_cstring(content)
        << " which does not match " << data_re;
     throw TestFailed(ss.str());
 }
 
 void ActualFile::contents_match(const std::initializer_list<std::string>& lines_re) const
 {
-    std::vector<std::string> actual_lines;
-    std::string content = str::rstrip(sys::read_file(_actual));
+    std::vector<std::string_view> actual_lines;
+    std::string content = sys::read_file(_actual);
+    content.resize(str::rstrip_view(content).size());
 
-    str::Split splitter(content, "\n");
+    str::SplitView splitter(content, "\n");
     std::copy(splitter.begin(), splitter.end(), back_inserter(actual_lines));
 
     auto ai = actual_lines.begin();
@@ -487,7 +506,7 @@ void ActualFile::contents_match(const std::initializer_list<std::string>& lines_
     while (ei != lines_re.end())
     {
         Regexp re(ei->c_str());
-        string actual_line = ai == actual_lines.end() ? "" : str::rstrip(*ai);
+        std::string_view actual_line = ai == actual_lines.end() ? std::string_view() : str::rstrip_view(*ai);
         if (re.search(content.c_str()))
         {
             if (re.matches[0].rm_so == re.matches[0].rm_eo)
@@ -501,7 +520,7 @@ void ActualFile::contents_match(const std::initializer_list<std::string>& lines_
             continue;
         }
 
-        std::stringstream ss;
+        str::Appender ss;
         ss << "file " << _actual << " actual contents differ from expected at line #" << lineno
            << " ('" << str::encode_cstring(actual_line)
            << "' does not match '" << str::encode_cstring(*ei) << "')";
@@ -9,6 +9,7 @@
  * Copyright (C) 2003--2017  Enrico Zini <enrico@debian.org>
  */
 
+#include "string.h"
 #include <string>
 #include <sstream>
 #include <exception>
@@ -82,6 +83,8 @@ struct TestStackFrame
 
     std::string format() const;
 
+    void format(str::Appender& out) const;
+
     void format(std::ostream& out) const;
 };
 
@@ -92,6 +95,9 @@ struct TestStack : public std::vector<TestStackFrame>
     /// Return the formatted backtrace for this location
     std::string backtrace() const;
 
+    /// Append the formatted backtrace for this location to \a out
+    void backtrace(str::Appender& out) const;
+
     /// Write the formatted backtrace for this location to \a out
     void backtrace(std::ostream& out) const;
 };
@@ -161,7 +167,7 @@ template<typename A>
 void assert_true(const A& actual)
 {
     if (actual) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "actual value " << actual << " is not true";
     throw TestFailed(ss.str());
 }
@@ -173,15 +179,15 @@ template<typename A>
 void assert_false(const A& actual)
 {
     if (!actual) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "actual value " << actual << " is not false";
     throw TestFailed(ss.str());
 }
 
 void assert_false(std::nullptr_t actual);
 
-template<typename LIST>
-static inline void _format_list(std::ostream& o, const LIST& list) {
+template<typename OUT, typename LIST>
+static inline void _format_list(OUT& o, const LIST& list) {
     bool first = true;
     o << "[";
     for (const auto& v: list)
@@ -199,7 +205,7 @@ template<typename T>
 void assert_equal(const std::vector<T>& actual, const std::vector<T>& expected)
 {
     if (actual == expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value ";
     _format_list(ss, actual);
     ss << " is different than the expected ";
@@ -211,7 +217,7 @@ template<typename T>
 void assert_equal(const std::vector<T>& actual, const std::initializer_list<T>& expected)
 {
     if (actual == expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value ";
     _format_list(ss, actual);
     ss << " is different than the expected ";
@@ -227,7 +233,7 @@ template<typename A, typename E>
 void assert_equal(const A& actual, const E& expected)
 {
     if (actual == expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value '" << actual << "' is different than the expected '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -240,7 +246,7 @@ template<typename A, typename E>
 void assert_not_equal(const A& actual, const E& expected)
 {
     if (actual != expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value '" << actual << "' is not different than the expected '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -250,7 +256,7 @@ template<typename A, typename E>
 void assert_less(const A& actual, const E& expected)
 {
     if (actual < expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value '" << actual << "' is not less than the expected '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -260,7 +266,7 @@ template<typename A, typename E>
 void assert_less_equal(const A& actual, const E& expected)
 {
     if (actual <= expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value '" << actual << "' is not less than or equals to the expected '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -270,7 +276,7 @@ template<typename A, typename E>
 void assert_greater(const A& actual, const E& expected)
 {
     if (actual > expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value '" << actual << "' is not greater than the expected '" << expected << "'";
     throw TestFailed(ss.str());
 }
@@ -280,7 +286,7 @@ template<typename A, typename E>
 void assert_greater_equal(const A& actual, const E& expected)
 {
     if (actual >= expected) return;
-    std::stringstream ss;
+    str::Appender ss;
     ss << "value '" << actual << "' is not greater than or equals to the expected '" << expected << "'";
     throw TestFailed(ss.str());
 }